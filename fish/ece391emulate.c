@@ -176,6 +176,18 @@ ece391_vidmap (uint8_t** screen_start)
     return 0;
 }
 
+int32_t 
+ece391_brk (void* addr)
+{
+    return (0 == brk (addr) ? 0 : -1);
+}
+
+void* 
+ece391_sbrk (int32_t increment)
+{
+    return sbrk (increment);
+}
+
 int32_t 
 ece391_read (int32_t fd, void* buf, int32_t nbytes)
 {
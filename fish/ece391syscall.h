@@ -20,5 +20,110 @@ extern int32_t ece391_close (int32_t fd);
 extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
 
+/* 
+ * The heap starts empty; brk moves its end to an absolute address and sbrk
+ * grows it by a byte count, returning the previous end ((void*)-1 on failure).
+ * New heap pages read as zero the first time they are touched.
+ */
+extern int32_t ece391_brk (void* addr);
+extern void* ece391_sbrk (int32_t increment);
+
+/* 
+ * Shared memory: shmget returns the id of the segment named by key,
+ * creating it (size bytes, zero-filled) if needed.  shmat maps it and
+ * returns its address, which is the same in every process; shmdt unmaps
+ * it, and the contents stay for the next process to attach.  shmrm
+ * removes the segment: the key is free again and the segment is destroyed
+ * once the last process attached to it detaches.
+ */
+extern int32_t ece391_shmget (int32_t key, uint32_t size);
+extern void* ece391_shmat (int32_t id);
+extern int32_t ece391_shmdt (void* addr);
+extern int32_t ece391_shmrm (int32_t id);
+
+/* 
+ * Scheduling priority: nice adds to the caller's nice value, setpriority
+ * sets the nice value of process pid.  Nice values run from -4 (first)
+ * to 3 and are clamped to that range; processes start at 0.
+ */
+extern int32_t ece391_nice (int32_t increment);
+extern int32_t ece391_setpriority (int32_t pid, int32_t nice);
+
+/* 
+ * Timer tuning: hz is the scheduler tick rate (19 to 1000, boots at 20 or
+ * the "hz=" boot option), quantum_ms the time slice of the highest
+ * priority levels (lower levels get multiples of it).  0 keeps a value.
+ */
+extern int32_t ece391_timer_config (int32_t hz, int32_t quantum_ms);
+
+/* 
+ * Background jobs: spawn starts a program next to the caller and returns
+ * its pid at once.  waitpid collects a spawned child (pid, or -1 for any)
+ * once it has halted and stores its halt status; with WNOHANG it returns 0
+ * instead of waiting if none has halted yet.  Children still running when
+ * their parent halts are collected by nobody.
+ */
+#define WNOHANG 1
+extern int32_t ece391_spawn (const uint8_t* command);
+extern int32_t ece391_waitpid (int32_t pid, int32_t* status, int32_t options);
+
+/* 
+ * Process accounting: getstats fills buf with up to count entries, one
+ * per process, and returns how many it filled.  Times are in units of
+ * 1024 CPU cycles and only grow, so a monitor compares two snapshots.
+ */
+#define PROC_RUNNABLE 0
+#define PROC_SLEEPING 1
+#define PROC_ZOMBIE   2
+typedef struct proc_stat_t {
+    int32_t pid;
+    int32_t parent;
+    int32_t terminal;
+    int32_t nice;
+    uint32_t state;
+    uint32_t cpu;
+    uint32_t user_kcycles;
+    uint32_t kernel_kcycles;
+    uint32_t syscalls;
+    uint32_t page_faults;
+    uint32_t vol_switches;
+    uint32_t invol_switches;
+    uint8_t name[12];
+} proc_stat_t;
+extern int32_t ece391_getstats (proc_stat_t* buf, int32_t count);
+
+/* 
+ * Sleeping: nanosleep suspends the caller for the time in req (rounded up
+ * to scheduler ticks) and stores the time left, always zero, in rem if it
+ * is not NULL.  timedwait is waitpid giving up after timeout_ms
+ * milliseconds (0 only checks); it returns 0 when the time ran out.
+ */
+typedef struct timespec_t {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+} timespec_t;
+extern int32_t ece391_nanosleep (const timespec_t* req, timespec_t* rem);
+extern int32_t ece391_timedwait (int32_t pid, int32_t* status, int32_t timeout_ms);
+
+/* 
+ * Monotonic clock: nanoseconds since boot from the calibrated TSC.
+ * clock_gettime reads it with a system call; ece391_vclock_gettime (in
+ * ece391support) reads the same clock without one, off the read-only page
+ * the kernel maps at ECE391_VCLOCK_ADDR in every process.
+ */
+#define CLOCK_MONOTONIC 1
+#define ECE391_VCLOCK_ADDR 0x08823000
+typedef struct vclock_data_t {
+    volatile uint32_t seq;
+    uint32_t mult;
+    uint32_t shift;
+    uint32_t tsc_khz;
+    uint64_t base_tsc;
+    uint32_t base_sec;
+    uint32_t base_nsec;
+    uint32_t base_frac;
+} vclock_data_t;
+extern int32_t ece391_clock_gettime (int32_t clock_id, timespec_t* ts);
+
 #endif /* ECE391SYSCALL_H */
 
@@ -11,5 +11,20 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_BRK     11
+#define SYS_SBRK    12
+#define SYS_SHMGET  13
+#define SYS_SHMAT   14
+#define SYS_SHMDT   15
+#define SYS_NICE    16
+#define SYS_SETPRIORITY 17
+#define SYS_TIMER_CONFIG 18
+#define SYS_SPAWN   19
+#define SYS_WAITPID 20
+#define SYS_GETSTATS 21
+#define SYS_NANOSLEEP 22
+#define SYS_TIMEDWAIT 23
+#define SYS_CLOCK_GETTIME 24
+#define SYS_SHMRM   25
 
 #endif /* ECE391SYSNUM_H */
@@ -0,0 +1,155 @@
+/* acpi.c - Finds the ACPI system description tables the BIOS left in memory (MADT for the CPUs, ...) */
+
+#include "acpi.h"
+#include "paging.h"
+#include "lib.h"
+
+static uint32_t rsdt_addr = 0;                                  // Physical address of the RSDT, 0 until found
+
+
+/* 
+ * acpi_map()
+ *   DESCRIPTION: Makes a piece of physical memory readable by the kernel through the ACPI pages of the kernel map 
+ *                window. Only one piece is mapped at a time, so anything still needed from a table must be copied out 
+ *                before mapping the next one.
+ *   INPUTS: phys - physical address
+ *           len  - number of bytes needed, at most what fits in ACPI_KMAP_PAGES pages from phys' page on
+ *   OUTPUTS: none
+ *   RETURN VALUE: virtual address of phys, NULL if len does not fit
+ *   SIDE EFFECTS: changes the ACPI pages of the kernel map window
+ */
+void* acpi_map(uint32_t phys, uint32_t len){
+    uint32_t first = phys & ~(FRAME_SIZE-1);
+    uint32_t pages = (phys + len - first + FRAME_SIZE-1) / FRAME_SIZE;
+    uint32_t i;
+    if(len == 0 || pages > ACPI_KMAP_PAGES){
+        return NULL;
+    }
+    for(i = 0; i < pages; i++){
+        kmap(ACPI_FIRST_KMAP + i, first + i*FRAME_SIZE);
+    }
+    return (void*)(KMAP_START + ACPI_FIRST_KMAP*FRAME_SIZE + (phys - first));
+}
+
+
+/* 
+ * acpi_checksum_ok()
+ *   DESCRIPTION: Checks the byte sum the BIOS puts in every ACPI (and MP) structure
+ *   INPUTS: ptr - start of the structure
+ *           len - its length
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the bytes add up to 0 (mod 256), 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t acpi_checksum_ok(const void* ptr, uint32_t len){
+    const uint8_t* bytes = (const uint8_t*)ptr;
+    uint8_t sum = 0;
+    uint32_t i;
+    for(i = 0; i < len; i++){
+        sum += bytes[i];
+    }
+    return sum == 0;
+}
+
+
+/* 
+ * acpi_scan()
+ *   DESCRIPTION: Looks for a signature on a 16 byte boundary in a range of physical memory, one page at a time
+ *   INPUTS: start   - first physical address (16 byte aligned)
+ *           end     - first physical address past the range
+ *           sig     - signature
+ *           sig_len - its length (at most 16)
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address of the first match, 0 if there is none
+ *   SIDE EFFECTS: changes the ACPI pages of the kernel map window
+ */
+uint32_t acpi_scan(uint32_t start, uint32_t end, const char* sig, uint32_t sig_len){
+    uint32_t addr, page_end;
+    uint8_t* page;
+    for(addr = start; addr < end; addr = page_end){
+        page_end = (addr & ~(FRAME_SIZE-1)) + FRAME_SIZE;
+        if(page_end > end){
+            page_end = end;
+        }
+        page = (uint8_t*)acpi_map(addr, page_end - addr);
+        for(; addr < page_end; addr += 16, page += 16){
+            if(strncmp((const int8_t*)page, (const int8_t*)sig, sig_len) == 0){
+                return addr;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/* 
+ * find_rsdt()
+ *   DESCRIPTION: Finds the RSDP, in the first KB of the extended BIOS data area or in the BIOS ROM, and remembers 
+ *                where the RSDT it points to is
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address of the RSDT, 0 if there is no valid RSDP
+ *   SIDE EFFECTS: changes the ACPI pages of the kernel map window
+ */
+static uint32_t find_rsdt(){
+    uint32_t ebda, rsdp_addr;
+    acpi_rsdp_t* rsdp;
+    if(rsdt_addr != 0){
+        return rsdt_addr;
+    }
+    ebda = (uint32_t)(*(uint16_t*)acpi_map(BIOS_EBDA_SEG_PTR, 2)) << 4;
+    rsdp_addr = (ebda != 0) ? acpi_scan(ebda, ebda + 1024, "RSD PTR ", 8) : 0;
+    if(rsdp_addr == 0){
+        rsdp_addr = acpi_scan(BIOS_ROM_START, BIOS_ROM_END, "RSD PTR ", 8);
+    }
+    if(rsdp_addr == 0){
+        return 0;
+    }
+    rsdp = (acpi_rsdp_t*)acpi_map(rsdp_addr, sizeof(acpi_rsdp_t));
+    if(acpi_checksum_ok(rsdp, sizeof(acpi_rsdp_t))){
+        rsdt_addr = rsdp->rsdt_addr;
+    }
+    return rsdt_addr;
+}
+
+
+/* 
+ * acpi_find_table()
+ *   DESCRIPTION: Walks the RSDT for a table with the given signature ("APIC" is the MADT, "HPET", ...) and maps it
+ *   INPUTS: sig - 4 character signature
+ *   OUTPUTS: none
+ *   RETURN VALUE: the table (valid until the next acpi_map), NULL if there is no ACPI, no such table, the table is
+ *                 too large to map or its checksum is wrong
+ *   SIDE EFFECTS: changes the ACPI pages of the kernel map window
+ */
+acpi_sdt_header_t* acpi_find_table(const char* sig){
+    uint32_t tables[ACPI_MAX_TABLES];
+    uint32_t count, i, length;
+    acpi_sdt_header_t* header;
+    uint32_t rsdt = find_rsdt();
+    if(rsdt == 0){
+        return NULL;
+    }
+    header = (acpi_sdt_header_t*)acpi_map(rsdt, sizeof(acpi_sdt_header_t));
+    length = header->length;
+    if((header = (acpi_sdt_header_t*)acpi_map(rsdt, length)) == NULL){
+        return NULL;
+    }
+    count = (length - sizeof(acpi_sdt_header_t)) / 4;              // the RSDT is a header followed by 32 bit table addresses
+    if(count > ACPI_MAX_TABLES){
+        count = ACPI_MAX_TABLES;
+    }
+    memcpy(tables, header + 1, count*4);
+    for(i = 0; i < count; i++){
+        header = (acpi_sdt_header_t*)acpi_map(tables[i], sizeof(acpi_sdt_header_t));
+        if(strncmp((const int8_t*)header->signature, (const int8_t*)sig, 4) != 0){
+            continue;
+        }
+        length = header->length;
+        if((header = (acpi_sdt_header_t*)acpi_map(tables[i], length)) == NULL || !acpi_checksum_ok(header, length)){
+            return NULL;
+        }
+        return header;
+    }
+    return NULL;
+}
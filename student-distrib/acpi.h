@@ -0,0 +1,115 @@
+#ifndef _ACPI_H
+#define _ACPI_H
+
+#include "types.h"
+
+/* The tables are reached through a few pages of the kernel map window, mapped on demand */
+#define ACPI_FIRST_KMAP     4                                   // kernel map page of the first table page
+#define ACPI_KMAP_PAGES     4                                   // at most 16KB of one table visible at a time
+#define ACPI_MAX_TABLES     32                                  // RSDT entries looked at
+
+/* Where the BIOS may put the RSDP (and the MP floating pointer) */
+#define BIOS_EBDA_SEG_PTR   0x40E                               // real mode segment of the extended BIOS data area
+#define BIOS_ROM_START      0xE0000
+#define BIOS_ROM_END        0x100000
+
+/* Header shared by every ACPI system description table */
+typedef struct __attribute__((packed)) acpi_sdt_header_t {
+    char signature[4];
+    uint32_t length;                            // of the whole table, header included
+    uint8_t revision;
+    uint8_t checksum;                           // all bytes of the table add up to 0
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} acpi_sdt_header_t;
+
+/* Root System Description Pointer (ACPI 1.0 part) */
+typedef struct __attribute__((packed)) acpi_rsdp_t {
+    char signature[8];                          // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_addr;
+} acpi_rsdp_t;
+
+/* Multiple APIC Description Table ("APIC"): header, then variable length entries */
+typedef struct __attribute__((packed)) acpi_madt_t {
+    acpi_sdt_header_t header;
+    uint32_t lapic_addr;                        // physical address of every CPU's local APIC
+    uint32_t flags;                             // bit 0: the machine also has 8259 PICs
+} acpi_madt_t;
+
+/* MADT entry types */
+#define MADT_LAPIC          0                   // one CPU
+#define MADT_IOAPIC         1
+#define MADT_ISO            2                   // interrupt source override (ISA IRQ to global interrupt)
+#define MADT_LAPIC_ENABLED  0x1
+
+/* Start of every MADT entry */
+typedef struct __attribute__((packed)) madt_entry_t {
+    uint8_t type;
+    uint8_t length;
+} madt_entry_t;
+
+/* MADT_LAPIC entry */
+typedef struct __attribute__((packed)) madt_lapic_t {
+    madt_entry_t entry;
+    uint8_t acpi_id;
+    uint8_t apic_id;
+    uint32_t flags;                             // MADT_LAPIC_ENABLED if the CPU can be used
+} madt_lapic_t;
+
+/* MADT_IOAPIC entry */
+typedef struct __attribute__((packed)) madt_ioapic_t {
+    madt_entry_t entry;
+    uint8_t ioapic_id;
+    uint8_t reserved;
+    uint32_t addr;                              // physical address of its registers
+    uint32_t gsi_base;                          // global interrupt of its first input
+} madt_ioapic_t;
+
+/* MADT_ISO entry: ISA IRQ source is wired to global interrupt gsi (identity without one) */
+typedef struct __attribute__((packed)) madt_iso_t {
+    madt_entry_t entry;
+    uint8_t bus;                                // 0: ISA
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;                             // MADT_ISO_POLARITY and MADT_ISO_TRIGGER, 0 in both: ISA default
+} madt_iso_t;
+
+#define MADT_ISO_POLARITY   0x3
+#define MADT_ISO_ACTIVE_LOW 0x3
+#define MADT_ISO_TRIGGER    0xC
+#define MADT_ISO_LEVEL      0xC
+
+/* High Precision Event Timer Description Table ("HPET") */
+typedef struct __attribute__((packed)) acpi_hpet_t {
+    acpi_sdt_header_t header;
+    uint32_t block_id;                          // copy of the low half of the capabilities register
+    uint8_t address_space;                      // 0: memory
+    uint8_t register_width;
+    uint8_t register_offset;
+    uint8_t reserved;
+    uint32_t base_addr;                         // physical address of the registers (64 bit, the high half is 0 below 4GB)
+    uint32_t base_addr_high;
+    uint8_t hpet_number;
+    uint16_t min_tick;                          // smallest periodic interval without lost interrupts, in counts
+    uint8_t page_protection;
+} acpi_hpet_t;
+
+/* Maps len bytes of physical memory at phys, returns their address (valid until the next acpi_map) */
+void* acpi_map(uint32_t phys, uint32_t len);
+
+/* Scans phys [start, end) for a signature on a 16 byte boundary, returns its physical address or 0 */
+uint32_t acpi_scan(uint32_t start, uint32_t end, const char* sig, uint32_t sig_len);
+
+/* Returns 1 if the len bytes at ptr add up to 0 */
+int32_t acpi_checksum_ok(const void* ptr, uint32_t len);
+
+/* Finds the ACPI table with the given 4 character signature, returns it mapped (see acpi_map) or NULL */
+acpi_sdt_header_t* acpi_find_table(const char* sig);
+
+#endif
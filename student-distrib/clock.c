@@ -0,0 +1,156 @@
+/* clock.c - Monotonic clock from the TSC calibrated against the PIT, readable by user programs without a system call */
+
+#include "clock.h"
+#include "syscall.h"
+#include "paging.h"
+#include "pit.h"
+#include "lib.h"
+
+/* The clock's data on a page of its own: the whole page is mapped into user space, nothing else may share it */
+static union {
+    vclock_data_t data;
+    uint8_t page[FRAME_SIZE];
+} vclock_page __attribute__((aligned(FRAME_SIZE)));
+
+#define vclock  (vclock_page.data)
+
+
+/*
+ * ns_mult()
+ *   DESCRIPTION: Computes the nanoseconds per cycle scaled by 2^VCLOCK_SHIFT, 10^6 * 2^VCLOCK_SHIFT / khz, by long
+ *                division 4 bits at a time (there is no 64 bit division in the kernel)
+ *   INPUTS: khz - TSC frequency in kHz
+ *   OUTPUTS: none
+ *   RETURN VALUE: the multiplier
+ *   SIDE EFFECTS: none
+ */
+static uint32_t ns_mult(uint32_t khz){
+    uint32_t mult = 1000000 / khz;
+    uint32_t rem = 1000000 % khz;
+    uint32_t bits;
+    for(bits = 0; bits < VCLOCK_SHIFT; bits += 4){
+        rem <<= 4;
+        mult = (mult << 4) + rem / khz;
+        rem %= khz;
+    }
+    return mult;
+}
+
+
+/*
+ * vclock_read()
+ *   DESCRIPTION: Reads the time off a clock page: the base plus the cycles since base_tsc, retried while the kernel
+ *                moves the base. The same steps run in user space (ece391_clock_gettime).
+ *   INPUTS: data - clock page
+ *           ts   - where to store the time
+ *   OUTPUTS: *ts
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void vclock_read(volatile vclock_data_t* data, timespec_t* ts){
+    uint32_t seq, sec;
+    uint64_t now, nsec;
+    do{
+        seq = data->seq;
+        asm volatile("" ::: "memory");
+        rdtsc(now);
+        nsec = ((uint64_t)(uint32_t)(now - data->base_tsc) * data->mult + data->base_frac) >> data->shift;
+        nsec += data->base_nsec;
+        sec = data->base_sec;
+        asm volatile("" ::: "memory");
+    } while((seq & 1) || seq != data->seq);
+    while(nsec >= NSEC_PER_SEC){                            // at most a few seconds since the base
+        nsec -= NSEC_PER_SEC;
+        sec++;
+    }
+    ts->tv_sec = sec;
+    ts->tv_nsec = (uint32_t)nsec;
+}
+
+
+/*
+ * clock_init()
+ *   DESCRIPTION: Measures the TSC frequency against the PIT, starts the monotonic clock at zero and maps its page
+ *                read only at VCLOCK_ADDR for every process. Call after page_init and before the other CPUs start
+ *                (they copy the bootstrap processor's vidmap page table).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: uses PIT channel 2, changes paging
+ */
+void clock_init(){
+    uint32_t flags;
+    cli_and_save(flags);
+    vclock.tsc_khz = pit_calibrate_tsc();
+    vclock.shift = VCLOCK_SHIFT;
+    vclock.base_sec = 0;
+    vclock.base_nsec = 0;
+    vclock.base_frac = 0;
+    rdtsc(vclock.base_tsc);
+    vclock.mult = ns_mult(vclock.tsc_khz);
+    vclock_map((uint32_t)&vclock_page);
+    restore_flags(flags);
+}
+
+
+/*
+ * clock_tick()
+ *   DESCRIPTION: Moves the clock's base to the current TSC, so the cycles a reader converts stay few (one PIT period,
+ *                at most a tickless one-shot). The remainder of a nanosecond is carried in base_frac, so moving the
+ *                base never changes the time a reader computes. Only the PIT handler writes the page.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the clock page
+ */
+void clock_tick(){
+    uint64_t now, delta, ns;
+    if(vclock.mult == 0){                                   // not calibrated yet
+        return;
+    }
+    rdtsc(now);
+    vclock.seq++;
+    asm volatile("" ::: "memory");
+    delta = now - vclock.base_tsc;
+    while(delta > 0){
+        ns = (uint64_t)(uint32_t)((delta > 0xFFFFFFFF) ? 0xFFFFFFFF : delta);
+        delta -= ns;
+        ns = ns * vclock.mult + vclock.base_frac;
+        vclock.base_frac = (uint32_t)ns & ((1 << VCLOCK_SHIFT) - 1);
+        ns = (ns >> VCLOCK_SHIFT) + vclock.base_nsec;
+        while(ns >= NSEC_PER_SEC){
+            ns -= NSEC_PER_SEC;
+            vclock.base_sec++;
+        }
+        vclock.base_nsec = (uint32_t)ns;
+    }
+    vclock.base_tsc = now;
+    asm volatile("" ::: "memory");
+    vclock.seq++;
+}
+
+
+/*
+ * clock_read()
+ *   DESCRIPTION: Reads the monotonic clock, the time since clock_init
+ *   INPUTS: ts - where to store the time
+ *   OUTPUTS: *ts
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void clock_read(struct timespec_t* ts){
+    vclock_read(&vclock, ts);
+}
+
+
+/*
+ * clock_tsc_khz()
+ *   DESCRIPTION: Returns the TSC frequency measured by clock_init
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: TSC frequency in kHz, 0 before clock_init
+ *   SIDE EFFECTS: none
+ */
+uint32_t clock_tsc_khz(){
+    return vclock.tsc_khz;
+}
@@ -0,0 +1,40 @@
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+#include "types.h"
+
+struct timespec_t;
+
+/* Clock ids of system_clock_gettime */
+#define CLOCK_MONOTONIC     1
+
+/* Cycles to nanoseconds: ns = (cycles * mult) >> VCLOCK_SHIFT */
+#define VCLOCK_SHIFT        24
+
+/* The monotonic clock as user programs read it from their read-only page at VCLOCK_ADDR: the time at the TSC stamp
+ * base_tsc plus the cycles since, converted with mult. The kernel moves the base forward at every PIT interrupt;
+ * seq is odd while it does, a reader retries if seq was odd or changed across its read. */
+typedef struct vclock_data_t {
+    volatile uint32_t seq;
+    uint32_t mult;
+    uint32_t shift;
+    uint32_t tsc_khz;                           // TSC frequency measured at boot
+    uint64_t base_tsc;
+    uint32_t base_sec;                          // time at base_tsc
+    uint32_t base_nsec;
+    uint32_t base_frac;                         // fraction of a nanosecond at base_tsc, in units of 2^-shift
+} vclock_data_t;
+
+/* Calibrates the TSC, starts the clock at zero and maps its page into every address space */
+void clock_init();
+
+/* Moves the clock's base to now, called by the PIT handler */
+void clock_tick();
+
+/* Reads the monotonic clock */
+void clock_read(struct timespec_t* ts);
+
+/* Returns the TSC frequency in kHz, 0 before clock_init */
+uint32_t clock_tsc_khz();
+
+#endif /* _CLOCK_H */
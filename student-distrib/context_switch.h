@@ -3,10 +3,13 @@
 #include "types.h"
 #include "syscall.h"
 
-/*declare context_switch function that handles context switching in system execute*/
-extern int32_t context_switch (pcb_t* pcb, const uint32_t eip, const uint32_t cs, const uint32_t eflags,  const uint32_t esp, const uint32_t ss);
+/*declare switch_stack function that saves the current kernel stack pointer at save_esp and continues on the stack at esp*/
+extern void switch_stack (uint32_t* save_esp, uint32_t esp);
 
-/*declare restore_reg function that restores the registers and important values needed to return to system execute from system halt*/
-extern int32_t restore_reg (pcb_t* pcb);
+/*declare switch_to function that moves from the kernel stack of prev to the kernel stack of next*/
+extern void switch_to (pcb_t* prev, pcb_t* next);
+
+/*declare enter_user, the return address of a new process' first switch: irets to user mode*/
+extern void enter_user (void);
 
 #endif
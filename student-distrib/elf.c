@@ -0,0 +1,195 @@
+/* elf.c - ELF program loader: maps the PT_LOAD segments of an executable into a process' address space */
+
+#include "elf.h"
+#include "syscall.h"
+#include "page_fault.h"
+#include "filesystem.h"
+#include "lib.h"
+#include "spinlock.h"
+
+#define PAGE_OFFSET(addr)   ((addr) & (FRAME_SIZE-1))
+#define PAGE_DOWN(addr)     ((addr) & ~(FRAME_SIZE-1))
+#define PAGE_UP(addr)       PAGE_DOWN((addr) + FRAME_SIZE - 1)
+
+static elf_cache_entry_t elf_cache[ELF_CACHE_SIZE];            // Parsed headers of recently launched executables
+static uint32_t elf_cache_clock = 0;                            // Bumped by every lookup, orders the entries by last use
+static uint32_t elf_cache_hits = 0;
+static uint32_t elf_cache_misses = 0;
+static spinlock_t elf_cache_lock = SPINLOCK_INIT("elf cache");  // Guards everything above
+
+
+/*
+ * elf_parse
+ *   DESCRIPTION: Reads the ELF header and program headers of an executable and keeps its PT_LOAD segments. Only
+ *                32 bit little endian i386 executables are taken. Programs in the file system went through
+ *                elfconvert, which lays every segment out as it sits in memory: its bytes are at vaddr -
+ *                PROGRAM_IMAGE_ADDR in the file, not at the p_offset the linker wrote, so the segments we keep carry
+ *                that offset (pages then map straight onto the file). Every segment must come from inside the file,
+ *                lie in the program window from PROGRAM_IMAGE_ADDR up to the stack reservation and share no page with
+ *                the segment before it; the entry point must lie in an executable segment.
+ *   INPUTS: inode  - inode of the executable
+ *           length - its length in bytes
+ *           image  - filled in with the entry point and the segments
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the file is not an executable we can run
+ *   SIDE EFFECTS: none
+ */
+int32_t elf_parse(uint32_t inode, uint32_t length, elf_image_t* image){
+    elf32_ehdr_t ehdr;
+    elf32_phdr_t phdrs[ELF_MAX_PHDRS];
+    elf32_phdr_t* ph;
+    uint32_t i, size, prev_end = USER_START, entry_ok = 0;
+
+    if(read_data(inode, 0, (uint8_t*)&ehdr, sizeof(ehdr)) != sizeof(ehdr)){
+        return -1;
+    }
+    if(ehdr.magic != ELF_MAGIC || ehdr.class != ELF_CLASS_32 || ehdr.data != ELF_DATA_LSB || ehdr.type != ELF_TYPE_EXEC ||
+       ehdr.machine != ELF_MACHINE_386 || ehdr.phentsize != sizeof(elf32_phdr_t) || ehdr.phnum == 0 || ehdr.phnum > ELF_MAX_PHDRS){
+        return -1;
+    }
+    size = ehdr.phnum * sizeof(elf32_phdr_t);
+    if(ehdr.phoff > length || size > length - ehdr.phoff || read_data(inode, ehdr.phoff, (uint8_t*)phdrs, size) != size){
+        return -1;
+    }
+
+    image->inode = inode;
+    image->entry = ehdr.entry;
+    image->num_segments = 0;
+    for(i = 0; i < ehdr.phnum; i++){
+        ph = &phdrs[i];
+        if(ph->type != PT_LOAD || ph->memsz == 0){
+            continue;
+        }
+        if(ph->vaddr < PROGRAM_IMAGE_ADDR){
+            return -1;
+        }
+        ph->offset = ph->vaddr - PROGRAM_IMAGE_ADDR;                                // where elfconvert put it
+        if(image->num_segments == ELF_MAX_SEGMENTS || ph->filesz > ph->memsz || ph->offset > length ||
+           ph->filesz > length - ph->offset){
+            return -1;
+        }
+        if(PAGE_DOWN(ph->vaddr) < prev_end || ph->vaddr >= USER_STACK_TOP - USER_STACK_MAX ||
+           ph->memsz > USER_STACK_TOP - USER_STACK_MAX - ph->vaddr){                // in order, no shared pages, below the stack
+            return -1;
+        }
+        prev_end = PAGE_UP(ph->vaddr + ph->memsz);
+        if((ph->flags & PF_X) && ehdr.entry >= ph->vaddr && ehdr.entry < ph->vaddr + ph->memsz){
+            entry_ok = 1;
+        }
+        image->segments[image->num_segments++] = *ph;
+    }
+    return entry_ok ? 0 : -1;
+}
+
+
+/*
+ * elf_lookup
+ *   DESCRIPTION: elf_parse for execute, through a small LRU cache keyed by inode: an executable launched again
+ *                gets its entry point and segment table from the cache without reading the file. A miss parses
+ *                the file with the cache unlocked and replaces the least recently used entry (files that fail
+ *                to parse are not cached).
+ *   INPUTS: inode  - inode of the executable
+ *           length - its length in bytes
+ *           image  - filled in with the entry point and the segments
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the file is not an executable we can run
+ *   SIDE EFFECTS: may replace a cache entry
+ */
+int32_t elf_lookup(uint32_t inode, uint32_t length, elf_image_t* image){
+    uint32_t i, victim = 0, flags;
+    elf_cache_entry_t* entry;
+
+    flags = spin_lock_irqsave(&elf_cache_lock);
+    for(i = 0; i < ELF_CACHE_SIZE; i++){
+        entry = &elf_cache[i];
+        if(entry->valid && entry->image.inode == inode && entry->length == length){
+            entry->last_used = ++elf_cache_clock;
+            elf_cache_hits++;
+            *image = entry->image;
+            spin_unlock_irqrestore(&elf_cache_lock, flags);
+            return 0;
+        }
+    }
+    elf_cache_misses++;
+    spin_unlock_irqrestore(&elf_cache_lock, flags);
+
+    if(elf_parse(inode, length, image) == -1){
+        return -1;
+    }
+
+    flags = spin_lock_irqsave(&elf_cache_lock);
+    for(i = 0; i < ELF_CACHE_SIZE; i++){
+        entry = &elf_cache[i];
+        if(entry->valid && entry->image.inode == inode){                // Someone else parsed it meanwhile
+            victim = i;
+            break;
+        }
+        if(!entry->valid || (elf_cache[victim].valid && entry->last_used < elf_cache[victim].last_used)){
+            victim = i;
+        }
+    }
+    entry = &elf_cache[victim];
+    entry->valid = 1;
+    entry->length = length;
+    entry->last_used = ++elf_cache_clock;
+    entry->image = *image;
+    spin_unlock_irqrestore(&elf_cache_lock, flags);
+    return 0;
+}
+
+
+/*
+ * elf_cache_flush
+ *   DESCRIPTION: Drops every cached executable, the next launch of each parses its headers again
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void elf_cache_flush(){
+    uint32_t i, flags;
+    flags = spin_lock_irqsave(&elf_cache_lock);
+    for(i = 0; i < ELF_CACHE_SIZE; i++){
+        elf_cache[i].valid = 0;
+    }
+    spin_unlock_irqrestore(&elf_cache_lock, flags);
+}
+
+
+/*
+ * elf_cache_stats
+ *   DESCRIPTION: Reports how many elf_lookup calls were served by the cache and how many had to parse the file
+ *   INPUTS: hits   - where to store the hit count
+ *           misses - where to store the miss count
+ *   OUTPUTS: *hits, *misses
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void elf_cache_stats(uint32_t* hits, uint32_t* misses){
+    *hits = elf_cache_hits;
+    *misses = elf_cache_misses;
+}
+
+
+/*
+ * elf_map
+ *   DESCRIPTION: Gives every segment of image a file-backed VMA, from VMA_IMAGE_SLOT up. A VMA starts at the page
+ *                holding the segment's first byte and is backed by the file up to the end of the segment's file
+ *                bytes; the rest (.bss) is zero-filled by the page fault handler, nothing is read for it. Only
+ *                segments with PF_W are writable, so text pages stay read only.
+ *   INPUTS: pcb   - process being started
+ *           image - executable checked by elf_parse
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes pcb->vmas
+ */
+void elf_map(struct pcb_t* pcb, elf_image_t* image){
+    uint32_t i, start;
+    elf32_phdr_t* ph;
+    for(i = 0; i < image->num_segments; i++){
+        ph = &image->segments[i];
+        start = PAGE_DOWN(ph->vaddr);
+        vma_set(pcb, VMA_IMAGE_SLOT + i, VMA_FILE, start, ph->vaddr + ph->memsz, (ph->flags & PF_W) ? 1 : 0);
+        vma_set_file(pcb, VMA_IMAGE_SLOT + i, image->inode, ph->offset - PAGE_OFFSET(ph->vaddr), ph->filesz + PAGE_OFFSET(ph->vaddr));
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef _ELF_H
+#define _ELF_H
+
+#include "types.h"
+#include "paging.h"
+
+struct pcb_t;
+
+/* ELF header fields we check */
+#define ELF_MAGIC           0x464C457F              // "\177ELF" read as a little endian word
+#define ELF_CLASS_32        1
+#define ELF_DATA_LSB        1
+#define ELF_TYPE_EXEC       2
+#define ELF_MACHINE_386     3
+
+/* Program header types and flags */
+#define PT_LOAD             1
+#define PF_X                0x1
+#define PF_W                0x2
+#define PF_R                0x4
+
+/* Most program headers we read, and most loadable segments a process can have (one VMA each) */
+#define ELF_MAX_PHDRS       16
+#define ELF_MAX_SEGMENTS    (MAX_VMAS - VMA_IMAGE_SLOT)
+
+/* ELF file header (32 bit) */
+typedef struct elf32_ehdr_t {
+    uint32_t magic;
+    uint8_t class;
+    uint8_t data;
+    uint8_t ident_rest[10];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint32_t entry;                             // user EIP to start at
+    uint32_t phoff;                             // file offset of the program headers
+    uint32_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} elf32_ehdr_t;
+
+/* ELF program header (32 bit) */
+typedef struct elf32_phdr_t {
+    uint32_t type;
+    uint32_t offset;                            // file offset of the segment
+    uint32_t vaddr;                             // where it is mapped
+    uint32_t paddr;
+    uint32_t filesz;                            // bytes in the file
+    uint32_t memsz;                             // bytes in memory, the rest after filesz is .bss
+    uint32_t flags;                             // PF_*
+    uint32_t align;
+} elf32_phdr_t;
+
+/* What execute needs to map a program: its loadable segments and entry point */
+typedef struct elf_image_t {
+    uint32_t inode;
+    uint32_t entry;
+    uint32_t num_segments;
+    elf32_phdr_t segments[ELF_MAX_SEGMENTS];
+} elf_image_t;
+
+/* Executables whose parsed headers are kept, so launching them again reads no headers */
+#define ELF_CACHE_SIZE      8
+
+/* One cached executable, the least recently launched one is replaced first */
+typedef struct elf_cache_entry_t {
+    uint32_t valid;
+    uint32_t length;                            // file length the image was parsed at
+    uint32_t last_used;                         // elf_cache_clock at the last lookup
+    elf_image_t image;
+} elf_cache_entry_t;
+
+/* Reads and checks the ELF headers of an executable, returns 0 if it can be run */
+int32_t elf_parse(uint32_t inode, uint32_t length, elf_image_t* image);
+
+/* elf_parse through the cache of recently launched executables */
+int32_t elf_lookup(uint32_t inode, uint32_t length, elf_image_t* image);
+
+/* Empties the cache */
+void elf_cache_flush();
+
+/* Returns the cache hit and miss counts */
+void elf_cache_stats(uint32_t* hits, uint32_t* misses);
+
+/* Describes the segments of image as VMAs of a process, they are paged in on first touch */
+void elf_map(struct pcb_t* pcb, elf_image_t* image);
+
+#endif /* _ELF_H */
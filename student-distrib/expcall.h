@@ -35,7 +35,6 @@ extern void exp_SIMD_floating();
 extern void keyboard_handler();
 
 /* ERROR CODES */
-extern void exp_double_fault();
 extern void exp_invalid_tss();
 extern void exp_seg_not_present();
 extern void exp_stack_seg_fault();
@@ -52,5 +51,11 @@ extern void rtc_interrupt();
 /* PIT INTERRUPTS */
 extern void pit_interrupt(); 
 
+/* INTERRUPTS BETWEEN CPUS */
+extern void ipi_resched_interrupt();
+extern void ipi_tick_interrupt();
+extern void lapic_timer_interrupt();
+extern void spurious_interrupt();
+
 #endif /* EXPCALL_H */
 
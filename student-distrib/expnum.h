@@ -43,5 +43,11 @@
 /* SYSTEM CALL */
 #define SYSTEM_CALL 0x80
 
+/* INTERRUPTS BETWEEN CPUS (local APIC, see smp.h) */
+#define IPI_RESCHED_VECTOR  0xF0            // a process was queued on the target's run queue
+#define IPI_TICK_VECTOR     0xF1            // PIT tick forwarded by CPU 0
+#define LAPIC_TIMER_VECTOR  0xF2            // the CPU's own local APIC timer, time slicing on CPUs 1 and up
+#define SPURIOUS_VECTOR     0xFF
+
 #endif /* EXPNUM_H */
 
@@ -87,16 +87,7 @@ int32_t file_open (const uint8_t* filename){
     if (retval != 0 || dentry.file_type!=2) {                                   // If not exist or is not a normal file, we fail 
         return -1;
     }
-    int i; 
-    for(i=2; i<8; i++){                                                         // Look through thd FD array to find an open spot to store the file details 
-        if(pcb_ptr()->fds[i].flags==0){
-            pcb_ptr()->fds[i].inode_num = dentry.inode_num;                     // Initialize the paramaters within this index
-            pcb_ptr()->fds[i].file_pos = 0; 
-            pcb_ptr()->fds[i].flags = 1;
-            return i;                                                           // Return the FD array index 
-        }
-    }
-    return -1;
+    return fd_alloc(dentry.inode_num);                                          // Take an open spot in the FD array for the file, return its index 
 }
 
 /* 
@@ -108,11 +99,7 @@ int32_t file_open (const uint8_t* filename){
  *   SIDE EFFECTS: clear the flag of the fd entry in the fd array
  */
 int32_t file_close (int32_t fd){
-    if(pcb_ptr()->fds[fd].flags !=0 ){              // Access the flags value located within the FD array of our current process 
-        pcb_ptr()->fds[fd].flags = 0;               // Set the flag to 0
-        return 0; 
-    }
-    return -1; 
+    return fd_free(fd);                             // Clear the flag in the FD array of our current process 
 }
 
 
@@ -219,7 +206,7 @@ int32_t dir_write (int32_t fd, const void* buf, int32_t nbytes){
  */
 int32_t dir_open (const uint8_t* filename){
     dentry_t dentry;
-    int i, retval; 
+    int retval; 
 
     retval = read_dentry_by_name (filename, &dentry);
     // file type 1 = directory
@@ -227,18 +214,8 @@ int32_t dir_open (const uint8_t* filename){
         return -1;
     }
 
-    // 2 as stdin and stdout is the first 2, 8 as the array length is 8
-    for(i=2; i<8; i++){     
-        if(pcb_ptr()->fds[i].flags==0){
-            // ignore index node number as we are dealing with directory
-            pcb_ptr()->fds[i].inode_num=0; 
-            pcb_ptr()->fds[i].file_pos = 0; 
-            pcb_ptr()->fds[i].flags = 1;  //Mark file as in use
-            return i; 
-        }
-    }
-    // return fail if maximum number of opened file is reached
-    return -1;
+    // ignore index node number as we are dealing with directory, fail if maximum number of opened file is reached
+    return fd_alloc(0);
 }
 
 /* 
@@ -250,14 +227,8 @@ int32_t dir_open (const uint8_t* filename){
  *   SIDE EFFECTS: clear the flag inside the corresponding fd element in the array
  */
 int32_t dir_close (int32_t fd){
-    // clear flag
-    if(pcb_ptr()->fds[fd].flags !=0 ){
-        pcb_ptr()->fds[fd].flags = 0;
-        return 0; 
-    }
-
-    // else failed
-    return -1; 
+    // clear flag, fails if it was not open
+    return fd_free(fd);
 }
 
 
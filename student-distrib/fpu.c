@@ -0,0 +1,195 @@
+/* fpu.c - Lazy x87/SSE state switching: the FPU registers belong to one process at a time and change hands on #NM */
+
+#include "fpu.h"
+#include "paging.h"
+#include "lib.h"
+
+static pcb_t* cpu_fpu_owner[MAX_CPUS];                         // Process whose state is in the FPU registers of each CPU
+#define fpu_owner this_cpu_var(cpu_fpu_owner)
+static uint8_t fpu_area_used[FPU_AREAS];                        // Save areas handed out
+static uint8_t fpu_clean_state[FXSAVE_SIZE] __attribute__((aligned(16)));    // State after fninit, loaded on a process' first use
+
+
+/* Control register accessors */
+static inline uint32_t read_cr0(){
+    uint32_t val;
+    asm volatile("movl %%cr0, %0" : "=r"(val));
+    return val;
+}
+
+static inline void write_cr0(uint32_t val){
+    asm volatile("movl %0, %%cr0" : : "r"(val) : "memory");
+}
+
+static inline void fxsave(uint8_t* area){
+    asm volatile("fxsave (%0)" : : "r"(area) : "memory");
+}
+
+static inline void fxrstor(uint8_t* area){
+    asm volatile("fxrstor (%0)" : : "r"(area) : "memory");
+}
+
+
+/* 
+ * fpu_init()
+ *   DESCRIPTION: Turns on the FPU (EM clear, MP set) and SSE (CR4.OSFXSR/OSXMMEXCPT), captures the clean state every process
+ *                starts from and sets CR0.TS, so the first FPU or SSE instruction of any process raises #NM.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes CR0 and CR4
+ */
+void fpu_init(){
+    uint32_t cr4;
+    asm volatile("movl %%cr4, %0" : "=r"(cr4));
+    asm volatile("movl %0, %%cr4" : : "r"(cr4 | CR4_OSFXSR | CR4_OSXMMEXCPT));
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP);
+    asm volatile("fninit");
+    fxsave(fpu_clean_state);
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+
+/* 
+ * fpu_area_alloc()
+ *   DESCRIPTION: Hands out a free FXSAVE area, mapping a fresh frame in the kernel map window when its page is not 
+ *                backed yet
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the area, NULL if every area is taken or the frame pool is empty
+ *   SIDE EFFECTS: may allocate a frame
+ */
+static uint8_t* fpu_area_alloc(){
+    uint32_t i, page, frame;
+    for(i = 0; i < FPU_AREAS; i++){
+        if(!fpu_area_used[i]){
+            page = FPU_FIRST_KMAP + i/FPU_AREAS_PER_PAGE;
+            if(!kmap_page_table[page].present){
+                if((frame = allocate_frame()) == 0){
+                    return NULL;
+                }
+                kmap(page, frame);
+            }
+            fpu_area_used[i] = 1;
+            return (uint8_t*)(KMAP_START + FPU_FIRST_KMAP*FRAME_SIZE + i*FXSAVE_SIZE);
+        }
+    }
+    return NULL;
+}
+
+
+/* 
+ * fpu_area_free()
+ *   DESCRIPTION: Returns a save area, the frame behind its page goes back to the pool once the whole page is free
+ *   INPUTS: area - area from fpu_area_alloc
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may free a frame
+ */
+static void fpu_area_free(uint8_t* area){
+    uint32_t i = ((uint32_t)area - (KMAP_START + FPU_FIRST_KMAP*FRAME_SIZE)) / FXSAVE_SIZE;
+    uint32_t first = i - i%FPU_AREAS_PER_PAGE;
+    uint32_t j, page = FPU_FIRST_KMAP + i/FPU_AREAS_PER_PAGE;
+    fpu_area_used[i] = 0;
+    for(j = first; j < first + FPU_AREAS_PER_PAGE; j++){
+        if(fpu_area_used[j]){
+            return;
+        }
+    }
+    free_frame(kmap_page_table[page].page_base_addr << 12);
+    kunmap(page);
+}
+
+
+/* 
+ * fpu_handler()
+ *   DESCRIPTION: Device Not Available (#NM) handler, reached when a process runs an FPU/SSE instruction with CR0.TS set.
+ *                Clears TS, saves the registers of the process that last used the FPU into its area and loads the 
+ *                current process' state. A process' area is allocated here the first time it touches the FPU and 
+ *                starts out clean, processes that never use the FPU never get one.
+ *   INPUTS: vector - exception vector (7), from IDT_EXCEPTION_MACRO
+ *   OUTPUTS: prints an error if no save area is left
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes CR0.TS and the FPU registers, halts the process if it cannot get a save area
+ */
+void fpu_handler(int vector){
+    uint32_t flags;
+    pcb_t* pcb = pcb_ptr();
+
+    cli_and_save(flags);
+    write_cr0(read_cr0() & ~CR0_TS);
+    if(pcb == NULL || pcb == fpu_owner){
+        restore_flags(flags);
+        return;
+    }
+    if(fpu_owner != NULL){
+        fxsave(fpu_owner->fpu_state);
+        fpu_owner = NULL;
+    }
+    if(pcb->fpu_state == NULL){
+        if((pcb->fpu_state = fpu_area_alloc()) == NULL){
+            write_cr0(read_cr0() | CR0_TS);
+            printf("EXCEPTION: Device Not Available! (no FPU save area left)\n");
+            sti();
+            system_halt((uint8_t)256);
+        }
+        memcpy(pcb->fpu_state, fpu_clean_state, FXSAVE_SIZE);
+    }
+    fxrstor(pcb->fpu_state);
+    fpu_owner = pcb;
+    restore_flags(flags);
+}
+
+
+/* 
+ * fpu_switch()
+ *   DESCRIPTION: Arms the lazy switch for the process about to run: if its state is not the one in the FPU registers, 
+ *                CR0.TS is set and its first FPU instruction traps to fpu_handler. The owner runs with TS clear.
+ *   INPUTS: pcb - process about to run
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes CR0.TS
+ */
+void fpu_switch(pcb_t* pcb){
+    uint32_t cr0 = read_cr0();
+    uint32_t want = (pcb == fpu_owner) ? (cr0 & ~CR0_TS) : (cr0 | CR0_TS);
+    if(want != cr0){                                            // writing CR0 serializes, skip it when nothing changes
+        write_cr0(want);
+    }
+}
+
+
+/* 
+ * fpu_release()
+ *   DESCRIPTION: Forgets the FPU state of a process that halts (on whichever CPU holds it) and frees its save area
+ *   INPUTS: pcb - halting process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may free a frame
+ */
+void fpu_release(pcb_t* pcb){
+    uint32_t cpu;
+    for(cpu = 0; cpu < MAX_CPUS; cpu++){
+        if(cpu_fpu_owner[cpu] == pcb){
+            cpu_fpu_owner[cpu] = NULL;
+        }
+    }
+    if(pcb->fpu_state != NULL){
+        fpu_area_free(pcb->fpu_state);
+        pcb->fpu_state = NULL;
+    }
+}
+
+
+/* 
+ * fpu_owner_on()
+ *   DESCRIPTION: Tells which process' state a CPU holds in its FPU registers. That process cannot move to another CPU: 
+ *                its save area is out of date until the CPU saves it.
+ *   INPUTS: cpu - CPU number
+ *   OUTPUTS: none
+ *   RETURN VALUE: the owner, NULL if there is none
+ *   SIDE EFFECTS: none
+ */
+pcb_t* fpu_owner_on(uint32_t cpu){
+    return cpu_fpu_owner[cpu];
+}
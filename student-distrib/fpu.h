@@ -0,0 +1,36 @@
+#ifndef _FPU_H
+#define _FPU_H
+
+#include "types.h"
+#include "syscall.h"
+
+/* Control register bits used for lazy FPU switching */
+#define CR0_MP              0x2                                 // WAIT/FWAIT also trap while TS is set
+#define CR0_EM              0x4                                 // no FPU present (must be clear for SSE)
+#define CR0_TS              0x8                                 // task switched: the next FPU/SSE instruction raises #NM
+#define CR4_OSFXSR          0x200                               // OS saves SSE state with FXSAVE/FXRSTOR
+#define CR4_OSXMMEXCPT      0x400                               // OS handles SIMD floating point exceptions (#XM)
+
+/* FXSAVE areas: 512 bytes each, 16 byte aligned, carved from frames mapped in the kernel map window */
+#define FXSAVE_SIZE         512
+#define FPU_FIRST_KMAP      8                                   // kernel map page of the first page of save areas
+#define FPU_KMAP_PAGES      1                                   // pages of save areas (8 areas each)
+#define FPU_AREAS_PER_PAGE  (FRAME_SIZE/FXSAVE_SIZE)
+#define FPU_AREAS           (FPU_KMAP_PAGES*FPU_AREAS_PER_PAGE)
+
+/* Enables the FPU and SSE with CR0.TS set, so the first use traps */
+void fpu_init();
+
+/* #NM handler: gives the FPU to the current process, saving the previous owner's state */
+void fpu_handler(int vector);
+
+/* Sets CR0.TS unless pcb already owns the FPU registers, called whenever pcb is about to run */
+void fpu_switch(pcb_t* pcb);
+
+/* Drops the FPU state of a process that halts */
+void fpu_release(pcb_t* pcb);
+
+/* Returns the process whose state is in the FPU registers of a CPU */
+pcb_t* fpu_owner_on(uint32_t cpu);
+
+#endif
@@ -0,0 +1,246 @@
+/* hpet.c - High Precision Event Timer: a memory mapped counter and comparators, the tick source for "timer=hpet" */
+
+#include "hpet.h"
+#include "acpi.h"
+#include "paging.h"
+#include "rtc.h"
+#include "spinlock.h"
+#include "lib.h"
+
+static void hpet_periodic(uint32_t counts);
+static void hpet_oneshot(uint32_t counts);
+static uint32_t hpet_read_left();
+
+static volatile uint32_t* hpet_regs = NULL;                     // Register block, NULL until hpet_init found one
+static uint32_t hpet_freq = 0;                                  // Main counter frequency in Hz
+static uint32_t hpet_legacy = 0;                                // 1 while in legacy replacement mode
+static uint32_t hpet_armed_cmp;                                 // Comparator of timer 0's current one-shot
+static spinlock_t hpet_lock = SPINLOCK_INIT("hpet");            // Guards the configuration register and timer 1
+
+/* Timer 0 in legacy replacement mode as the tick source, filled in by hpet_init */
+static tick_source_t hpet_source = { "hpet", 0, 0, HPET_MAX_HZ, hpet_periodic, hpet_oneshot, hpet_read_left };
+
+#define hpet_reg(offset)    (hpet_regs[(offset) / 4])
+
+
+/*
+ * fs_to_hz()
+ *   DESCRIPTION: Turns the counter period into a frequency, 10^15 / period_fs, by long division (there is no 64 bit
+ *                division in the kernel): 10^9 / period_fs, then one decimal digit at a time
+ *   INPUTS: period_fs - counter period in femtoseconds, at most HPET_MAX_PERIOD_FS
+ *   OUTPUTS: none
+ *   RETURN VALUE: frequency in Hz
+ *   SIDE EFFECTS: none
+ */
+static uint32_t fs_to_hz(uint32_t period_fs){
+    uint32_t hz = 1000000000 / period_fs;
+    uint32_t rem = 1000000000 % period_fs;
+    uint32_t digits;
+    for(digits = 0; digits < 6; digits++){
+        rem *= 10;
+        hz = hz * 10 + rem / period_fs;
+        rem %= period_fs;
+    }
+    return hz;
+}
+
+
+/*
+ * hpet_init()
+ *   DESCRIPTION: Finds the HPET through its ACPI table, maps its registers (they sit in the 4MB region of the APICs,
+ *                mapped uncached) and starts the main counter from 0. Timers 0 and 1 must be able to run periodically
+ *                (timer 1 stands in for the RTC in legacy replacement mode) and the block must support legacy
+ *                replacement, which is how their interrupts reach the 8259. Call after page_init.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if there is no usable HPET
+ *   SIDE EFFECTS: changes paging, starts the main counter
+ */
+int32_t hpet_init(){
+    acpi_hpet_t* table = (acpi_hpet_t*)acpi_find_table("HPET");
+    uint32_t base, cap, period;
+    if(table == NULL || table->header.length < sizeof(acpi_hpet_t) || table->address_space != 0 || table->base_addr_high != 0){
+        return -1;
+    }
+    base = table->base_addr;
+    mmio_directory_entry_init(base);
+    hpet_regs = (volatile uint32_t*)base;
+    cap = hpet_reg(HPET_REG_CAP);
+    period = hpet_reg(HPET_REG_PERIOD);
+    if(period == 0 || period > HPET_MAX_PERIOD_FS || !(cap & HPET_CAP_LEGACY) || HPET_CAP_NUM_TIMERS(cap) < 2 ||
+       !(hpet_reg(HPET_TIMER_CONFIG(0)) & HPET_TN_PERIODIC_CAP) || !(hpet_reg(HPET_TIMER_CONFIG(1)) & HPET_TN_PERIODIC_CAP)){
+        hpet_regs = NULL;
+        return -1;
+    }
+    hpet_freq = fs_to_hz(period);
+    hpet_source.freq = hpet_freq;
+    hpet_source.max_count = 0x7FFFFFFF;                         // comparisons are done on the 32 bit counter, modulo 2^32
+    hpet_reg(HPET_REG_CONFIG) &= ~(HPET_ENABLE | HPET_LEGACY);
+    hpet_reg(HPET_TIMER_CONFIG(0)) &= ~HPET_TN_INT_ENB;
+    hpet_reg(HPET_TIMER_CONFIG(1)) &= ~HPET_TN_INT_ENB;
+    hpet_reg(HPET_REG_COUNTER) = 0;
+    hpet_reg(HPET_REG_COUNTER_HIGH) = 0;
+    hpet_reg(HPET_REG_CONFIG) |= HPET_ENABLE;
+    return 0;
+}
+
+
+/*
+ * hpet_get_freq()
+ *   DESCRIPTION: Returns the frequency of the main counter
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: counts per second, 0 without an HPET
+ *   SIDE EFFECTS: none
+ */
+uint32_t hpet_get_freq(){
+    return hpet_freq;
+}
+
+
+/*
+ * hpet_read_counter()
+ *   DESCRIPTION: Reads the low half of the main counter, one memory read (no port I/O). It wraps after 2^32 counts,
+ *                differences are taken modulo 2^32.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: counter value, 0 without an HPET
+ *   SIDE EFFECTS: none
+ */
+uint32_t hpet_read_counter(){
+    return (hpet_regs == NULL) ? 0 : hpet_reg(HPET_REG_COUNTER);
+}
+
+
+/*
+ * set_periodic()
+ *   DESCRIPTION: Runs a timer periodically: the first interrupt counts periods from now, then every counts periods
+ *                (the comparator adds the period to itself when it fires)
+ *   INPUTS: timer  - timer number
+ *           counts - periods between interrupts
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reprograms the timer
+ */
+static void set_periodic(uint32_t timer, uint32_t counts){
+    hpet_reg(HPET_TIMER_CONFIG(timer)) |= HPET_TN_INT_ENB | HPET_TN_PERIODIC | HPET_TN_VAL_SET | HPET_TN_32BIT;
+    hpet_reg(HPET_TIMER_CMP(timer)) = hpet_reg(HPET_REG_COUNTER) + counts;
+    hpet_reg(HPET_TIMER_CMP(timer)) = counts;                   // after HPET_TN_VAL_SET: the period
+}
+
+
+/*
+ * hpet_periodic()
+ *   DESCRIPTION: tick_source_t periodic: timer 0 interrupts (IRQ 0) every counts periods
+ *   INPUTS: counts - periods between interrupts
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reprograms timer 0
+ */
+static void hpet_periodic(uint32_t counts){
+    set_periodic(0, counts);
+}
+
+
+/*
+ * hpet_oneshot()
+ *   DESCRIPTION: tick_source_t oneshot: timer 0 interrupts once, counts periods from now. The comparator only fires
+ *                when the counter reaches it, so a deadline the counter passed while we programmed it would only come
+ *                around after the counter wraps: we check and push it further out if so.
+ *   INPUTS: counts - periods before the interrupt
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reprograms timer 0
+ */
+static void hpet_oneshot(uint32_t counts){
+    uint32_t config = hpet_reg(HPET_TIMER_CONFIG(0));
+    hpet_reg(HPET_TIMER_CONFIG(0)) = (config & ~HPET_TN_PERIODIC) | HPET_TN_INT_ENB | HPET_TN_32BIT;
+    if(counts < HPET_MIN_COUNTS){
+        counts = HPET_MIN_COUNTS;
+    }
+    do{
+        hpet_armed_cmp = hpet_reg(HPET_REG_COUNTER) + counts;
+        hpet_reg(HPET_TIMER_CMP(0)) = hpet_armed_cmp;
+        counts *= 2;
+    } while((int32_t)(hpet_armed_cmp - hpet_reg(HPET_REG_COUNTER)) <= 0);
+}
+
+
+/*
+ * hpet_read_left()
+ *   DESCRIPTION: tick_source_t read_left: the counts before timer 0's one-shot fires
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: counts left, 0 once it fired
+ *   SIDE EFFECTS: none
+ */
+static uint32_t hpet_read_left(){
+    int32_t left = (int32_t)(hpet_armed_cmp - hpet_reg(HPET_REG_COUNTER));
+    return (left > 0) ? (uint32_t)left : 0;
+}
+
+
+/*
+ * hpet_tick_source()
+ *   DESCRIPTION: Switches the HPET to legacy replacement mode: timer 0 takes over IRQ 0 from the PIT and timer 1 IRQ 8
+ *                from the RTC, which it keeps running at the RTC's current rate (see hpet_rtc_rate). Hand the result
+ *                to pit_use_source to move the tick.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the HPET tick source, NULL without an HPET
+ *   SIDE EFFECTS: reroutes IRQ 0 and IRQ 8
+ */
+const tick_source_t* hpet_tick_source(){
+    uint32_t flags;
+    if(hpet_regs == NULL){
+        return NULL;
+    }
+    flags = spin_lock_irqsave(&hpet_lock);
+    hpet_reg(HPET_REG_CONFIG) |= HPET_LEGACY;
+    hpet_legacy = 1;
+    set_periodic(1, hpet_freq / rtc_get_hw_freq());
+    spin_unlock_irqrestore(&hpet_lock, flags);
+    return &hpet_source;
+}
+
+
+/*
+ * hpet_release()
+ *   DESCRIPTION: Leaves legacy replacement mode and stops timers 0 and 1; IRQ 0 and IRQ 8 come from the PIT and the
+ *                RTC again. The main counter keeps running. Move the tick back to the PIT before.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reroutes IRQ 0 and IRQ 8
+ */
+void hpet_release(){
+    uint32_t flags;
+    if(hpet_regs == NULL){
+        return;
+    }
+    flags = spin_lock_irqsave(&hpet_lock);
+    hpet_reg(HPET_TIMER_CONFIG(0)) &= ~HPET_TN_INT_ENB;
+    hpet_reg(HPET_TIMER_CONFIG(1)) &= ~HPET_TN_INT_ENB;
+    hpet_reg(HPET_REG_CONFIG) &= ~HPET_LEGACY;
+    hpet_legacy = 0;
+    spin_unlock_irqrestore(&hpet_lock, flags);
+}
+
+
+/*
+ * hpet_rtc_rate()
+ *   DESCRIPTION: Called by the RTC driver when it changes the chip's periodic rate: in legacy replacement mode the
+ *                chip's interrupt no longer reaches IRQ 8, timer 1 raises it at that rate instead (rtc_handler works
+ *                unchanged). Nothing to do otherwise.
+ *   INPUTS: freq - RTC periodic interrupt rate in Hz
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may reprogram timer 1
+ */
+void hpet_rtc_rate(uint32_t freq){
+    uint32_t flags = spin_lock_irqsave(&hpet_lock);
+    if(hpet_legacy && freq != 0){
+        set_periodic(1, hpet_freq / freq);
+    }
+    spin_unlock_irqrestore(&hpet_lock, flags);
+}
@@ -0,0 +1,53 @@
+#ifndef _HPET_H
+#define _HPET_H
+
+#include "types.h"
+#include "pit.h"
+
+/* Registers, offsets from the base the ACPI HPET table gives (64 bit registers, accessed 32 bits at a time) */
+#define HPET_REG_CAP            0x000           // capabilities: number of timers, legacy replacement capable
+#define HPET_REG_PERIOD         0x004           // high half of the capabilities: counter period in femtoseconds
+#define HPET_REG_CONFIG         0x010
+#define HPET_REG_COUNTER        0x0F0           // main counter
+#define HPET_REG_COUNTER_HIGH   0x0F4
+#define HPET_TIMER_CONFIG(n)    (0x100 + 0x20*(n))
+#define HPET_TIMER_CMP(n)       (0x108 + 0x20*(n))
+
+/* HPET_REG_CAP bits */
+#define HPET_CAP_NUM_TIMERS(cap)    ((((cap) >> 8) & 0x1F) + 1)
+#define HPET_CAP_LEGACY         0x8000
+
+/* HPET_REG_CONFIG bits */
+#define HPET_ENABLE             0x1             // main counter runs
+#define HPET_LEGACY             0x2             // timer 0 drives IRQ 0 and timer 1 IRQ 8, in place of the PIT and the RTC
+
+/* HPET_TIMER_CONFIG bits */
+#define HPET_TN_INT_ENB         0x004
+#define HPET_TN_PERIODIC        0x008
+#define HPET_TN_PERIODIC_CAP    0x010
+#define HPET_TN_VAL_SET         0x040           // the next comparator write sets the comparator, the one after the period
+#define HPET_TN_32BIT           0x100
+
+#define HPET_MAX_PERIOD_FS      100000000       // the counter runs at 10MHz at least
+#define HPET_MAX_HZ             10000           // fastest tick on the HPET (0.1ms)
+#define HPET_MIN_COUNTS         64              // shortest one-shot, programming it takes about as long
+
+/* Finds the HPET through ACPI and starts its main counter, returns -1 if there is none we can use */
+int32_t hpet_init();
+
+/* Returns the main counter's frequency in Hz, 0 without an HPET */
+uint32_t hpet_get_freq();
+
+/* Reads the low half of the main counter */
+uint32_t hpet_read_counter();
+
+/* Enters legacy replacement mode and returns the HPET as a tick source for pit_use_source, NULL without an HPET */
+const tick_source_t* hpet_tick_source();
+
+/* Leaves legacy replacement mode, IRQ 0 and IRQ 8 go back to the PIT and the RTC (switch the tick back first) */
+void hpet_release();
+
+/* Runs timer 1 at the RTC's periodic rate while it stands in for the RTC on IRQ 8 */
+void hpet_rtc_rate(uint32_t freq);
+
+#endif /* _HPET_H */
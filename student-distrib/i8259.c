@@ -1,10 +1,17 @@
 /* i8259.c - Functions to interact with the 8259 interrupt controller
  * vim:ts=4 noexpandtab
  *  Research about PIC extracted from: https://wiki.osdev.org/8259_PIC
+ *  Once ioapic_init moved the IRQs to the IO APIC, the functions below drive it and the local APIC instead; the
+ *  8259 is the fallback for machines without one (or booted with "noapic").
  */
 
 #include "i8259.h"
+#include "ioapic.h"
+#include "smp.h"
 #include "lib.h"
+#include "spinlock.h"
+
+static spinlock_t pic_lock = SPINLOCK_INIT("8259");         // Guards the read-modify-write of the mask registers and the command ports
 
 
 /* 
@@ -17,8 +24,7 @@
  */
 void i8259_init(void) {
 
-    unsigned long flags;
-    cli_and_save(flags);
+    uint32_t flags = spin_lock_irqsave(&pic_lock);
 
 	outb(0xFF, PIC1_DATA);                              // mask all interrupt as it is the device's routine to open it up
 	outb(0xFF, PIC2_DATA);
@@ -42,8 +48,8 @@ void i8259_init(void) {
  	outb(0xFF, PIC1_DATA);                              // mask all interrupt again as it is part of the device's
 	outb(0xFF, PIC2_DATA);                              // initialization routine to unmask irq
 
+    spin_unlock_irqrestore(&pic_lock, flags);
     enable_irq(2);                                      // as the slave PIC is initialized, open up that particular mask (IRQ 2)
-    restore_flags(flags);
 
 }
 
@@ -59,9 +65,13 @@ void i8259_init(void) {
 void disable_irq(uint32_t irq_num) {
     uint16_t port;
     uint8_t value;
- 
-    unsigned long flags;
-    cli_and_save(flags);                    // should use spinlock instead of cli but currently spinlock is not implemented
+    uint32_t flags;
+
+    if(ioapic_active()) {
+        ioapic_mask(irq_num);
+        return;
+    }
+    flags = spin_lock_irqsave(&pic_lock);
 
     if(irq_num < 8) {                       // Check if the user wants to enable the irq in slave or master
         port = PIC1_DATA;
@@ -76,7 +86,7 @@ void disable_irq(uint32_t irq_num) {
     value = value | (1 << irq_num);         // only change that specific mask and leave others untouched
     //printf("value is %d \n", value);
     outb(value, port);
-    restore_flags(flags);
+    spin_unlock_irqrestore(&pic_lock, flags);
 }
 
 
@@ -91,9 +101,13 @@ void disable_irq(uint32_t irq_num) {
 void enable_irq(uint32_t irq_num) {
     uint16_t port;
     uint8_t value;
+    uint32_t flags;
 
-    unsigned long flags;
-    cli_and_save(flags);                        // should use spinlock instead of cli but currently spinlock is not implemented
+    if(ioapic_active()) {
+        ioapic_unmask(irq_num);
+        return;
+    }
+    flags = spin_lock_irqsave(&pic_lock);
 
     if(irq_num < 8) {                           // Check if the user wants to disable the irq in slave or master
         port = PIC1_DATA;
@@ -108,7 +122,7 @@ void enable_irq(uint32_t irq_num) {
     value = value & ~(1 << irq_num);
     //printf("value is %d \n", value);
     outb(value, port);
-    restore_flags(flags);    
+    spin_unlock_irqrestore(&pic_lock, flags);    
 }
 
 
@@ -118,12 +132,16 @@ void enable_irq(uint32_t irq_num) {
  *   INPUTS: irq_num -- indicate wether we are sending EOI to the master or the slave, should set to irq number + 8 if sending to slave PIC
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Send end-of-interrupt signal for the specified IRQ
+ *   SIDE EFFECTS: Send end-of-interrupt signal for the specified IRQ (to the local APIC under the IO APIC)
  */
 void send_eoi(uint32_t irq_num) {
+    uint32_t flags;
     //printf("sending EOI with irq_num being %d\n", irq_num);
-    unsigned long flags;
-    cli_and_save(flags);                                    // should use spinlock instead of cli but currently spinlock is not implemented
+    if(ioapic_active()) {
+        lapic_eoi();
+        return;
+    }
+    flags = spin_lock_irqsave(&pic_lock);
 
     // 8 as only 8 irq in a PIC
 	if(irq_num >= 8){
@@ -134,7 +152,7 @@ void send_eoi(uint32_t irq_num) {
     else{
         outb((EOI | irq_num), PIC1_COMMAND);
     }
-    restore_flags(flags);   
+    spin_unlock_irqrestore(&pic_lock, flags);   
 }
 
 /* 
@@ -143,12 +161,35 @@ void send_eoi(uint32_t irq_num) {
  *   INPUTS: irq_num -- indicate which irq to mask and send doi and wether we are sending EOI to the master or the slave, should set to irq number + 8 if sending to slave PIC
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Mask corresponding irq and send end-of-interrupt signal for the specified IRQ
+ *   SIDE EFFECTS: Mask corresponding irq and send end-of-interrupt signal for the specified IRQ. Under the IO APIC
+ *                 only the acknowledge is sent: the ISA IRQs are edge triggered and the handlers run with interrupts
+ *                 off until they reopen the IRQ, so masking in between would change nothing.
  */
 void mask_and_ack(uint32_t irq_num){
-    // cannot use the same spinlock in disable_irq/send_eoi as a deadlock will form. CARE!
-    // better to lock? not sure if it matters
+    if(ioapic_active()) {
+        lapic_eoi();
+        return;
+    }
+    // disable_irq and send_eoi each take pic_lock, so it must not be held here
     disable_irq(irq_num);
     send_eoi(irq_num);
 }
 
+
+/* 
+ * i8259_disable_all
+ *   DESCRIPTION: Masks every IRQ on both PICs, when the IO APIC takes over
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the previous masks, bit n set if IRQ n was masked
+ *   SIDE EFFECTS: no interrupt comes from the 8259 anymore
+ */
+uint32_t i8259_disable_all(void) {
+    uint32_t masks;
+    uint32_t flags = spin_lock_irqsave(&pic_lock);
+    masks = inb(PIC1_DATA) | (inb(PIC2_DATA) << 8);
+    outb(0xFF, PIC1_DATA);
+    outb(0xFF, PIC2_DATA);
+    spin_unlock_irqrestore(&pic_lock, flags);
+    return masks;
+}
@@ -44,6 +44,8 @@ void enable_irq(uint32_t irq_num);
 void send_eoi(uint32_t irq_num);
 /* Send mask and end-of-interrupt signal for the specified IRQ */
 void mask_and_ack(uint32_t irq_num);
+/* Mask every IRQ on both PICs, returns the previous masks */
+uint32_t i8259_disable_all(void);
 
 #endif /* _I8259_H */
 
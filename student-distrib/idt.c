@@ -5,6 +5,9 @@
 #include "syscall_handler.h"
 #include "syscall.h"
 #include "rtc.h"
+#include "smp.h"
+#include "schedule.h"
+#include "paging.h"
 
 #include "lib.h"
 
@@ -13,6 +16,131 @@
 #include "rtc.h"
 
 
+#define DOUBLE_FAULT_VIDEO      0xB8000                                             // Screen text memory, 2 bytes per cell
+#define DOUBLE_FAULT_COLS       80
+#define DOUBLE_FAULT_ATTRIB     0x7
+
+static tss_t double_fault_tss;                                                      // Task the double fault gate switches to
+static uint8_t double_fault_stack[FRAME_SIZE] __attribute__((aligned(16)));         // Its stack, in the identity mapped kernel image
+
+
+/*
+*   double_fault_write()
+*
+*   DESCRIPTION/FUNCTIONALITY: 
+*   Writes a string, and a value in hex if one is given, straight into the screen's text memory at the start of a row. The
+*   double fault task cannot use printf: putc goes through the running CPU's output terminal, which is per-CPU data.
+*
+*   INPUTS:   
+*   row      - screen row
+*   s        - string
+*   value    - value printed in hex after s
+*   hex      - nonzero to print value
+*
+*   OUTPUTS: 
+*   N/a
+*/
+static void double_fault_write(uint32_t row, const char* s, uint32_t value, uint32_t hex){
+    volatile uint8_t* cell = (volatile uint8_t*)(DOUBLE_FAULT_VIDEO + row * DOUBLE_FAULT_COLS * 2);
+    int32_t shift;
+    for(; *s != '\0'; s++, cell += 2){
+        cell[0] = *s;
+        cell[1] = DOUBLE_FAULT_ATTRIB;
+    }
+    for(shift = 28; hex && shift >= 0; shift -= 4, cell += 2){
+        cell[0] = "0123456789ABCDEF"[(value >> shift) & 0xF];
+        cell[1] = DOUBLE_FAULT_ATTRIB;
+    }
+}
+
+
+/*
+*   double_fault_task()
+*
+*   DESCRIPTION/FUNCTIONALITY: 
+*   Runs as a task of its own when a double fault is raised, on double_fault_stack. A kernel stack overflow ends up here: the
+*   page fault on the guard page cannot push its frame on the same stack, which turns it into a double fault, and CR2 still
+*   holds the guard page address. The faulting stack is unusable, so this reports and stops the CPU instead of squashing the
+*   process. Runs with interrupts off and must not touch per-CPU data: this_cpu_id() reads the task register, which now
+*   holds DOUBLE_FAULT_TSS. The task runs on CPU 0's page directory, whose video page may point at a background terminal,
+*   so it is pointed back at the screen before the report is written.
+*
+*   INPUTS:   
+*   N/a
+*
+*   OUTPUTS: 
+*   N/a
+*/
+static void double_fault_task(){
+    uint32_t addr;
+    asm volatile ("movl %%cr2, %0" : "=r"(addr));
+    cpu_first_page_table[0][VIDEO_MEM_ADDR].page_base_addr = VIDEO_MEM_ADDR;
+    asm volatile ("invlpg (%0)" : : "r"(DOUBLE_FAULT_VIDEO) : "memory");
+    if(kernel_stack_guard_hit(addr)){                                               // Ran off the bottom of a kernel stack into its guard page
+        double_fault_write(0, "EXCEPTION: Kernel Stack Overflow!", 0, 0);
+        double_fault_write(1, "guard page hit at 0x", addr, 1);
+    }
+    else{
+        double_fault_write(0, "EXCEPTION: Double Fault!", 0, 0);
+    }
+    while(1){
+        asm volatile ("cli; hlt");
+    }
+}
+
+
+/*
+*   double_fault_init()
+*
+*   DESCRIPTION/FUNCTIONALITY: 
+*   Builds the double fault task (its TSS and GDT descriptor, like the boot CPU's TSS in kernel.c) and points vector 8 at it
+*   through a task gate, so the handler gets a fresh stack whatever state the faulting stack is in. The task is shared by all
+*   CPUs: the first double fault is reported, a second one on another CPU finds the task busy and resets the machine.
+*
+*   INPUTS:   
+*   N/a
+*
+*   OUTPUTS: 
+*   N/a
+*/
+static void double_fault_init(){
+    seg_desc_t the_tss_desc;
+    the_tss_desc.granularity   = 0x0;
+    the_tss_desc.opsize        = 0x0;
+    the_tss_desc.reserved      = 0x0;
+    the_tss_desc.avail         = 0x0;
+    the_tss_desc.seg_lim_19_16 = TSS_SIZE & 0x000F0000;
+    the_tss_desc.present       = 0x1;
+    the_tss_desc.dpl           = 0x0;
+    the_tss_desc.sys           = 0x0;
+    the_tss_desc.type          = 0x9;
+    the_tss_desc.seg_lim_15_00 = TSS_SIZE & 0x0000FFFF;
+    SET_TSS_PARAMS(the_tss_desc, &double_fault_tss, tss_size);
+    double_fault_tss_desc_ptr = the_tss_desc;
+
+    double_fault_tss.cr3 = (uint32_t)cpu_page_directory[0];                        // Every CPU maps the kernel the same way
+    double_fault_tss.eip = (uint32_t)double_fault_task;
+    double_fault_tss.eflags = 0x2;                                                  // Interrupts off (bit 1 is always set)
+    double_fault_tss.esp = (uint32_t)double_fault_stack + FRAME_SIZE;
+    double_fault_tss.cs = KERNEL_CS;
+    double_fault_tss.ss = double_fault_tss.ds = double_fault_tss.es = KERNEL_DS;
+    double_fault_tss.fs = double_fault_tss.gs = KERNEL_DS;
+    double_fault_tss.ldt_segment_selector = KERNEL_LDT;
+    double_fault_tss.io_base_addr = TSS_SIZE;                                       // No I/O permission bitmap
+
+    idt[8].seg_selector = DOUBLE_FAULT_TSS;                                         // Task gate: the offset is unused
+    idt[8].offset_15_00 = 0;
+    idt[8].offset_31_16 = 0;
+    idt[8].reserved4    = 0x00;
+    idt[8].reserved3    = 1;                                                        // Reserved 1,2,3 define gate type (Task=0101)
+    idt[8].reserved2    = 0;
+    idt[8].reserved1    = 1;
+    idt[8].size         = 0;
+    idt[8].reserved0    = 0;
+    idt[8].dpl          = 0;
+    idt[8].present      = 1;
+}
+
                          
 //to get to uppercase of things, offset of 0x59
 /*
@@ -50,6 +178,19 @@ void idt_init(){
                 idt[i].dpl          = 0;                        // 0 for exception to prevent user level applications from calling into these routines with the int instruction
                 idt[i].present      = 1;                        // 1 if a table is filled
             }
+            /*Page fault: interrupt gate so CR2 is read before another fault can overwrite it*/
+            /*Device not available: interrupt gate so the FPU changes hands before anything else can run*/
+            else if(i==14 || i==7){
+                idt[i].seg_selector = KERNEL_CS;                // Needs to point to Kernel Code 
+                idt[i].reserved4    = 0x00;
+                idt[i].reserved3    = 0;                        // Reserved 1,2,3 define gate type (16b or 32b trap/interrupt) (Interrupt=1110)
+                idt[i].reserved2    = 1;                        
+                idt[i].reserved1    = 1; 
+                idt[i].size         = 1;                        // Size = 1 means 32 bits, Size = 0 means 16 bits (size of gate)
+                idt[i].reserved0    = 0;                        // Fixed to 0
+                idt[i].dpl          = 0;                        // 0 for exception to prevent user level applications from calling into these routines with the int instruction
+                idt[i].present      = 1;                        // 1 if a table is filled
+            }
             /*Reserved*/
             else if( i==15){ //15 is the index of the Reserved Exception
                 //Do Nothing
@@ -112,7 +253,7 @@ void idt_init(){
         */
 
 
-        SET_IDT_ENTRY(idt[8], exp_double_fault);         // Assembly linkage to function which saves registers and executes the interrupt handler 
+        double_fault_init();                            // Task gate: a double fault switches to a stack of its own
         SET_IDT_ENTRY(idt[10], exp_invalid_tss);
         SET_IDT_ENTRY(idt[11], exp_seg_not_present);
         SET_IDT_ENTRY(idt[12], exp_stack_seg_fault);
@@ -176,6 +317,32 @@ void idt_init(){
         SET_IDT_ENTRY(idt[33], keyboard_handler);
 
 
+    ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    //////////////////////////////////////////////////////////// INTERRUPTS BETWEEN CPUS ///////////////////////////////////////////////////////////
+    ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+        /* Reschedule (0xF0), forwarded PIT tick (0xF1), local APIC timer (0xF2), local APIC spurious interrupt (0xFF) */
+        int cpu_vectors[4] = {IPI_RESCHED_VECTOR, IPI_TICK_VECTOR, LAPIC_TIMER_VECTOR, SPURIOUS_VECTOR};
+        int j;
+        for(j = 0; j < 4; j++){
+            i = cpu_vectors[j];
+            idt[i].seg_selector = KERNEL_CS;
+            idt[i].reserved4    = 0x00;
+            idt[i].reserved3    = 0;                        // Reserved 1,2,3 define gate type (16b or 32b trap/interrupt)(Interrupt=1110)
+            idt[i].reserved2    = 1;
+            idt[i].reserved1    = 1; 
+            idt[i].size         = 1;
+            idt[i].reserved0    = 0;
+            idt[i].dpl          = 0;                        // 0 for hardware interrupt to prevent user level applications from calling into these routines with the int instruction
+            idt[i].present      = 1; 
+        }
+
+        SET_IDT_ENTRY(idt[IPI_RESCHED_VECTOR], ipi_resched_interrupt);
+        SET_IDT_ENTRY(idt[IPI_TICK_VECTOR], ipi_tick_interrupt);
+        SET_IDT_ENTRY(idt[LAPIC_TIMER_VECTOR], lapic_timer_interrupt);
+        SET_IDT_ENTRY(idt[SPURIOUS_VECTOR], spurious_interrupt);
+
+
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
     //////////////////////////////////////////////////////////// SYSTEM CALLS //////////////////////////////////////////////////////////////////////
     ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -239,7 +406,7 @@ void handler(int vector){
     else if(vector == 6){
         printf("EXCEPTION: Invalid Opcode!\n");
     }
-    else if(vector == 7){
+    else if(vector == 7){                                  // Normally handled by fpu_handler (see exp_device_unavail)
         printf("EXCEPTION: Device Not Available!\n");
     }
     else if(vector == 9){
@@ -258,10 +425,7 @@ void handler(int vector){
 
 
     /* ERROR CODES */
-    else if(vector == 8){
-        printf("EXCEPTION: Double Fault!\n");
-    }
-    else if(vector == 10){
+    else if(vector == 10){                                 // Double faults (8) go to double_fault_task instead
         printf("EXCEPTION: Invalid TSS!\n");
     }
     else if(vector == 11){
@@ -273,7 +437,7 @@ void handler(int vector){
     else if(vector == 13){
         printf("EXCEPTION: General Protection Fault!\n");
     }
-    else if(vector == 14){
+    else if(vector == 14){                                 // Normally handled by page_fault_handler (see exp_page_fault)
         printf("EXCEPTION: Page Fault!\n");
     }
     else if(vector == 17){
@@ -295,6 +459,18 @@ void handler(int vector){
     else if(vector == 33){                                 /* Keyboard index 33 on IDT*/
         key_handler();
     }
+
+    /* INTERRUPTS BETWEEN CPUS */
+    else if(vector == IPI_RESCHED_VECTOR){                 /* Another CPU queued a process here */
+        lapic_eoi();
+        sched_preempt();
+    }
+    else if(vector == IPI_TICK_VECTOR || vector == LAPIC_TIMER_VECTOR){ /* PIT tick forwarded by CPU 0, or our own timer */
+        lapic_eoi();
+        sched_tick();
+    }
+    else if(vector == SPURIOUS_VECTOR){                    /* Nothing to acknowledge */
+    }
      
     /* SYSTEM CALLS */
     else if(vector == 0x80){                                /* System call index 0x80 on IDT*/
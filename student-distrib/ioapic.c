@@ -0,0 +1,210 @@
+/* ioapic.c - IO APIC: delivers the ISA IRQs to CPU 0's local APIC in place of the 8259, see i8259.c */
+
+#include "ioapic.h"
+#include "i8259.h"
+#include "acpi.h"
+#include "paging.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "lib.h"
+
+static volatile uint32_t* ioapic_regs = NULL;                   // Register window, NULL until ioapic_init found one
+static uint32_t ioapic_on = 0;                                  // 1 once the ISA IRQs come through here
+static uint32_t isa_pin[ISA_IRQS];                              // Input each ISA IRQ is wired to
+static uint32_t isa_flags[ISA_IRQS];                            // Polarity and trigger of each, IOAPIC_ACTIVE_LOW and IOAPIC_LEVEL
+static uint32_t isa_masked = 0xFFFF;                            // Bit per ISA IRQ, a copy of the mask bits so unmasking an open IRQ costs no register access
+static spinlock_t ioapic_lock = SPINLOCK_INIT("ioapic");        // Guards the select/window register pair
+
+
+/*
+ * ioapic_read()
+ *   DESCRIPTION: Reads an IO APIC register through the select/window pair. Call with ioapic_lock held.
+ *   INPUTS: reg - register number
+ *   OUTPUTS: none
+ *   RETURN VALUE: its value
+ *   SIDE EFFECTS: none
+ */
+static uint32_t ioapic_read(uint32_t reg){
+    ioapic_regs[IOAPIC_REGSEL / 4] = reg;
+    return ioapic_regs[IOAPIC_WIN / 4];
+}
+
+
+/*
+ * ioapic_write()
+ *   DESCRIPTION: Writes an IO APIC register through the select/window pair. Call with ioapic_lock held.
+ *   INPUTS: reg - register number
+ *           val - value
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void ioapic_write(uint32_t reg, uint32_t val){
+    ioapic_regs[IOAPIC_REGSEL / 4] = reg;
+    ioapic_regs[IOAPIC_WIN / 4] = val;
+}
+
+
+/*
+ * find_ioapic()
+ *   DESCRIPTION: Finds the IO APIC of the ISA IRQs (the one whose inputs start at global interrupt 0) in the ACPI
+ *                MADT, and where each ISA IRQ is wired: input n for IRQ n, polarity and trigger of the ISA bus
+ *                (active high, edge), unless an interrupt source override says otherwise.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address of its registers, 0 if there is none
+ *   SIDE EFFECTS: fills isa_pin and isa_flags, changes the ACPI pages of the kernel map window
+ */
+static uint32_t find_ioapic(){
+    acpi_madt_t* madt = (acpi_madt_t*)acpi_find_table("APIC");
+    madt_entry_t* entry;
+    madt_ioapic_t* ioapic;
+    madt_iso_t* iso;
+    uint32_t irq, addr = 0;
+    uint8_t* end;
+    if(madt == NULL){
+        return 0;
+    }
+    for(irq = 0; irq < ISA_IRQS; irq++){
+        isa_pin[irq] = irq;
+        isa_flags[irq] = 0;
+    }
+    end = (uint8_t*)madt + madt->header.length;
+    for(entry = (madt_entry_t*)(madt + 1); (uint8_t*)entry < end && entry->length > 0;
+        entry = (madt_entry_t*)((uint8_t*)entry + entry->length)){
+        if(entry->type == MADT_IOAPIC && ((madt_ioapic_t*)entry)->gsi_base == 0){
+            ioapic = (madt_ioapic_t*)entry;
+            addr = ioapic->addr;
+        }
+        else if(entry->type == MADT_ISO && ((madt_iso_t*)entry)->bus == 0 && ((madt_iso_t*)entry)->source < ISA_IRQS){
+            iso = (madt_iso_t*)entry;
+            isa_pin[iso->source] = iso->gsi;
+            isa_flags[iso->source] = (((iso->flags & MADT_ISO_POLARITY) == MADT_ISO_ACTIVE_LOW) ? IOAPIC_ACTIVE_LOW : 0) |
+                                     (((iso->flags & MADT_ISO_TRIGGER) == MADT_ISO_LEVEL) ? IOAPIC_LEVEL : 0);
+        }
+    }
+    return addr;
+}
+
+
+/*
+ * ioapic_init()
+ *   DESCRIPTION: Moves the ISA IRQs from the 8259 to the IO APIC: every input is masked, each ISA IRQ gets the vector
+ *                it had on the 8259 (ICW2_MASTER + irq) with fixed delivery to CPU 0, the IRQs the 8259 had open are
+ *                opened here and the 8259 is masked for good. CPU 0's LINT0 stops passing the 8259 through. From then
+ *                on enable_irq, disable_irq, send_eoi and mask_and_ack go to the IO APIC and the local APIC (one
+ *                memory write to acknowledge instead of port I/O). Without an IO APIC in the MADT or a local APIC the
+ *                8259 stays. Call after clock_init (setting up the local APIC calibrates its timer), with interrupts
+ *                off.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the 8259 stays
+ *   SIDE EFFECTS: changes paging, reroutes every ISA IRQ
+ */
+int32_t ioapic_init(){
+    uint32_t addr, pins, pin, irq, open, flags;
+    if((addr = find_ioapic()) == 0 || lapic_setup() == -1){
+        return -1;
+    }
+    mmio_directory_entry_init(addr);
+    ioapic_regs = (volatile uint32_t*)addr;
+    flags = spin_lock_irqsave(&ioapic_lock);
+    pins = ((ioapic_read(IOAPIC_REG_VER) >> 16) & 0xFF) + 1;
+    for(pin = 0; pin < pins; pin++){
+        ioapic_write(IOAPIC_REDTBL(pin), IOAPIC_MASKED);
+    }
+    for(irq = 0; irq < ISA_IRQS; irq++){
+        if(irq != ISA_CASCADE_IRQ && isa_pin[irq] < pins){
+            ioapic_write(IOAPIC_REDTBL(isa_pin[irq]) + 1, cpus[0].apic_id << 24);
+            ioapic_write(IOAPIC_REDTBL(isa_pin[irq]), IOAPIC_MASKED | isa_flags[irq] | (ICW2_MASTER + irq));
+        }
+    }
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+    open = ~i8259_disable_all();
+    ioapic_on = 1;
+    lapic_init();
+    for(irq = 0; irq < ISA_IRQS; irq++){
+        if((open & (1 << irq)) && irq != ISA_CASCADE_IRQ && isa_pin[irq] < pins){
+            ioapic_unmask(irq);
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * ioapic_active()
+ *   DESCRIPTION: Tells whether the ISA IRQs come through the IO APIC
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 after ioapic_init succeeded, 0 while the 8259 delivers them
+ *   SIDE EFFECTS: none
+ */
+uint32_t ioapic_active(){
+    return ioapic_on;
+}
+
+
+/*
+ * ioapic_mask()
+ *   DESCRIPTION: Masks an ISA IRQ at its IO APIC input
+ *   INPUTS: irq - ISA IRQ number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes its redirection entry
+ */
+void ioapic_mask(uint32_t irq){
+    uint32_t flags;
+    if(irq >= ISA_IRQS || irq == ISA_CASCADE_IRQ){
+        return;
+    }
+    flags = spin_lock_irqsave(&ioapic_lock);
+    if(!(isa_masked & (1 << irq))){
+        isa_masked |= 1 << irq;
+        ioapic_write(IOAPIC_REDTBL(isa_pin[irq]), ioapic_read(IOAPIC_REDTBL(isa_pin[irq])) | IOAPIC_MASKED);
+    }
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+
+/*
+ * ioapic_unmask()
+ *   DESCRIPTION: Unmasks an ISA IRQ at its IO APIC input. The handlers reopen their IRQ after every interrupt
+ *                (enable_irq), which costs nothing here: the IRQ never got masked.
+ *   INPUTS: irq - ISA IRQ number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes its redirection entry
+ */
+void ioapic_unmask(uint32_t irq){
+    uint32_t flags;
+    if(irq >= ISA_IRQS || irq == ISA_CASCADE_IRQ || !(isa_masked & (1 << irq))){
+        return;
+    }
+    flags = spin_lock_irqsave(&ioapic_lock);
+    if(isa_masked & (1 << irq)){
+        isa_masked &= ~(1 << irq);
+        ioapic_write(IOAPIC_REDTBL(isa_pin[irq]), ioapic_read(IOAPIC_REDTBL(isa_pin[irq])) & ~IOAPIC_MASKED);
+    }
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+
+/*
+ * ioapic_irq_entry()
+ *   DESCRIPTION: Reads the low half of the redirection entry of an ISA IRQ: vector, polarity, trigger and mask bit
+ *   INPUTS: irq - ISA IRQ number
+ *   OUTPUTS: none
+ *   RETURN VALUE: the entry, 0 without an IO APIC
+ *   SIDE EFFECTS: none
+ */
+uint32_t ioapic_irq_entry(uint32_t irq){
+    uint32_t flags, entry;
+    if(ioapic_regs == NULL || irq >= ISA_IRQS){
+        return 0;
+    }
+    flags = spin_lock_irqsave(&ioapic_lock);
+    entry = ioapic_read(IOAPIC_REDTBL(isa_pin[irq]));
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+    return entry;
+}
@@ -0,0 +1,33 @@
+#ifndef _IOAPIC_H
+#define _IOAPIC_H
+
+#include "types.h"
+
+/* IO APIC registers: IOAPIC_REGSEL selects one, IOAPIC_WIN reads or writes it */
+#define IOAPIC_REGSEL       0x00
+#define IOAPIC_WIN          0x10
+#define IOAPIC_REG_VER      0x01                // bits 16-23: number of inputs - 1
+#define IOAPIC_REDTBL(pin)  (0x10 + 2 * (pin))  // redirection entry of an input, low half (the high half follows)
+
+/* Redirection entry bits, low half (fixed delivery to the APIC id in bits 24-31 of the high half) */
+#define IOAPIC_ACTIVE_LOW   0x2000
+#define IOAPIC_LEVEL        0x8000
+#define IOAPIC_MASKED       0x10000
+
+#define ISA_IRQS            16
+#define ISA_CASCADE_IRQ     2                   // the slave 8259, no device behind it
+
+/* Routes the ISA IRQs through the IO APIC to CPU 0, taking over from the 8259 */
+int32_t ioapic_init();
+
+/* Returns 1 once the IO APIC delivers the ISA IRQs */
+uint32_t ioapic_active();
+
+/* Masks and unmasks an ISA IRQ at the IO APIC */
+void ioapic_mask(uint32_t irq);
+void ioapic_unmask(uint32_t irq);
+
+/* Returns the low half of the redirection entry of an ISA IRQ */
+uint32_t ioapic_irq_entry(uint32_t irq);
+
+#endif /* _IOAPIC_H */
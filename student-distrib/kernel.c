@@ -14,15 +14,65 @@
 #include "filesystem.h"
 #include "syscall.h"
 #include "pit.h"
+#include "schedule.h"
+#include "fpu.h"
+#include "smp.h"
+#include "workqueue.h"
 
 
 #include "paging.h"
+#include "clock.h"
+#include "hpet.h"
+#include "ioapic.h"
 #define RUN_TESTS
 
 /* Macros. */
 /* Check if the bit BIT in FLAGS is set. */
 #define CHECK_FLAG(flags, bit)   ((flags) & (1 << (bit)))
 
+static int use_ioapic = 1;                  /* cleared by "noapic": interrupts stay on the 8259 */
+
+/* parse_cmdline
+ *   DESCRIPTION: Applies the scheduler options of the boot command line, in order: "timer=hpet" moves the tick to the
+ *                HPET, "hz=<ticks per second>" sets the tick frequency (up to 1000 on the PIT, more on the HPET) and
+ *                "quantum=<milliseconds>" the scheduling quantum. "noapic" keeps the interrupts on the 8259. Other
+ *                words are ignored, and so are values out of range (the defaults stay).
+ *   INPUTS: cmdline - NUL terminated command line from the boot loader
+ *   OUTPUTS: prints the options it rejects
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may reprogram the PIT or the HPET */
+static void parse_cmdline(const char* cmdline) {
+    const char* p = cmdline;
+    uint32_t value;
+    int is_hz;
+    const tick_source_t* source;
+    while (*p != '\0') {
+        while (*p == ' ')
+            p++;
+        is_hz = (strncmp((const int8_t*)p, (const int8_t*)"hz=", 3) == 0);
+        if (is_hz || strncmp((const int8_t*)p, (const int8_t*)"quantum=", 8) == 0) {
+            p += is_hz ? 3 : 8;
+            value = 0;
+            while (*p >= '0' && *p <= '9')
+                value = value * 10 + (*p++ - '0');
+            if ((is_hz ? pit_set_hz(value) : sched_set_quantum(value)) == -1)
+                printf("cmdline: ignoring %s=%u\n", is_hz ? "hz" : "quantum", value);
+        }
+        else if (strncmp((const int8_t*)p, (const int8_t*)"timer=hpet", 10) == 0) {
+            source = hpet_tick_source();
+            if (source == NULL || pit_use_source(source) == -1) {
+                hpet_release();
+                printf("cmdline: no HPET, the tick stays on the PIT\n");
+            }
+        }
+        else if (strncmp((const int8_t*)p, (const int8_t*)"noapic", 6) == 0) {
+            use_ioapic = 0;
+        }
+        while (*p != ' ' && *p != '\0')
+            p++;
+    }
+}
+
 /* Check if MAGIC is valid and print the Multiboot information structure
    pointed by ADDR. */
 void entry(unsigned long magic, unsigned long addr) {
@@ -169,6 +219,23 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Init Paging */
     page_init();
 
+    /* Calibrate the TSC and start the monotonic clock, its page is mapped for every process */
+    clock_init();
+
+    /* Init HPET, if the machine has one the tick can move to it */
+    hpet_init();
+
+    /* Timer source, frequency and time slice from the boot command line */
+    if (CHECK_FLAG(mbi->flags, 2))
+        parse_cmdline((char *)mbi->cmdline);
+
+    /* Route the ISA IRQs through the IO APIC to the local APIC, the 8259 stays without one (or with "noapic") */
+    if (use_ioapic && ioapic_init() == -1)
+        printf("No IO APIC, interrupts stay on the 8259\n");
+
+    /* Init FPU/SSE, switched lazily */
+    fpu_init();
+
     /* Init Terminal Structs */
     terminals_init();
     
@@ -182,9 +249,17 @@ void entry(unsigned long magic, unsigned long addr) {
     /* Run tests */
     launch_tests();
 #endif
+    /* Start the other CPUs, they wait for the kernel lock until we idle */
+    smp_init();
+
+    /* Start the kernel thread that runs interrupt bottom halves */
+    workqueue_init();
+
     /* Execute the first program ("shell") ... */
+    /* ... on every terminal: queue their base shells, the PIT switches to them from now on */
+    scheduler_init();
 
-    /* Spin (nicely, so we don't chew up cycles) */
-    asm volatile (".1: hlt; jmp .1;");
+    /* Spin (nicely, so we don't chew up cycles): this is CPU 0's idle thread, the PIT is one-shot while we sit here */
+    cpu_idle();
 }
 
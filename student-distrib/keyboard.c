@@ -2,6 +2,7 @@
 
 #include "keyboard.h"
 #include "lib.h"
+#include "workqueue.h"
 
 
 /* TABLE MAPPING KEYCODES TO CHARACTERS */
@@ -100,6 +101,8 @@ char scankey_to_character[172] = {
  /* Global Variables Used for the 3 Terminals */ 
     terminal_t all_terminal_data[3];                // Keyboard Buffers for the 3 Terminals
     static int terminal_num = 1; 
+    static int cpu_output_terminal[MAX_CPUS] = { [0 ... MAX_CPUS-1] = 1 };  // Terminal that printf/putc currently draw on, per CPU
+    #define output_terminal this_cpu_var(cpu_output_terminal)
 
 
 /* Global Variables Used in key_handler() */ 
@@ -111,6 +114,14 @@ char scankey_to_character[172] = {
     char backspace = '\b';
     uint32_t demo;
 
+/* Scancodes captured by key_handler, waiting for key_work */
+    static uint8_t scancodes[SCANCODE_QUEUE_SIZE];
+    static uint32_t scancode_head = 0;              // Next scancode key_work takes 
+    static uint32_t scancode_count = 0;
+    static spinlock_t scancode_lock = SPINLOCK_INIT("keyboard");
+    static void key_work(void* arg);
+    static work_t key_work_item = WORK_INIT(key_work, NULL);
+
 
 /* 
  * terminal_data(int num)
@@ -144,6 +155,9 @@ void terminals_init(){
         all_terminal_data[i].cursor[0] = 0; 
         all_terminal_data[i].cursor[1] = 0; 
         all_terminal_data[i].last_run_pcb = NULL;       // Set last run pcb to NULL 
+        all_terminal_data[i].readers.head = NULL;       // Nobody is waiting for input yet 
+        all_terminal_data[i].readers.tail = NULL;
+        mutex_init(&all_terminal_data[i].lock, "terminal");
     }
     
 }
@@ -175,6 +189,76 @@ int get_seen_terminal_num(){
 }
 
 
+/* 
+ * set_output_terminal(int num)
+ *   DESCRIPTION: Makes printf/putc draw on terminal num. The cursor of the terminal we stop drawing on is saved in its 
+ *                terminal struct and the one of terminal num is loaded. Video memory is mapped to the screen when num is 
+ *                the seen terminal and to num's background page otherwise. 
+ *   INPUTS: num - terminal to draw on
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: the terminal that was drawn on before 
+ *   SIDE EFFECTS: remaps video memory, changes screen_x and screen_y 
+ */
+int set_output_terminal(int num){
+    int prev = output_terminal; 
+    all_terminal_data[prev-1].cursor[0] = get_screen_x();              // Save where the previous terminal's text ends 
+    all_terminal_data[prev-1].cursor[1] = get_screen_y();
+    output_terminal = num; 
+    copy_terminal_data((num == terminal_num) ? 0 : num);                // 0 = physical video memory 
+    set_screen_x(all_terminal_data[num-1].cursor[0]);
+    set_screen_y(all_terminal_data[num-1].cursor[1]);
+    return prev; 
+}
+
+
+/* 
+ * output_terminal_load()
+ *   DESCRIPTION: Picks up drawing on this CPU's output terminal where the last CPU in the kernel left it: loads the 
+ *                terminal's cursor and, if the seen terminal changed meanwhile, points video memory at the screen or 
+ *                at the terminal's background page. Called when the CPU takes the kernel lock. 
+ *   INPUTS: none
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: none 
+ *   SIDE EFFECTS: may remap video memory, changes screen_x and screen_y 
+ */
+void output_terminal_load(){
+    int target = (output_terminal == terminal_num) ? 0 : output_terminal;
+    if(first_page_table[VIDEO_MEM_ADDR].page_base_addr != VIDEO_MEM_ADDR + target){
+        copy_terminal_data(target);
+    }
+    set_screen_x(all_terminal_data[output_terminal-1].cursor[0]);
+    set_screen_y(all_terminal_data[output_terminal-1].cursor[1]);
+}
+
+
+/* 
+ * output_terminal_save()
+ *   DESCRIPTION: Saves the cursor of this CPU's output terminal in its terminal struct, called when the CPU releases 
+ *                the kernel lock 
+ *   INPUTS: none
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: none 
+ *   SIDE EFFECTS: none 
+ */
+void output_terminal_save(){
+    all_terminal_data[output_terminal-1].cursor[0] = get_screen_x();
+    all_terminal_data[output_terminal-1].cursor[1] = get_screen_y();
+}
+
+
+/* 
+ * get_output_terminal()
+ *   DESCRIPTION: Returns the terminal that printf/putc currently draw on
+ *   INPUTS: none
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: output terminal number 
+ *   SIDE EFFECTS: none 
+ */
+int get_output_terminal(){
+    return output_terminal; 
+}
+
+
 /* 
  * keyboard_init()
  *   DESCRIPTION: Initializes communication with the keyboard
@@ -275,24 +359,22 @@ void update_cursor(int x, int y)
 
 
 /* 
- * key_handler()
+ * key_input()
  *   DESCRIPTION: Prints a character to the screen when its correpsponding key is pressed.  
- *   INPUTS: none  
+ *   INPUTS: scancode - key event read by key_handler  
  *   OUTPUTS: Prints data from keyboard to the screen. 
  *   RETURN VALUE: none 
  *   SIDE EFFECTS: Prints data from keyboard to the screen. 
  */
-void key_handler(){
+static void key_input(uint8_t scancode){
 
-    /* Handler Preparation */
-    mask_and_ack(KEYBOARD_IRQ_NUM);                                 // Disable Interrupts 
     int clear_flag = 0;                                             // Indicates whether screen needs to be cleared
 
     /* Set cursor */
     update_cursor(get_screen_x(), get_screen_y());                  // Puts the cursor in the correct position 
     
-    /* Reading from Keyboard */ 
-    demo = inb(KEYBOARD_PORT);                                      // Read keypress from keyboard
+    /* Key from the Keyboard */ 
+    demo = scancode;
     
     /* Check if ENTER is Pressed */               
     if(demo==ENTER_PRESS){
@@ -315,7 +397,6 @@ void key_handler(){
 
     /* Do not BACKSPACE if we have backspaced the entire buffer */
     else if(demo==BACKSPACE_PRESS && (all_terminal_data[terminal_num-1].next_index==0)){
-        enable_irq(KEYBOARD_IRQ_NUM);
         return;
     }
 
@@ -368,42 +449,15 @@ void key_handler(){
             clear_flag=1;
         }
 
-        /* Check if ALT - F1 is Pressed (switch to Terminal 1) */
-        if(alt_pressed==1 && demo==F1_PRESS){                                                                                           
+        /* Check if ALT - F1/F2/F3 is Pressed (switch to Terminal 1/2/3) */
+        if(alt_pressed==1 && (demo==F1_PRESS || demo==F2_PRESS || demo==F3_PRESS)){
             memcpy(terminal_addr_ptr(terminal_num), get_vid_mem_ptr(), 4096);                   // Store what is in video memory into the page of the terminal we are LEAVING 
-            all_terminal_data[terminal_num-1].last_run_pcb = pcb_ptr();                         // Store the last_run_pcb into the terminal struct for the terminal we are LEAVING
-            terminal_num=1;                             
-            set_screen_x(all_terminal_data[terminal_num-1].cursor[0]);                          // Set the position of the cursor such that is aligns with the terminal we are ENTERING
-            set_screen_y(all_terminal_data[terminal_num-1].cursor[1]);
+            terminal_num = demo - F1_PRESS + 1;                                                 // F1, F2, F3 have consecutive keycodes 
+            set_output_terminal(terminal_num);                                                  // Draw on the screen again and load the cursor of the terminal we are ENTERING
             memcpy(get_vid_mem_ptr(), terminal_addr_ptr(terminal_num), 4096);                   // Store what is in the page of the terminal we are ENTERING into video memory 
-            //load_4MB_syscall_page(0);                                                         // (SCHEDULING) - Map the Program Image to the Shell for Terminal 1
-            //change_global_pcb(all_terminal_data[0].last_run_pcb);                             // (SCHEDULING) - Change the global pcb in syscall.c to be the last_run_pcb of terminal 1 
+            update_cursor(get_screen_x(), get_screen_y());
         }
 
-        /* Check if ALT - F2 is Pressed (switch to Terminal 2) */
-        if(alt_pressed==1 && demo==F2_PRESS){                                                                                                        
-            memcpy(terminal_addr_ptr(terminal_num), get_vid_mem_ptr(), 4096);                   // Store what is in video memory into the page of the terminal we are LEAVING 
-            all_terminal_data[terminal_num-1].last_run_pcb = pcb_ptr();                         // Store the last_run_pcb into the terminal struct for the terminal we are LEAVING
-            terminal_num=2; 
-            set_screen_x(all_terminal_data[terminal_num-1].cursor[0]);                          // Set the position of the cursor such that is aligns with the terminal we are ENTERING
-            set_screen_y(all_terminal_data[terminal_num-1].cursor[1]);
-            memcpy(get_vid_mem_ptr(), terminal_addr_ptr(terminal_num), 4096);                   // Store what is in the page of the terminal we are ENTERING into video memory
-            //load_4MB_syscall_page(1);                                                         // (SCHEDULING) - Map the Program Image to the Shell for Terminal 2
-            //change_global_pcb(all_terminal_data[1].last_run_pcb);                             // (SCHEDULING) - Change the global pcb in syscall.c to be the last_run_pcb of terminal 2 
-        }
-
-        /* Check if ALT - F3 is Pressed (switch to Terminal 3) */
-        if(alt_pressed==1 && demo==F3_PRESS){                                                                                                         
-            memcpy(terminal_addr_ptr(terminal_num), get_vid_mem_ptr(), 4096);                   // Store what is in video memory into the page of the terminal we are LEAVING
-            all_terminal_data[terminal_num-1].last_run_pcb = pcb_ptr();                         // Store the last_run_pcb into the terminal struct for the terminal we are LEAVING
-            terminal_num=3;
-            set_screen_x(all_terminal_data[terminal_num-1].cursor[0]);                          // Set the position of the cursor such that is aligns with the terminal we are ENTERING
-            set_screen_y(all_terminal_data[terminal_num-1].cursor[1]);
-            memcpy(get_vid_mem_ptr(), terminal_addr_ptr(terminal_num), 4096);                   // Store what is in the page of the terminal we are ENTERING into video memory
-            //load_4MB_syscall_page(2);                                                         // (SCHEDULING) - Map the Program Image to the Shell for Terminal 3
-            //change_global_pcb(all_terminal_data[2].last_run_pcb);                             // (SCHEDULING) - Change the global pcb in syscall.c to be the last_run_pcb of terminal 3
-        }
-         
         /* Check of TAB is Pressed and we are at the bottom right corner of the screen */
         if(demo==TAB_PRESS && get_screen_y()==24 && get_screen_x()>=76){
             all_terminal_data[terminal_num-1].keys[all_terminal_data[terminal_num-1].next_index]='\t';                                          // Store tab in our buffer 
@@ -411,7 +465,6 @@ void key_handler(){
             vertical_shift();                                               // Vertical Shift if this is the case 
             set_screen_x((x+4)%80);                                         // Restore to correct screen_x value on our new line 
             all_terminal_data[terminal_num-1].next_index++; 
-            enable_irq(KEYBOARD_IRQ_NUM);
             return;
         }
         int flag_period=0;
@@ -474,7 +527,6 @@ void key_handler(){
         // If we are at the bottom right corner of the screen -> vertical_shift() 
         if((get_screen_x()==79 && get_screen_y()==24)){                 
             vertical_shift();
-            enable_irq(KEYBOARD_IRQ_NUM);   
             return;
         }
         
@@ -482,14 +534,76 @@ void key_handler(){
         // NOTE: only 80 chars can fit on one row in our terminal when typing 
         if(get_screen_y()<24 && get_screen_x()==79){ 
             printf("%c",'\n');
-            enable_irq(KEYBOARD_IRQ_NUM);   
             return;
         }
         
     }
-   
-    // Re-enable interrupts and send EOI to PIC for IRQ1
-    enable_irq(KEYBOARD_IRQ_NUM);             
+}
+
+
+/* 
+ * key_work()
+ *   DESCRIPTION: Bottom half of the keyboard interrupt, run by the worker thread. Every key is echoed on the seen 
+ *                terminal, so output is pointed there for the duration of key_input and handed back afterwards (an 
+ *                ALT+Fn key changes the seen terminal for the keys after it). Processes blocked in terminal_read on 
+ *                that terminal are woken to look at the new key. Interrupts stay on throughout. The terminal lock is 
+ *                a mutex, so a reader that finds it taken sleeps instead of spinning, and preemption is off while 
+ *                output points at the typed-on terminal: nothing else draws in between.  
+ *   INPUTS: arg - unused  
+ *   OUTPUTS: Prints data from keyboard to the screen. 
+ *   RETURN VALUE: none 
+ *   SIDE EFFECTS: Prints data from keyboard to the screen, may switch processes. 
+ */
+static void key_work(void* arg){
+    uint32_t flags;
+    uint8_t scancode;
+    int typed_on, prev;
+    while(1){
+        flags = spin_lock_irqsave(&scancode_lock);
+        if(scancode_count == 0){
+            spin_unlock_irqrestore(&scancode_lock, flags);
+            break;
+        }
+        scancode = scancodes[scancode_head];
+        scancode_head = (scancode_head + 1) % SCANCODE_QUEUE_SIZE;
+        scancode_count--;
+        spin_unlock_irqrestore(&scancode_lock, flags);
+
+        typed_on = terminal_num;
+        mutex_lock(&all_terminal_data[typed_on-1].lock);            // May sleep, so before preemption goes off 
+        sched_preempt_disable();
+        prev = set_output_terminal(typed_on);
+        key_input(scancode);
+        set_output_terminal(prev);
+        sched_preempt_enable();
+        mutex_unlock(&all_terminal_data[typed_on-1].lock);
+        sched_wake_up(&all_terminal_data[typed_on-1].readers);
+    }
+    sched_preempt();
+}
+
+
+/* 
+ * key_handler()
+ *   DESCRIPTION: Keyboard interrupt handler (top half): reads the scancode, acknowledges the interrupt and leaves 
+ *                the rest (echo, scrolling, terminal switches, waking readers) to key_work on the worker thread. 
+ *                A scancode that finds the queue full is dropped.  
+ *   INPUTS: none  
+ *   OUTPUTS: none 
+ *   RETURN VALUE: none 
+ *   SIDE EFFECTS: queues key_work, may switch to the worker thread 
+ */
+void key_handler(){
+    uint8_t scancode = inb(KEYBOARD_PORT);
+    send_eoi(KEYBOARD_IRQ_NUM);
+    spin_lock(&scancode_lock);
+    if(scancode_count < SCANCODE_QUEUE_SIZE){
+        scancodes[(scancode_head + scancode_count) % SCANCODE_QUEUE_SIZE] = scancode;
+        scancode_count++;
+    }
+    spin_unlock(&scancode_lock);
+    work_queue(&key_work_item);
+    sched_preempt();
 }
 
 
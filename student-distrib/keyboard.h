@@ -36,6 +36,8 @@ IO Port	    Access Type	     Purpose
 #include "syscall.h"
 #include "paging.h"
 #include "lib.h"
+#include "wait_queue.h"
+#include "mutex.h"
 
 // NOTE: keyboard is the first ps2 device (assume single ps2 controller)
 
@@ -80,6 +82,7 @@ IO Port	    Access Type	     Purpose
 
 /* Keyboard Constants */
 #define KEYBOARD_MAX_TRY 5                          // maximum try during keyboard restart process, currently not using
+#define SCANCODE_QUEUE_SIZE 64                      // scancodes key_handler can hold for key_work
 #define RELEASE_PERIOD   0xB4
 
 /* Initialize keyboard */
@@ -122,6 +125,8 @@ typedef struct terminal_t {
     uint32_t next_index;                // Next Index for keyboard buffer 
     uint32_t cursor[2];                 // Saved cursor position 
     struct pcb_t* last_run_pcb;         // Pointer to the last_run_pcb for the terminal 
+    wait_queue_t readers;               // Processes blocked in terminal_read until a key arrives 
+    mutex_t lock;                       // Guards keys and next_index (key_work vs terminal_read) 
 } terminal_t;
 
 /* Returns Pointer to Terminal Struct for Specified Terminal */
@@ -130,4 +135,14 @@ terminal_t* terminal_data(int num);
 /* Returns the Number for the Currently Seen Terminal */
 int get_seen_terminal_num();
 
+/* Makes printf/putc draw on a terminal, returns the terminal drawn on before */
+int set_output_terminal(int num);
+
+/* Returns the terminal printf/putc draw on */
+int get_output_terminal();
+
+/* Kernel lock hand over: load/save the cursor (and video mapping) of this CPU's output terminal */
+void output_terminal_load();
+void output_terminal_save();
+
 #endif /* _KEYBOARD_H */
@@ -248,13 +248,15 @@ format_char_switch:
         buf++;
     }
     /*Implemented cursor functions following this doc given by CA: https://wiki.osdev.org/Text_Mode_Cursor*/
-    /*UPDATE CURSOR PART*/
-    uint16_t pos = screen_y*80+screen_x;
+    /*UPDATE CURSOR PART (only the seen terminal owns the hardware cursor)*/
+    if(get_output_terminal() == get_seen_terminal_num()){
+        uint16_t pos = screen_y*80+screen_x;
  
-	outb(0x0F, 0x3D4);
-	outb((uint8_t) (pos & 0xFF), 0x3D5);
-	outb(0x0E, 0x3D4);
-	outb((uint8_t) ((pos >> 8) & 0xFF), 0x3D5);
+	    outb(0x0F, 0x3D4);
+	    outb((uint8_t) (pos & 0xFF), 0x3D5);
+	    outb(0x0E, 0x3D4);
+	    outb((uint8_t) ((pos >> 8) & 0xFF), 0x3D5);
+    }
     
     return (buf - format);
 }
@@ -362,8 +364,8 @@ void putc(uint8_t c) {
     }
     
     /* Save the new screen_x and screen_y values for the current terminal we are in */
-    terminal_data(get_seen_terminal_num())->cursor[0]=  screen_x; 
-    terminal_data(get_seen_terminal_num())->cursor[1]=  screen_y; 
+    terminal_data(get_output_terminal())->cursor[0]=  screen_x; 
+    terminal_data(get_output_terminal())->cursor[1]=  screen_y; 
 }
 
 
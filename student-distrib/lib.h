@@ -139,6 +139,14 @@ do {                                    \
     );                                  \
 } while (0)
 
+/* Read the 64-bit time stamp counter into val (a uint64_t) */
+#define rdtsc(val)                      \
+do {                                    \
+    asm volatile ("rdtsc"               \
+            : "=A"(val)                 \
+    );                                  \
+} while (0)
+
 /* Set interrupt flag - enable interrupts on this processor */
 #define sti()                           \
 do {                                    \
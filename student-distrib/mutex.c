@@ -0,0 +1,79 @@
+/* mutex.c - Sleeping locks: a process that finds the lock taken gives up the CPU until it is released */
+
+#include "mutex.h"
+
+
+/*
+ * mutex_init()
+ *   DESCRIPTION: Makes m a free mutex with nobody waiting
+ *   INPUTS: m    - mutex to set up
+ *           name - shown by spin_dump_stats for its guard
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void mutex_init(mutex_t* m, const char* name){
+    spin_lock_init(&m->guard, name);
+    m->held = 0;
+    m->waiters.head = NULL;
+    m->waiters.tail = NULL;
+}
+
+
+/*
+ * mutex_lock()
+ *   DESCRIPTION: Takes m. While someone else holds it we sleep on its waiters and try again when woken, so the holder
+ *                may be preempted or sleep without anyone spinning on it. Before the scheduler runs the sleep is a hlt.
+ *   INPUTS: m - mutex to take
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may switch processes, must not be called from an interrupt handler
+ */
+void mutex_lock(mutex_t* m){
+    uint32_t flags = spin_lock_irqsave(&m->guard);
+    while(m->held){
+        sched_sleep_on_lock(&m->waiters, &m->guard);
+    }
+    m->held = 1;
+    spin_unlock_irqrestore(&m->guard, flags);
+}
+
+
+/*
+ * mutex_unlock()
+ *   DESCRIPTION: Releases m and makes its waiters runnable, the first one to run takes it
+ *   INPUTS: m - mutex held by the caller
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the run queues
+ */
+void mutex_unlock(mutex_t* m){
+    uint32_t flags = spin_lock_irqsave(&m->guard);
+    m->held = 0;
+    spin_unlock_irqrestore(&m->guard, flags);
+    sched_wake_up(&m->waiters);
+}
+
+
+/*
+ * mutex_sleep_on()
+ *   DESCRIPTION: sched_sleep_on_lock for a condition tested under a mutex: m is released and we join wq under m's
+ *                guard, so whoever takes m next to change the condition and then wakes wq cannot miss us. m is held
+ *                again when we return.
+ *   INPUTS: wq - wait queue to sleep on
+ *           m  - mutex held by the caller, guarding the condition
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: switches processes
+ */
+void mutex_sleep_on(wait_queue_t* wq, mutex_t* m){
+    uint32_t flags = spin_lock_irqsave(&m->guard);
+    m->held = 0;
+    sched_wake_up(&m->waiters);
+    sched_sleep_on_lock(wq, &m->guard);
+    while(m->held){
+        sched_sleep_on_lock(&m->waiters, &m->guard);
+    }
+    m->held = 1;
+    spin_unlock_irqrestore(&m->guard, flags);
+}
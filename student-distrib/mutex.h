@@ -0,0 +1,28 @@
+#ifndef _MUTEX_H
+#define _MUTEX_H
+
+#include "types.h"
+#include "spinlock.h"
+#include "wait_queue.h"
+
+/* A lock whose waiters sleep instead of spinning, for sections that are long or run with interrupts on. guard
+ * (a spinlock) only covers held and the waiter list. */
+typedef struct mutex_t {
+    spinlock_t guard;
+    uint32_t held;                              // 1 while someone holds the mutex
+    wait_queue_t waiters;                       // Processes sleeping in mutex_lock
+} mutex_t;
+
+/* Makes m a free mutex named name */
+void mutex_init(mutex_t* m, const char* name);
+
+/* Takes m, sleeping while someone else holds it */
+void mutex_lock(mutex_t* m);
+
+/* Releases m and wakes its waiters */
+void mutex_unlock(mutex_t* m);
+
+/* Releases m once we are on wq, sleeps until sched_wake_up(wq) and takes m again */
+void mutex_sleep_on(wait_queue_t* wq, mutex_t* m);
+
+#endif /* _MUTEX_H */
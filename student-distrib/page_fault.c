@@ -0,0 +1,416 @@
+/* page_fault.c - Page fault handler: decodes the fault and hands it to the resolver of the area it hit */
+
+#include "page_fault.h"
+#include "paging.h"
+#include "filesystem.h"
+#include "swap.h"
+#include "lib.h"
+
+#define STACK_GROWTH_SLACK  (65536 + 32*4)                 // how far below esp a user access may touch (enter/pusha)
+
+
+
+/*
+ * vma_set
+ *   DESCRIPTION: Describes one area of a process' address space, the page fault handler uses it to decide
+ *                how a missing page is filled in. An empty range (start == end) is allowed, e.g. for a fresh heap.
+ *   INPUTS: pcb      - process owning the area
+ *           slot     - VMA slot (VMA_HEAP_SLOT, VMA_STACK_SLOT, VMA_IMAGE_SLOT...)
+ *           type     - VMA_NONE, VMA_ANON, VMA_FILE or VMA_STACK
+ *           start    - first address of the area
+ *           end      - first address past the area
+ *           writable - 1 if the pages may be written
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes pcb->vmas[slot]
+ */
+void vma_set(pcb_t* pcb, uint32_t slot, uint32_t type, uint32_t start, uint32_t end, uint32_t writable){
+    vm_area_t* vma = &pcb->vmas[slot];
+    vma->type = type;
+    vma->start = start;
+    vma->end = end;
+    vma->writable = writable;
+    vma->inode = 0;
+    vma->file_offset = 0;
+    vma->file_size = 0;
+}
+
+
+/*
+ * vma_set_file
+ *   DESCRIPTION: Backs a VMA with a file. Bytes [start, start+file_size) come from the inode starting at
+ *                file_offset, anything after that up to end reads as zero.
+ *   INPUTS: pcb         - process owning the area
+ *           slot        - VMA slot, already set up by vma_set
+ *           inode       - inode of the backing file
+ *           file_offset - offset in the file of the area's first byte
+ *           file_size   - number of bytes backed by the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes pcb->vmas[slot]
+ */
+void vma_set_file(pcb_t* pcb, uint32_t slot, uint32_t inode, uint32_t file_offset, uint32_t file_size){
+    vm_area_t* vma = &pcb->vmas[slot];
+    vma->type = VMA_FILE;
+    vma->inode = inode;
+    vma->file_offset = file_offset;
+    vma->file_size = file_size;
+}
+
+
+/*
+ * vma_find
+ *   DESCRIPTION: Looks up the area of a process containing addr
+ *   INPUTS: pcb  - process to search
+ *           addr - virtual address
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the VMA, NULL if addr is not inside any area
+ *   SIDE EFFECTS: none
+ */
+vm_area_t* vma_find(pcb_t* pcb, uint32_t addr){
+    uint32_t i;
+    for(i = 0; i < MAX_VMAS; i++){
+        if(pcb->vmas[i].type != VMA_NONE && addr >= pcb->vmas[i].start && addr < pcb->vmas[i].end){
+            return &pcb->vmas[i];
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * user_access
+ *   DESCRIPTION: Checks that every page of a user range is mapped (writable or copy-on-write, if asked), or is missing
+ *                (or swapped out) in an area (a writable one, if asked) that the page fault handler backs on first touch
+ *   INPUTS: pcb   - process owning the address space, NULL before any process runs
+ *           addr  - first user address
+ *           len   - number of bytes
+ *           write - 1 to require write access
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the kernel may access the whole range, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+static int32_t user_access(pcb_t* pcb, uint32_t addr, uint32_t len, uint32_t write){
+    uint32_t page, last;
+    page_table_entry* pte;
+    vm_area_t* vma;
+    if(pcb == NULL){                                                // no process yet: there is no user memory
+        return 0;
+    }
+    if(len == 0){
+        return 1;
+    }
+    if(addr + len - 1 < addr){                                      // wraps around
+        return 0;
+    }
+    last = (addr + len - 1) & ~(FRAME_SIZE-1);
+    for(page = addr & ~(FRAME_SIZE-1); ; page += FRAME_SIZE){
+        if((pte = user_pte(pcb->process_num, page)) == NULL){
+            return 0;
+        }
+        if(pte->present || (pte->avail & PTE_AVAIL_SWAP)){         // a swapped page keeps its permissions
+            if(write && !pte->read_write && !(pte->avail & PTE_AVAIL_COW)){     // a copy-on-write page is copied by the store
+                return 0;
+            }
+        }
+        else if((vma = vma_find(pcb, (page > addr) ? page : addr)) == NULL || (write && !vma->writable)){
+            return 0;
+        }
+        if(page == last){
+            return 1;
+        }
+    }
+}
+
+
+/*
+ * user_writable
+ *   DESCRIPTION: Checks that the kernel may store len bytes at addr on behalf of a process, e.g. to fill a system
+ *                call's output buffer. With CR0.WP set a kernel store to a read only user page faults like a user
+ *                one would, so callers fail the call instead.
+ *   INPUTS: pcb  - process owning the address space, NULL before any process runs
+ *           addr - first user address
+ *           len  - number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the whole range is writable, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t user_writable(pcb_t* pcb, uint32_t addr, uint32_t len){
+    return user_access(pcb, addr, len, 1);
+}
+
+
+/*
+ * user_readable
+ *   DESCRIPTION: Checks that the kernel may load len bytes from addr on behalf of a process, e.g. a system call's
+ *                input structure, anywhere in the program, heap or shared memory windows. An address outside every
+ *                area would fault in the kernel and end the process, so callers fail the call instead.
+ *   INPUTS: pcb  - process owning the address space, NULL before any process runs
+ *           addr - first user address
+ *           len  - number of bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the whole range is readable, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t user_readable(pcb_t* pcb, uint32_t addr, uint32_t len){
+    return user_access(pcb, addr, len, 0);
+}
+
+
+/*
+ * resolve_demand_zero
+ *   DESCRIPTION: Backs a missing anonymous page with a fresh zeroed frame. The frame is cleared through the kernel
+ *                map window before it is mapped, so read only pages get filled too.
+ *   INPUTS: pcb  - faulting process
+ *           vma  - area containing the page
+ *           page - page aligned faulting address
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the frame pool is empty
+ *   SIDE EFFECTS: allocates a frame and maps it, changes the PF_KMAP_INDEX page
+ */
+static int32_t resolve_demand_zero(pcb_t* pcb, vm_area_t* vma, uint32_t page){
+    uint32_t frame = allocate_frame();
+    if(frame == 0){
+        return -1;
+    }
+    memset((void*)kmap(PF_KMAP_INDEX, frame), 0, FRAME_SIZE);
+    user_map_page(pcb->process_num, page, frame, vma->writable);
+    return 0;
+}
+
+
+/*
+ * resolve_stack_growth
+ *   DESCRIPTION: Grows the user stack by one page. Faults from user mode must land near esp, anything further
+ *                below is a wild pointer that merely happens to fall inside the stack reservation.
+ *   INPUTS: pcb   - faulting process
+ *           vma   - stack area
+ *           page  - page aligned faulting address
+ *           addr  - faulting address
+ *           frame - processor frame of the fault
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the access is not a stack access or memory is exhausted
+ *   SIDE EFFECTS: allocates a frame and maps it
+ */
+static int32_t resolve_stack_growth(pcb_t* pcb, vm_area_t* vma, uint32_t page, uint32_t addr, pf_frame_t* frame){
+    if((frame->error_code & PF_ERR_USER) && addr + STACK_GROWTH_SLACK < frame->esp){
+        return -1;
+    }
+    return resolve_demand_zero(pcb, vma, page);
+}
+
+
+/*
+ * map_cow
+ *   DESCRIPTION: Maps a frame holding an untouched page of a private writable file-backed area (.data): read only,
+ *                marked PTE_AVAIL_COW, so other processes running the same program can share it until one of them
+ *                writes it and resolve_cow gives that one a private copy.
+ *   INPUTS: pcb   - process to map it into
+ *           page  - page aligned user address
+ *           frame - frame holding the page
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes a PTE and flushes the TLB
+ */
+static void map_cow(pcb_t* pcb, uint32_t page, uint32_t frame){
+    user_map_page(pcb->process_num, page, frame, 0);
+    user_pte(pcb->process_num, page)->avail |= PTE_AVAIL_COW;
+}
+
+
+/*
+ * share_text
+ *   DESCRIPTION: Maps a page of a file-backed area onto the frame another process already has for the same page of
+ *                the same file, so processes running one program share it. A read only page (text) is shared for
+ *                good: no process can write it. A page of a writable area (.data) is shared only while the other
+ *                process has not written it (its PTE still has PTE_AVAIL_COW), and copy-on-write. The swap scan
+ *                skips shared frames, so every sharer keeps seeing the file.
+ *   INPUTS: pcb  - faulting process
+ *           vma  - file-backed area
+ *           page - page aligned faulting address
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the page was mapped, -1 if no other process has it
+ *   SIDE EFFECTS: takes a reference to the shared frame
+ */
+static int32_t share_text(pcb_t* pcb, vm_area_t* vma, uint32_t page){
+    int32_t i;
+    pcb_t* other;
+    vm_area_t* other_vma;
+    page_table_entry* pte;
+    uint32_t frame;
+    for(i = 0; i < PCB_ARR_MAX_COUNT; i++){
+        other = pcb_by_num(i);
+        if(other == pcb || !other->in_use){
+            continue;
+        }
+        other_vma = vma_find(other, page);
+        if(other_vma == NULL || other_vma->type != VMA_FILE || other_vma->writable != vma->writable || other_vma->inode != vma->inode ||
+           other_vma->start != vma->start || other_vma->file_offset != vma->file_offset || other_vma->file_size != vma->file_size){
+            continue;
+        }
+        pte = user_pte(i, page);
+        if(pte == NULL || !pte->present || (vma->writable && !(pte->avail & PTE_AVAIL_COW))){
+            continue;
+        }
+        frame = pte->page_base_addr << 12;
+        frame_get(frame);
+        if(vma->writable){
+            map_cow(pcb, page, frame);
+        }
+        else{
+            user_map_page(pcb->process_num, page, frame, 0);
+        }
+        return 0;
+    }
+    return -1;
+}
+
+
+/*
+ * resolve_file
+ *   DESCRIPTION: Pages in one page of a file-backed area. A page another process already has is shared with it,
+ *                see share_text. Otherwise the part of the page covered by the file is read from the file system,
+ *                the rest of it (.bss) is zeroed. The frame is filled through the kernel map window and only
+ *                mapped once it is complete. A page of a writable area is mapped copy-on-write, so later
+ *                launches can share it until it is written.
+ *   INPUTS: pcb  - faulting process
+ *           vma  - file-backed area
+ *           page - page aligned faulting address
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if no frame is left or the file cannot be read
+ *   SIDE EFFECTS: allocates a frame and maps it, changes the PF_KMAP_INDEX page
+ */
+static int32_t resolve_file(pcb_t* pcb, vm_area_t* vma, uint32_t page){
+    uint32_t from, to, frame;
+    uint8_t* buf;
+    if(share_text(pcb, vma, page) == 0){
+        return 0;
+    }
+    if((frame = allocate_frame()) == 0){
+        return -1;
+    }
+    buf = (uint8_t*)kmap(PF_KMAP_INDEX, frame);
+    memset(buf, 0, FRAME_SIZE);
+    from = (page > vma->start) ? page : vma->start;                 // part of this page that lies inside the file
+    to = vma->start + vma->file_size;
+    if(to > page + FRAME_SIZE){
+        to = page + FRAME_SIZE;
+    }
+    if(from < to && read_data(vma->inode, vma->file_offset + (from - vma->start), buf + (from - page), to - from) == -1){
+        free_frame(frame);
+        return -1;
+    }
+    if(vma->writable){
+        map_cow(pcb, page, frame);
+    }
+    else{
+        user_map_page(pcb->process_num, page, frame, 0);
+    }
+    return 0;
+}
+
+
+/*
+ * resolve_cow
+ *   DESCRIPTION: Handles a write to a copy-on-write page. The last sharer simply gets write access back,
+ *                everyone else gets a private copy of the page, filled through the kernel map window.
+ *   INPUTS: pcb  - faulting process
+ *           pte  - entry mapping the page
+ *           page - page aligned faulting address
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if no frame is left
+ *   SIDE EFFECTS: may allocate a frame and drops a reference to the shared one, changes the PF_KMAP_INDEX page
+ */
+static int32_t resolve_cow(pcb_t* pcb, page_table_entry* pte, uint32_t page){
+    uint32_t old_frame = pte->page_base_addr << 12;
+    uint32_t frame;
+    if(frame_refcount(old_frame) == 1){                             // nobody else maps it any more
+        pte->read_write = 1;
+        pte->avail &= ~PTE_AVAIL_COW;
+        tlb_flush();
+        return 0;
+    }
+    if((frame = allocate_frame()) == 0){
+        return -1;
+    }
+    memcpy((void*)kmap(PF_KMAP_INDEX, frame), (void*)page, FRAME_SIZE);
+    user_map_page(pcb->process_num, page, frame, 1);
+    free_frame(old_frame);
+    return 0;
+}
+
+
+/*
+ * page_fault_handler
+ *   DESCRIPTION: Called by exp_page_fault with interrupts off. Reads CR2, decodes the error code and dispatches
+ *                the fault: a write to a copy-on-write page goes to resolve_cow, a compressed page to swap_in
+ *                and a missing page to the resolver of the VMA it lies in (demand-zero, file-backed or stack
+ *                growth). A resolved fault returns and the faulting instruction is retried. Anything else is a real fault: it is reported
+ *                and the process is halted like for every other exception. Each fault is counted per process
+ *                along with the TSC cycles spent resolving it.
+ *   INPUTS: frame - processor frame of the fault, starting at the error code
+ *   OUTPUTS: prints the fault on failure
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may map pages, halts the process on an unresolved fault
+ */
+void page_fault_handler(pf_frame_t* frame){
+    uint32_t addr = read_cr2();                                     // read before anything else can fault
+    uint32_t err = frame->error_code;
+    uint32_t page = addr & ~(FRAME_SIZE-1);
+    pcb_t* pcb = pcb_ptr();
+    page_table_entry* pte;
+    vm_area_t* vma;
+    uint32_t kind = PF_FATAL;
+    int32_t ret = -1;
+    uint64_t start, end;
+
+    rdtsc(start);
+    if(pcb != NULL && !(err & PF_ERR_RESERVED)){
+        pte = user_pte(pcb->process_num, addr);
+        vma = vma_find(pcb, addr);
+        if(err & PF_ERR_PRESENT){                                   // protection violation, only a COW write is legal
+            if((err & PF_ERR_WRITE) && pte != NULL && (pte->avail & PTE_AVAIL_COW)){
+                kind = PF_COW;
+                ret = resolve_cow(pcb, pte, page);
+            }
+        }
+        else if(pte != NULL && (pte->avail & PTE_AVAIL_SWAP)){      // page was compressed while the process sat idle
+            kind = PF_SWAP_IN;
+            ret = swap_in(pcb->process_num, pte, page);
+        }
+        else if(vma != NULL && pte != NULL && (vma->writable || !(err & PF_ERR_WRITE))){
+            switch(vma->type){
+                case VMA_ANON:
+                    kind = PF_DEMAND_ZERO;
+                    ret = resolve_demand_zero(pcb, vma, page);
+                    break;
+                case VMA_FILE:
+                    kind = PF_FILE;
+                    ret = resolve_file(pcb, vma, page);
+                    break;
+                case VMA_STACK:
+                    kind = PF_STACK;
+                    ret = resolve_stack_growth(pcb, vma, page, addr, frame);
+                    break;
+            }
+        }
+    }
+    rdtsc(end);
+
+    if(ret != 0){
+        kind = PF_FATAL;
+    }
+    if(pcb != NULL){
+        pcb->fault_count[kind]++;
+        pcb->fault_cycles[kind] += end - start;
+    }
+    if(ret == 0){
+        return;
+    }
+
+    printf("EXCEPTION: Page Fault!\n");                             // Kernel stack overflows double fault instead, see double_fault_task
+    printf("%s at 0x%x, eip 0x%x (%s, %s mode)\n", (err & PF_ERR_WRITE) ? "write" : ((err & PF_ERR_FETCH) ? "fetch" : "read"),
+           addr, frame->eip, (err & PF_ERR_PRESENT) ? "protection" : "not present", (err & PF_ERR_USER) ? "user" : "kernel");
+    sti();
+    system_halt((uint8_t)256);                                      // Squash the process, as handler() does for other exceptions
+}
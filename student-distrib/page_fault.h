@@ -0,0 +1,47 @@
+#ifndef _PAGE_FAULT_H
+#define _PAGE_FAULT_H
+
+#include "types.h"
+#include "syscall.h"
+
+/* Kernel map page the resolvers fill a new frame through before it is mapped (read only pages cannot be written
+ * through their user mapping, CR0.WP is set) */
+#define PF_KMAP_INDEX     1
+
+/* Page fault error code bits pushed by the processor */
+#define PF_ERR_PRESENT    0x1           // 0 = page not present, 1 = protection violation
+#define PF_ERR_WRITE      0x2           // access was a write
+#define PF_ERR_USER       0x4           // access came from user mode
+#define PF_ERR_RESERVED   0x8           // reserved bit set in a paging structure
+#define PF_ERR_FETCH      0x10          // instruction fetch
+
+/* What exp_page_fault hands to page_fault_handler: the processor's frame, starting at the error code.
+ * esp and ss are only valid when the fault came from user mode. */
+typedef struct pf_frame_t {
+    uint32_t error_code;
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+    uint32_t esp;
+    uint32_t ss;
+} pf_frame_t;
+
+/* Decodes CR2 and the error code and dispatches the fault to its resolver */
+void page_fault_handler(pf_frame_t* frame);
+
+/* Fills in VMA slot of a process */
+void vma_set(pcb_t* pcb, uint32_t slot, uint32_t type, uint32_t start, uint32_t end, uint32_t writable);
+
+/* Makes VMA slot of a process file-backed */
+void vma_set_file(pcb_t* pcb, uint32_t slot, uint32_t inode, uint32_t file_offset, uint32_t file_size);
+
+/* Returns the VMA of a process containing addr, NULL if there is none */
+vm_area_t* vma_find(pcb_t* pcb, uint32_t addr);
+
+/* Returns 1 if the kernel may store len bytes at user address addr for a process */
+int32_t user_writable(pcb_t* pcb, uint32_t addr, uint32_t len);
+
+/* Returns 1 if the kernel may load len bytes from user address addr for a process */
+int32_t user_readable(pcb_t* pcb, uint32_t addr, uint32_t len);
+
+#endif
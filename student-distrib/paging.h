@@ -2,10 +2,86 @@
 #define PAGING_H
 
 #include "types.h"
+#include "x86_desc.h"
 
 #define ENTRIES_NUM   1024
 #define VIDEO_MEM_ADDR   0xB8
 
+/* Maximum number of processes */
+#define PCB_ARR_MAX_COUNT 6
+
+/* User program window: page directory slot 32 (128MB-132MB), one 4KB page table per process. The image
+ * is paged in from the file system on first touch and the stack grows down from the top on demand. */
+#define USER_PDE_INDEX     32
+#define USER_START         0x08000000
+#define USER_STACK_TOP     0x08400000
+#define USER_STACK_MAX     0x00100000
+#define PROGRAM_IMAGE_ADDR 0x08048000
+
+/* User heap: one 4MB page directory slot (132MB-136MB) backed by 4KB demand-zero pages */
+#define HEAP_PDE_INDEX    33
+#define HEAP_START        0x08400000
+#define HEAP_END          0x08800000
+
+/* vidmap page: page directory slot 34, user address 0x08822000 (the same index is used in vidmap_page_table) */
+#define VIDMAP_PDE_INDEX  34
+
+/* Monotonic clock page: read only for every process, in the vidmap page table next to the vidmap page (see clock.h) */
+#define VCLOCK_PTE_INDEX  35
+#define VCLOCK_ADDR       0x08823000
+
+/* Shared memory window: one 4MB page directory slot (140MB-144MB), segment i lives at SHM_START + i*SHM_SEG_SPAN */
+#define SHM_PDE_INDEX     35
+#define SHM_START         0x08C00000
+#define SHM_MAX_SEGMENTS  16
+#define SHM_MAX_PAGES     64
+#define SHM_SEG_SPAN      (SHM_MAX_PAGES*4096)
+
+/* Kernel stacks: 4MB virtual region (8MB-12MB) cut into slots of KSTACK_SLOT_PAGES pages. A stack of n pages
+ * is mapped at the top of its slot, the pages below it stay unmapped and act as guard pages. */
+#define KSTACK_PDE_INDEX   2
+#define KSTACK_START       0x00800000
+#define KSTACK_SLOT_PAGES  8
+#define KSTACK_NUM_SLOTS   (1024/KSTACK_SLOT_PAGES)
+
+/* Size of a process' kernel stack in 4KB pages (at most KSTACK_SLOT_PAGES-1, one page is always a guard) */
+#define KERNEL_STACK_PAGES 2
+
+/* Kernel map window: 4MB virtual region (12MB-16MB) where the kernel maps frames it has no other address for */
+#define KMAP_PDE_INDEX     3
+#define KMAP_START         0x00C00000
+
+/* Physical pool of 4KB frames handed out by allocate_frame() (8MB-32MB, where the 4MB program pages used to live) */
+#define FRAME_POOL_START  0x800000
+#define FRAME_POOL_FRAMES 6144
+#define FRAME_SIZE        4096
+
+/* Software bits kept in a PTE's avail field */
+#define PTE_AVAIL_COW     0x1   // page is shared read-only and copied on the first write
+#define PTE_AVAIL_SWAP    0x2   // not present, page_base_addr is a compressed swap slot
+#define PTE_AVAIL_NOSWAP  0x4   // did not compress, skipped by the swap scan until it is written again
+
+/* Virtual memory area types, each one has its own page fault resolver */
+#define VMA_NONE          0
+#define VMA_ANON          1     // demand-zero (heap)
+#define VMA_FILE          2     // paged in from an inode
+#define VMA_STACK         3     // demand-zero, grows down towards start
+
+/* Fixed VMA slots of a process, slots from VMA_IMAGE_SLOT up hold the program image */
+#define VMA_HEAP_SLOT     0
+#define VMA_STACK_SLOT    1
+#define VMA_IMAGE_SLOT    2
+#define MAX_VMAS          6
+
+/* Page fault kinds counted per process */
+#define PF_DEMAND_ZERO    0
+#define PF_COW            1
+#define PF_FILE           2
+#define PF_STACK          3
+#define PF_SWAP_IN        4
+#define PF_FATAL          5
+#define PF_NUM_KINDS      6
+
 /* initializing a 32 bit page directory entry struct */
 typedef struct __attribute__ ((packed)) page_directory_entry {
         uint32_t present          : 1;
@@ -36,18 +112,51 @@ typedef struct __attribute__ ((packed)) page_table_entry {
         uint32_t page_base_addr          : 20;
 } page_table_entry;
 
+/* A range [start, end) of a process' address space and where its pages come from */
+typedef struct vm_area_t {
+        uint32_t type;                  // VMA_*
+        uint32_t start;
+        uint32_t end;
+        uint32_t writable;
+        uint32_t inode;                 // VMA_FILE: backing file and the file offset of start
+        uint32_t file_offset;
+        uint32_t file_size;             // VMA_FILE: bytes backed by the file, the rest of the area reads as zero
+} vm_area_t;
+
+/* Every CPU has its own page directory, first page table and vidmap page table: they hold what differs between
+ * CPUs, the page tables of the process it runs and where video memory points for it. page_directory,
+ * first_page_table and vidmap_page_table always name the running CPU's copy. */
+page_directory_entry cpu_page_directory[MAX_CPUS][1024] __attribute__((aligned(4096))) ;
+page_table_entry cpu_first_page_table[MAX_CPUS][1024] __attribute__((aligned(4096))) ;
+page_table_entry cpu_vidmap_page_table[MAX_CPUS][1024] __attribute__((aligned(4096))) ;
+
 /* Initlialize the Page Directory (each point to an area in the Page Table) */
-page_directory_entry page_directory[1024] __attribute__((aligned(4096))) ;
+#define page_directory      this_cpu_var(cpu_page_directory)
 
 /* Initialize the Page Table (4KB Pages) */
-page_table_entry first_page_table[1024] __attribute__((aligned(4096))) ;
-page_table_entry vidmap_page_table[1024] __attribute__((aligned(4096))) ;
+#define first_page_table    this_cpu_var(cpu_first_page_table)
+#define vidmap_page_table   this_cpu_var(cpu_vidmap_page_table)
+
+/* Page table backing the kernel stack region, supervisor only */
+page_table_entry kernel_stack_page_table[1024] __attribute__((aligned(4096))) ;
+
+/* Page table backing the kernel map window, supervisor only */
+page_table_entry kmap_page_table[1024] __attribute__((aligned(4096))) ;
+
+/* One program page table per process slot, installed at USER_PDE_INDEX by load_4MB_syscall_page */
+page_table_entry program_page_table[PCB_ARR_MAX_COUNT][1024] __attribute__((aligned(4096))) ;
+
+/* One heap page table per process slot, installed at HEAP_PDE_INDEX by load_4MB_syscall_page */
+page_table_entry heap_page_table[PCB_ARR_MAX_COUNT][1024] __attribute__((aligned(4096))) ;
+
+/* One shared memory page table per process slot, installed at SHM_PDE_INDEX by load_4MB_syscall_page */
+page_table_entry shm_page_table[PCB_ARR_MAX_COUNT][1024] __attribute__((aligned(4096))) ;
 
 
 /* Loads CR3 with the Page Directory Base Address */
 extern void loadPageDirectory(page_directory_entry*);
 
-/* map the 4mb syscall page to a particular physical address based on the process number given */
+/* install the page tables of the given process in the 128MB-144MB user window */
 extern void load_4MB_syscall_page(int process);
 
 /* Enables Paging by Setting Attributes in CR0 and CR4 */
@@ -56,9 +165,21 @@ extern void enablePaging();
 /* flushing tlb by resetting cr3 */
 extern void tlb_flush();
 
+/* Returns the faulting linear address stored in CR2 */
+extern uint32_t read_cr2();
+
 /* Initializes Paging */
 extern void page_init();
 
+/* Initializes paging on an application processor with its own copy of the per-CPU tables */
+void page_init_ap();
+
+/* Flushes this CPU's TLB if a kernel mapping shared by all CPUs changed since it last did */
+void kernel_map_sync();
+
+/* Maps the 4MB of device registers containing phys_addr at the same virtual address, uncached */
+void mmio_directory_entry_init(uint32_t phys_addr);
+
 /* Initializes page directory */
 void page_directory_init();
 
@@ -68,6 +189,9 @@ void vidmap_init(uint32_t screen_start);
 /* Initializes the vidmap page table for our vidmap sycall */
 void vidmap_page_table_init(); 
 
+/* maps the monotonic clock's page read only at VCLOCK_ADDR */
+void vclock_map(uint32_t page_addr);
+
 /* Deallocates the page for vidmap */
 void deallocate_page(int index);
 
@@ -89,9 +213,66 @@ void video_mem_page_directory_entry_init();
 /* Initializes kernel page directory entry */
 void kernel_page_directory_entry_init();
 
+/* Initializes the page directory entry for the kernel stack region */
+void kernel_stack_directory_entry_init();
+
+/* Maps a kernel stack of the given number of pages under a guard page, returns its top (0 on failure) */
+uint32_t kernel_stack_alloc(uint32_t pages);
+
+/* Unmaps the kernel stack whose top is stack_top and frees its frames */
+void kernel_stack_free(uint32_t stack_top);
+
+/* Returns 1 if addr falls on a guard page of the kernel stack region */
+int32_t kernel_stack_guard_hit(uint32_t addr);
+
 /* Returns the address of the page for the terminal associated with num */
 uint8_t* terminal_addr_ptr(int num);
 
+/* Initializes the page directory entry for the kernel map window */
+void kmap_directory_entry_init();
+
+/* Maps frame_addr at page index of the kernel map window, returns its virtual address */
+uint32_t kmap(uint32_t index, uint32_t frame_addr);
+
+/* Unmaps page index of the kernel map window */
+void kunmap(uint32_t index);
+
+/* Hands out a free 4KB physical frame from the frame pool, 0 if the pool is empty */
+uint32_t allocate_frame();
+
+/* Drops a reference to a 4KB physical frame, it returns to the frame pool with the last one */
+void free_frame(uint32_t frame_addr);
+
+/* Takes an extra reference to a frame that is about to be shared */
+void frame_get(uint32_t frame_addr);
+
+/* Returns the number of references held on a pool frame (0 for frames outside the pool) */
+uint32_t frame_refcount(uint32_t frame_addr);
+
+/* Marks every page of a process' program page table not present */
+void program_page_table_init(int process);
+
+/* Marks every page of a process' heap page table not present */
+void heap_page_table_init(int process);
+
+/* Returns the PTE mapping addr in one of a process' user page tables, NULL if addr is outside them */
+page_table_entry* user_pte(int process, uint32_t addr);
+
+/* Maps frame_addr as a user page at the page containing addr */
+int32_t user_map_page(int process, uint32_t addr, uint32_t frame_addr, uint32_t writable);
+
+/* Unmaps and frees every user page in [start, end) */
+void user_release(int process, uint32_t start, uint32_t end);
+
+/* Marks every page of a process' shared memory window not present */
+void shm_page_table_init(int process);
+
+/* Maps the 4KB frame at frame_addr into a process' shared memory window at page index */
+void shm_map_page(int process, uint32_t index, uint32_t frame_addr);
+
+/* Unmaps page index of a process' shared memory window */
+void shm_unmap_page(int process, uint32_t index);
+
 #endif /* PAGING_H */
 
 
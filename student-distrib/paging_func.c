@@ -1,9 +1,17 @@
 #include "paging.h"
 #include "lib.h"
+#include "syscall.h"
+#include "swap.h"
 
 static uint8_t* terminal1_addr = (uint8_t*)(0x0B8000+0x01000);    // The virtual address of terminal 1's page
 static uint8_t* terminal2_addr = (uint8_t*)(0x0B8000+2*0x01000);  // The virtual address of terminal 2's page
 static uint8_t* terminal3_addr = (uint8_t*)(0x0B8000+3*0x01000);  // The virtual address of terminal 3's page
+static uint32_t frame_bitmap[FRAME_POOL_FRAMES/32];                // One bit per frame in the frame pool, 1 = in use
+static uint8_t frame_refs[FRAME_POOL_FRAMES];                       // Number of mappings/owners of each frame in the pool
+static uint32_t next_free_hint = 0;                                 // Word of frame_bitmap where the last search ended
+static uint8_t kstack_slot_pages[KSTACK_NUM_SLOTS];                 // Pages mapped in each kernel stack slot, 0 = slot free
+static uint32_t kernel_map_gen = 0;                                 // Bumped whenever a kernel mapping shared by all CPUs changes or goes away
+static uint32_t cpu_kernel_map_gen[MAX_CPUS];                       // kernel_map_gen each CPU last flushed its TLB for
 
 
 /* 
@@ -28,14 +36,14 @@ uint8_t* terminal_addr_ptr(int num){
 
 /* 
  * de_allocate_page
- *   DESCRIPTION: Sets the present bit of vidmap's page directory and page table to 0
- *   INPUTS: index - index into the page directory and page table
+ *   DESCRIPTION: Sets the present bit of vidmap's page table entry to 0. The page directory entry stays present, it 
+ *                also holds the clock page every process maps (see vclock_map)
+ *   INPUTS: index - index into the page table
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Changes the present bit of page table and page directory
+ *   SIDE EFFECTS: Changes the present bit of page table
  */
 void deallocate_page(int index){
-    page_directory[index].present = 0;
     vidmap_page_table[index].present = 0;
 }
 
@@ -45,10 +53,11 @@ void deallocate_page(int index){
  *   INPUTS: terminal_num- which terminal's background buffere we want the video memory to point to
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Changes the video memory mapping
+ *   SIDE EFFECTS: Changes the video memory mapping, and the vidmap page with it
  */
 void copy_terminal_data(int terminal_num){
     first_page_table[VIDEO_MEM_ADDR].page_base_addr = VIDEO_MEM_ADDR+terminal_num*0x01; // Page table register index= 0xB8 + 0x1, terminal 1: 0xB9, terminal 2: 0xBA, terminal 3: 0xBB
+    vidmap_page_table[VIDMAP_PDE_INDEX].page_base_addr = VIDEO_MEM_ADDR+terminal_num*0x01; // A user program drawing through vidmap follows its terminal the same way
     tlb_flush();                                                               
 }
 
@@ -163,7 +172,8 @@ void video_mem_page_table_entry_init(int terminal_num){
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Initializes the page within the vidmap page table for the vidmap syscall 
+ *   SIDE EFFECTS: Initializes the page within the vidmap page table for the vidmap syscall. The page maps wherever
+ *                 video memory currently points (the screen or the running process' background terminal page)
  */
 void vidmap_init(uint32_t screen_start){
     /*
@@ -173,7 +183,7 @@ void vidmap_init(uint32_t screen_start){
     vidmap_page_table[screen_start].present = 1;                                 
     vidmap_page_table[screen_start].read_write = 1;
     vidmap_page_table[screen_start].user_supervisor = 1;
-    vidmap_page_table[screen_start].page_base_addr = VIDEO_MEM_ADDR;
+    vidmap_page_table[screen_start].page_base_addr = first_page_table[VIDEO_MEM_ADDR].page_base_addr;
     tlb_flush();                    
 }
 
@@ -215,6 +225,25 @@ void vidmap_directory_entry_init(uint32_t screen_start){
 
 
 
+/* 
+ * vclock_map
+ *   DESCRIPTION: Maps the monotonic clock's page at VCLOCK_ADDR, user readable and read only, so programs read the
+ *                time without a system call. It lives in the vidmap page table, whose directory entry stays present.
+ *   INPUTS: page_addr - physical (= kernel) address of the page
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Changes the vidmap page table and its page directory entry
+ */
+void vclock_map(uint32_t page_addr){
+    vidmap_page_table[VCLOCK_PTE_INDEX].present = 1;
+    vidmap_page_table[VCLOCK_PTE_INDEX].read_write = 0;
+    vidmap_page_table[VCLOCK_PTE_INDEX].user_supervisor = 1;
+    vidmap_page_table[VCLOCK_PTE_INDEX].page_base_addr = page_addr >> 12;
+    vidmap_directory_entry_init(VIDMAP_PDE_INDEX);
+}
+
+
+
 /* 
  * vidmap_page_table_init
  *   DESCRIPTION: Initialize page table entries (PTE)
@@ -229,7 +258,10 @@ void vidmap_page_table_init(){
     // Loop through the entire Page Table (from index 0 to 1023) 
     for(i = 0; i < ENTRIES_NUM; i++)
     {
-        //and initialize all entries and the Present bit to 0
+        //and initialize all entries and the Present bit to 0, except the clock page
+        if(i == VCLOCK_PTE_INDEX){
+            continue;
+        }
         vidmap_page_table[i].present = 0;
         vidmap_page_table[i].read_write = 0;
         vidmap_page_table[i].user_supervisor = 0;
@@ -315,30 +347,481 @@ void kernel_page_directory_entry_init(){
 
 
 
+/* 
+ * kernel_stack_directory_entry_init
+ *   DESCRIPTION: Initialize page directory entry for the kernel stack region
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Points page directory index 2 (8MB-12MB) at kernel_stack_page_table. Every entry of the table
+ *                 starts out not present, stacks are mapped into it by kernel_stack_alloc.
+ */
+void kernel_stack_directory_entry_init(){
+    unsigned int i;
+    for(i = 0; i < ENTRIES_NUM; i++){
+        *(uint32_t*)&kernel_stack_page_table[i] = 0;
+    }
+    page_directory[KSTACK_PDE_INDEX].present = 1;
+    page_directory[KSTACK_PDE_INDEX].read_write = 1;
+    page_directory[KSTACK_PDE_INDEX].user_supervisor = 0;          // kernel only
+    page_directory[KSTACK_PDE_INDEX].page_size = 0;
+    page_directory[KSTACK_PDE_INDEX].page_table_base_addr = ((uint32_t)kernel_stack_page_table) >> 12;
+    tlb_flush();
+}
+
+
+
+/* 
+ *  kernel_stack_alloc
+ *   DESCRIPTION: find a free slot in the kernel stack region and map pages frames at the top of it. The
+ *                unmapped pages left at the bottom of the slot are guard pages, so a stack overflow faults
+ *                instead of running into whatever lies below it.
+ *   INPUTS: pages - size of the stack in 4KB pages, 1 to KSTACK_SLOT_PAGES-1
+ *   OUTPUTS: none
+ *   RETURN VALUE: virtual address of the top of the stack (initial esp), 0 on failure
+ *   SIDE EFFECTS: allocates frames and maps them
+ */
+uint32_t kernel_stack_alloc(uint32_t pages){
+    uint32_t slot, i, frame, first;
+    unsigned long flags;
+    if(pages == 0 || pages >= KSTACK_SLOT_PAGES){
+        return 0;
+    }
+    cli_and_save(flags);
+    for(slot = 0; slot < KSTACK_NUM_SLOTS; slot++){
+        if(kstack_slot_pages[slot] == 0){
+            break;
+        }
+    }
+    if(slot == KSTACK_NUM_SLOTS){
+        restore_flags(flags);
+        return 0;
+    }
+    first = (slot+1)*KSTACK_SLOT_PAGES - pages;                         // stack occupies the top pages of the slot
+    for(i = 0; i < pages; i++){
+        if((frame = allocate_frame()) == 0){
+            while(i-- > 0){                                             // undo the pages mapped so far
+                free_frame(kernel_stack_page_table[first+i].page_base_addr << 12);
+                *(uint32_t*)&kernel_stack_page_table[first+i] = 0;
+            }
+            tlb_flush();
+            restore_flags(flags);
+            return 0;
+        }
+        kernel_stack_page_table[first+i].present = 1;
+        kernel_stack_page_table[first+i].read_write = 1;
+        kernel_stack_page_table[first+i].user_supervisor = 0;
+        kernel_stack_page_table[first+i].page_base_addr = frame >> 12;
+    }
+    kstack_slot_pages[slot] = pages;
+    tlb_flush();
+    restore_flags(flags);
+    return KSTACK_START + (slot+1)*KSTACK_SLOT_PAGES*FRAME_SIZE;
+}
+
+
+
+/* 
+ *  kernel_stack_free
+ *   DESCRIPTION: unmap a stack returned by kernel_stack_alloc and give its frames back. Must not be called
+ *                on the stack that is currently in use.
+ *   INPUTS: stack_top - value returned by kernel_stack_alloc
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees frames, the slot can be reused
+ */
+void kernel_stack_free(uint32_t stack_top){
+    uint32_t slot, i, first;
+    unsigned long flags;
+    if(stack_top <= KSTACK_START || stack_top > KSTACK_START + KSTACK_NUM_SLOTS*KSTACK_SLOT_PAGES*FRAME_SIZE){
+        return;
+    }
+    slot = (stack_top - KSTACK_START)/(KSTACK_SLOT_PAGES*FRAME_SIZE) - 1;
+    cli_and_save(flags);
+    first = (slot+1)*KSTACK_SLOT_PAGES - kstack_slot_pages[slot];
+    for(i = first; i < (slot+1)*KSTACK_SLOT_PAGES; i++){
+        free_frame(kernel_stack_page_table[i].page_base_addr << 12);
+        *(uint32_t*)&kernel_stack_page_table[i] = 0;
+    }
+    kstack_slot_pages[slot] = 0;
+    kernel_map_gen++;
+    tlb_flush();
+    restore_flags(flags);
+}
+
+
+
+/* 
+ *  kernel_stack_guard_hit
+ *   DESCRIPTION: check whether a faulting address is a guard page of the kernel stack region
+ *   INPUTS: addr - faulting linear address
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if addr is an unmapped page of the kernel stack region, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+int32_t kernel_stack_guard_hit(uint32_t addr){
+    if(addr < KSTACK_START || addr >= KSTACK_START + ENTRIES_NUM*FRAME_SIZE){
+        return 0;
+    }
+    return !kernel_stack_page_table[(addr - KSTACK_START) >> 12].present;
+}
+
+
+
+/* 
+ *  kmap_directory_entry_init
+ *   DESCRIPTION: Initialize page directory entry for the kernel map window
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Points page directory index 3 (12MB-16MB) at kmap_page_table, every entry starts out not present
+ */
+void kmap_directory_entry_init(){
+    unsigned int i;
+    for(i = 0; i < ENTRIES_NUM; i++){
+        *(uint32_t*)&kmap_page_table[i] = 0;
+    }
+    page_directory[KMAP_PDE_INDEX].present = 1;
+    page_directory[KMAP_PDE_INDEX].read_write = 1;
+    page_directory[KMAP_PDE_INDEX].user_supervisor = 0;            // kernel only
+    page_directory[KMAP_PDE_INDEX].page_size = 0;
+    page_directory[KMAP_PDE_INDEX].page_table_base_addr = ((uint32_t)kmap_page_table) >> 12;
+    tlb_flush();
+}
+
+
+
+/* 
+ *  kmap
+ *   DESCRIPTION: give the kernel an address for a frame that is not mapped anywhere it can reach, e.g. a
+ *                page of a process whose page tables are not installed
+ *   INPUTS: index      - page index inside the kernel map window, owned by the caller
+ *           frame_addr - physical address of the frame
+ *   OUTPUTS: none
+ *   RETURN VALUE: virtual address of the frame
+ *   SIDE EFFECTS: changes a PTE and flushes the TLB
+ */
+uint32_t kmap(uint32_t index, uint32_t frame_addr){
+    *(uint32_t*)&kmap_page_table[index] = 0;
+    kmap_page_table[index].present = 1;
+    kmap_page_table[index].read_write = 1;
+    kmap_page_table[index].page_base_addr = frame_addr >> 12;
+    kernel_map_gen++;                                               // the index may have pointed elsewhere on another CPU
+    tlb_flush();
+    return KMAP_START + index*FRAME_SIZE;
+}
+
+
+
+/* 
+ *  kunmap
+ *   DESCRIPTION: remove a mapping made by kmap
+ *   INPUTS: index - page index inside the kernel map window
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes a PTE and flushes the TLB
+ */
+void kunmap(uint32_t index){
+    *(uint32_t*)&kmap_page_table[index] = 0;
+    kernel_map_gen++;
+    tlb_flush();
+}
+
+
+
+/* 
+ *  kernel_map_sync
+ *   DESCRIPTION: bring this CPU's TLB up to date with the kernel mappings all CPUs share (kernel map window, kernel 
+ *                stacks). Instead of interrupting the other CPUs on every change, a CPU that changes one bumps a 
+ *                generation number and every CPU flushes when it sees a new one. Kernel code runs under the kernel 
+ *                lock, which calls this when it is taken, so no CPU can use a stale entry.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may flush the TLB
+ */
+void kernel_map_sync(){
+    if(this_cpu_var(cpu_kernel_map_gen) != kernel_map_gen){
+        this_cpu_var(cpu_kernel_map_gen) = kernel_map_gen;
+        tlb_flush();
+    }
+}
+
+
+
+/* 
+ *  mmio_directory_entry_init
+ *   DESCRIPTION: map the 4MB of physical address space holding a device's registers (e.g. the local APIC and 
+ *                IO APIC at 0xFEC00000-0xFF000000) at the same virtual address, uncached and kernel only
+ *   INPUTS: phys_addr - any physical address inside the 4MB region
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes a page directory entry of this CPU (application processors copy it when they start)
+ */
+void mmio_directory_entry_init(uint32_t phys_addr){
+    uint32_t index = phys_addr >> 22;
+    page_directory[index].present = 1;
+    page_directory[index].read_write = 1;
+    page_directory[index].user_supervisor = 0;
+    page_directory[index].write_through = 1;
+    page_directory[index].cache_disabled = 1;                      // device registers must not be cached
+    page_directory[index].page_size = 1;
+    page_directory[index].page_table_base_addr = (phys_addr >> 22) << 10;
+    tlb_flush();
+}
+
+
+
 /* 
  *  load_4MB_syscall_page
- *   DESCRIPTION: map the virtual address of 128 MB to physical address starting from 8 MB
+ *   DESCRIPTION: install the page tables of a process in the user window: its program page table at 128MB,
+ *                its heap at 132MB and its shared memory window at 140MB. Pages inside them are filled in
+ *                lazily by the page fault handler.
  *   INPUTS: process
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: map the virtual address 128MB to the correct physical address
+ *   SIDE EFFECTS: changes page directory entries 32, 33 and 35 and flushes the TLB
  */
 void load_4MB_syscall_page(int process){
     // 32 as 128(wanted virtual address) / 4(4 mb per page) = 32
-    page_directory[32].present = 1;
-    page_directory[32].read_write = 1;           // read and write 
-    page_directory[32].user_supervisor = 1;      // user 
-    page_directory[32].reserved = 1;
-    // 1 as linear address must be mapped to physical addr 0x00800000 + 0x00400000 * process
-    // Thus, the 12 bit in page base addr of a PDE with 4-Mbyte page need to be the same
-    // left shift by 10 as the page base addr declared start at bit 12, 22-12 = 10
-    // 2 as 2 << 10 is 0x00800000
-    page_directory[32].page_table_base_addr =((2+process) << (10));
+    page_directory[USER_PDE_INDEX].present = 1;
+    page_directory[USER_PDE_INDEX].read_write = 1;           // read and write 
+    page_directory[USER_PDE_INDEX].user_supervisor = 1;      // user 
+    page_directory[USER_PDE_INDEX].page_size = 0;            // 4KB pages, so the image can be paged in one page at a time
+    page_directory[USER_PDE_INDEX].page_table_base_addr = ((uint32_t)program_page_table[process]) >> 12;
+
+    // the heap page table of the same process is installed right above the program image (132MB)
+    page_directory[HEAP_PDE_INDEX].present = 1;
+    page_directory[HEAP_PDE_INDEX].read_write = 1;
+    page_directory[HEAP_PDE_INDEX].user_supervisor = 1;
+    page_directory[HEAP_PDE_INDEX].page_size = 0;
+    page_directory[HEAP_PDE_INDEX].page_table_base_addr = ((uint32_t)heap_page_table[process]) >> 12;
+
+    // and its shared memory window right above the vidmap slot (140MB)
+    page_directory[SHM_PDE_INDEX].present = 1;
+    page_directory[SHM_PDE_INDEX].read_write = 1;
+    page_directory[SHM_PDE_INDEX].user_supervisor = 1;
+    page_directory[SHM_PDE_INDEX].page_size = 0;
+    page_directory[SHM_PDE_INDEX].page_table_base_addr = ((uint32_t)shm_page_table[process]) >> 12;
     tlb_flush();
 } 
 
 
 
+/* 
+ *  allocate_frame
+ *   DESCRIPTION: hand out a free 4KB physical frame from the frame pool. The bitmap is scanned a word
+ *                at a time starting where the previous search ended, so a full word is skipped in one compare.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address of the frame, 0 if the pool is exhausted
+ *   SIDE EFFECTS: marks the frame as in use
+ */
+uint32_t allocate_frame(){
+    uint32_t i, bit, word;
+    unsigned long flags;
+    cli_and_save(flags);
+    for(i = 0; i < FRAME_POOL_FRAMES/32; i++){
+        word = (next_free_hint + i) % (FRAME_POOL_FRAMES/32);
+        if(frame_bitmap[word] == 0xFFFFFFFF){                         // every frame in this word is taken
+            continue;
+        }
+        for(bit = 0; bit < 32; bit++){
+            if(!(frame_bitmap[word] & (1 << bit))){
+                frame_bitmap[word] |= (1 << bit);
+                frame_refs[word*32 + bit] = 1;
+                next_free_hint = word;
+                restore_flags(flags);
+                return FRAME_POOL_START + (word*32 + bit)*FRAME_SIZE;
+            }
+        }
+    }
+    restore_flags(flags);
+    return 0;
+}
+
+
+
+/* 
+ *  free_frame
+ *   DESCRIPTION: drop one reference to a 4KB physical frame, the frame returns to the pool with the last one
+ *   INPUTS: frame_addr - physical address previously returned by allocate_frame
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may mark the frame as free
+ */
+void free_frame(uint32_t frame_addr){
+    uint32_t index;
+    unsigned long flags;
+    if(frame_addr < FRAME_POOL_START || frame_addr >= FRAME_POOL_START + FRAME_POOL_FRAMES*FRAME_SIZE){
+        return;
+    }
+    index = (frame_addr - FRAME_POOL_START)/FRAME_SIZE;
+    cli_and_save(flags);
+    if(frame_refs[index] > 0 && --frame_refs[index] == 0){
+        frame_bitmap[index/32] &= ~(1 << (index%32));
+    }
+    restore_flags(flags);
+}
+
+
+
+/* 
+ *  frame_get
+ *   DESCRIPTION: take an extra reference to an allocated frame, used when a second mapping shares it
+ *   INPUTS: frame_addr - physical address of an allocated frame
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the frame stays allocated until free_frame has been called once more
+ */
+void frame_get(uint32_t frame_addr){
+    unsigned long flags;
+    if(frame_addr < FRAME_POOL_START || frame_addr >= FRAME_POOL_START + FRAME_POOL_FRAMES*FRAME_SIZE){
+        return;
+    }
+    cli_and_save(flags);
+    frame_refs[(frame_addr - FRAME_POOL_START)/FRAME_SIZE]++;
+    restore_flags(flags);
+}
+
+
+
+/* 
+ *  frame_refcount
+ *   DESCRIPTION: number of references held on a frame of the pool
+ *   INPUTS: frame_addr - physical address of the frame
+ *   OUTPUTS: none
+ *   RETURN VALUE: reference count, 0 for free frames and frames outside the pool
+ *   SIDE EFFECTS: none
+ */
+uint32_t frame_refcount(uint32_t frame_addr){
+    if(frame_addr < FRAME_POOL_START || frame_addr >= FRAME_POOL_START + FRAME_POOL_FRAMES*FRAME_SIZE){
+        return 0;
+    }
+    return frame_refs[(frame_addr - FRAME_POOL_START)/FRAME_SIZE];
+}
+
+
+
+/* 
+ *  program_page_table_init
+ *   DESCRIPTION: mark every page of a process' program window as not present, the image and the stack are
+ *                only backed once touched
+ *   INPUTS: process - process slot owning the window
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: clears program_page_table[process]
+ */
+void program_page_table_init(int process){
+    unsigned int i;
+    for(i = 0; i < ENTRIES_NUM; i++){
+        *(uint32_t*)&program_page_table[process][i] = 0;
+    }
+    tlb_flush();
+}
+
+
+
+/* 
+ *  heap_page_table_init
+ *   DESCRIPTION: mark every page of a process' heap as not present, nothing is backed until it is touched
+ *   INPUTS: process - process slot owning the heap
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: clears heap_page_table[process]
+ */
+void heap_page_table_init(int process){
+    unsigned int i;
+    for(i = 0; i < ENTRIES_NUM; i++){
+        *(uint32_t*)&heap_page_table[process][i] = 0;
+    }
+    tlb_flush();
+}
+
+
+
+/* 
+ *  user_pte
+ *   DESCRIPTION: find the page table entry that maps addr in one of a process' 4KB user page tables
+ *   INPUTS: process - process slot
+ *           addr    - user virtual address
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the PTE, NULL if addr is not in the program, heap or shared memory window
+ *   SIDE EFFECTS: none
+ */
+page_table_entry* user_pte(int process, uint32_t addr){
+    uint32_t index = (addr >> 12) & (ENTRIES_NUM-1);                   // 4KB page index inside its 4MB window
+    switch(addr >> 22){
+        case USER_PDE_INDEX:
+            return &program_page_table[process][index];
+        case HEAP_PDE_INDEX:
+            return &heap_page_table[process][index];
+        case SHM_PDE_INDEX:
+            return &shm_page_table[process][index];
+        default:
+            return NULL;
+    }
+}
+
+
+
+/* 
+ *  user_map_page
+ *   DESCRIPTION: map a frame as a user page at the page containing addr
+ *   INPUTS: process    - process slot owning the page table
+ *           addr       - any address inside the page to map
+ *           frame_addr - physical address of the frame
+ *           writable   - 1 for a read/write page, 0 for read only
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if addr is not in a user page table
+ *   SIDE EFFECTS: changes a PTE and flushes the TLB
+ */
+int32_t user_map_page(int process, uint32_t addr, uint32_t frame_addr, uint32_t writable){
+    page_table_entry* pte = user_pte(process, addr);
+    if(pte == NULL){
+        return -1;
+    }
+    *(uint32_t*)pte = 0;
+    pte->present = 1;
+    pte->read_write = writable;
+    pte->user_supervisor = 1;
+    pte->page_base_addr = frame_addr >> 12;
+    tlb_flush();
+    return 0;
+}
+
+
+
+/* 
+ *  user_release
+ *   DESCRIPTION: unmap every user page in [start, end) and drop its frame (or swap slot), start and end must lie in the same
+ *                4MB window. Used on shrinking brk and when a process halts.
+ *   INPUTS: process - process slot owning the pages
+ *           start   - first address, rounded up to a page boundary
+ *           end     - end of the range
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees frames and clears page table entries
+ */
+void user_release(int process, uint32_t start, uint32_t end){
+    uint32_t addr;
+    page_table_entry* pte;
+    for(addr = (start + FRAME_SIZE - 1) & ~(FRAME_SIZE-1); addr < end; addr += FRAME_SIZE){
+        pte = user_pte(process, addr);
+        if(pte != NULL && pte->present){
+            free_frame(pte->page_base_addr << 12);
+            *(uint32_t*)pte = 0;
+        }
+        else if(pte != NULL && (pte->avail & PTE_AVAIL_SWAP)){         // page lives in compressed swap
+            swap_free(pte->page_base_addr);
+            *(uint32_t*)pte = 0;
+        }
+    }
+    tlb_flush();
+}
+
+
+
 // see https://courses.grainger.illinois.edu/ECE391/sp2024/secure/references/IA32-ref-manual-vol-3.pdf page 87, 88, 90, 91
 /*
 *   page_init()
@@ -377,6 +860,12 @@ void page_init(){
     
     // initialize page directory entry 1 for kernel
     kernel_page_directory_entry_init();
+
+    // initialize page directory entry 2 for the kernel stack pool
+    kernel_stack_directory_entry_init();
+
+    // initialize page directory entry 3 for the kernel map window
+    kmap_directory_entry_init();
     
     // Load the Page Directory Base Address into CR3 
     loadPageDirectory(page_directory);
@@ -384,3 +873,85 @@ void page_init(){
     // Enable Paging for the OS 
     enablePaging();
 }
+
+
+
+/* 
+ *  page_init_ap
+ *   DESCRIPTION: Initializes paging on an application processor: its page directory, first page table and vidmap
+ *                page table start as copies of the bootstrap processor's, pointing at its own tables instead, so 
+ *                the two can run different processes. Every other table (kernel stacks, kernel map window, process 
+ *                page tables) is shared.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: enables paging on this CPU, must run after the CPU has loaded its TSS (see this_cpu_id)
+ */
+void page_init_ap(){
+    memcpy(page_directory, cpu_page_directory[0], sizeof(cpu_page_directory[0]));
+    memcpy(first_page_table, cpu_first_page_table[0], sizeof(cpu_first_page_table[0]));
+    memcpy(vidmap_page_table, cpu_vidmap_page_table[0], sizeof(cpu_vidmap_page_table[0]));
+    page_directory[0].page_table_base_addr = ((uint32_t)first_page_table) >> 12;
+    page_directory[VIDMAP_PDE_INDEX].page_table_base_addr = ((uint32_t)vidmap_page_table) >> 12;
+    this_cpu_var(cpu_kernel_map_gen) = kernel_map_gen;
+    loadPageDirectory(page_directory);
+    enablePaging();
+}
+
+
+
+/* 
+ *  shm_page_table_init
+ *   DESCRIPTION: mark every page of a process' shared memory window as not present
+ *   INPUTS: process - process slot owning the window
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: clears shm_page_table[process]
+ */
+void shm_page_table_init(int process){
+    unsigned int i;
+    for(i = 0; i < ENTRIES_NUM; i++){
+        *(uint32_t*)&shm_page_table[process][i] = 0;
+    }
+    tlb_flush();
+}
+
+
+
+/* 
+ *  shm_map_page
+ *   DESCRIPTION: Initialize a page within a process' shm page table, the same way vidmap_init maps video memory
+ *   INPUTS: process    - process slot owning the window
+ *           index      - page index inside the window
+ *           frame_addr - physical address of the shared frame
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: maps a user read/write 4KB page
+ */
+void shm_map_page(int process, uint32_t index, uint32_t frame_addr){
+    /*
+    * Mark the page as present, allow reading/writing to the page, set to user level, and map to the shared frame. 
+    * Every process attached to the segment points its entry at the same frame. 
+    */
+    shm_page_table[process][index].present = 1;
+    shm_page_table[process][index].read_write = 1;
+    shm_page_table[process][index].user_supervisor = 1;
+    shm_page_table[process][index].page_base_addr = frame_addr >> 12;
+    tlb_flush();
+}
+
+
+
+/* 
+ *  shm_unmap_page
+ *   DESCRIPTION: Clear a page within a process' shm page table. The frame itself stays with its segment.
+ *   INPUTS: process - process slot owning the window
+ *           index   - page index inside the window
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: unmaps a 4KB page
+ */
+void shm_unmap_page(int process, uint32_t index){
+    *(uint32_t*)&shm_page_table[process][index] = 0;
+    tlb_flush();
+}
@@ -1,14 +1,34 @@
 #include "pit.h"
+#include "swap.h"
+#include "timer.h"
+#include "clock.h"
+#include "spinlock.h"
 
 
+static void pit_periodic(uint32_t counts);
+static void pit_oneshot(uint32_t counts);
+static uint32_t pit_read_count();
+
+/* Channel 0 of the 8254 as the tick source */
+static const tick_source_t pit_source = { "pit", PIT_BASE_FREQ, PIT_MAX_COUNT, PIT_MAX_HZ, pit_periodic, pit_oneshot, pit_read_count };
+
 /* Static Variables to Keep Track of Scheduling States/Milestones */
-static int terminal_being_handled = -1; 															// terminal currently being handled in scheduling
+static const tick_source_t* source = &pit_source;													// Device the tick runs on
 static int counter=-1;																				// counter which gets incremented inside of pit_handler()
+static uint32_t pit_hz = PIT_DEFAULT_HZ;															// Tick frequency
+static uint32_t pit_divisor;																		// Input clock periods of the source per tick
+static int tickless = 0;																			// 1 while the PIT runs in one-shot mode instead of ticking periodically
+static uint32_t oneshot_counts;																		// Input clock periods programmed for the current one-shot
+static uint32_t residual_counts = 0;																// Periods spent in one-shot mode that do not make up a full tick yet
+static int next_swap_scan;																			// Tick at which the swap scan runs next
+static int oneshot_deadline;																		// Tick the current one-shot was armed for
+static int in_handler = 0;																			// 1 while pit_handler runs between accounting the one-shot and arming the next 
+static spinlock_t pit_lock = SPINLOCK_INIT("pit");														// Guards the PIT's mode and count registers and the tick state above
 
 
 /* 
  * pit_init()
- *   DESCRIPTION: Initializes the pit to interrupt at a frequency of 20Hz = 50ms.  
+ *   DESCRIPTION: Initializes the pit to interrupt at PIT_DEFAULT_HZ = 20Hz = 50ms (see pit_set_hz to change it).  
  *   INPUTS: none 
  *   OUTPUTS: none 
  *   RETURN VALUE: none
@@ -17,28 +37,341 @@ static int counter=-1;																				// counter which gets incremented insi
  */
 void pit_init(){
 
-    cli();																							// Disable Interrupts 
-	int Hz=20;																						// Set pit interrupt rate to 20Hz = 50ms 
-	int divisor =1193180/Hz;																		// 1193180 Hz = input clock rate of the pit 
-	outb(0x00110100b, MODE_COMMAND_REG);															// 0x00110100b: Select Channel 0, Set Access Mode to lobyte/hibyte, Set the mode to mode 2 (rate generator)
-	outb(divisor&0xFF,CHANNEL0);																	// Set the low byte (divisor&0xFF:selecting low byte) of the divisor 
-    outb(divisor>>8,CHANNEL0);     																	// Set the high byte (divisor>>8:selecting high byte) of the divisor 
-    sti();
+	uint32_t flags = spin_lock_irqsave(&pit_lock);
+	pit_divisor = PIT_BASE_FREQ/pit_hz;																// 1193180 Hz = input clock rate of the pit 
+	next_swap_scan = pit_ms_to_ticks(SWAP_SCAN_MS);
+	pit_periodic(pit_divisor);
+	spin_unlock_irqrestore(&pit_lock, flags);
     enable_irq(PIT_IRQ_NUM);
 
 }
 
 
 /* 
- * get_terminal_being_handled()
- *   DESCRIPTION: Returns the terminal currently being handled in scheduling   
+ * pit_set_hz()
+ *   DESCRIPTION: Changes the tick frequency (boot command line "hz=", or the timer_config system call). A higher rate 
+ *				  gives finer time slices and wakes up more often. Time slices and the periodic work are set in 
+ *				  milliseconds and follow the new rate. In tickless mode the new rate applies from the next restart.  
+ *   INPUTS: hz - ticks per second, PIT_MIN_HZ to the source's max_hz (PIT_MAX_HZ for the PIT) 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: 0 on success, -1 if hz is out of range
+ *   SIDE EFFECTS: reprograms the PIT
+ */
+int32_t pit_set_hz(uint32_t hz){
+	uint32_t flags;
+	if(hz < PIT_MIN_HZ || hz > source->max_hz){
+		return -1;
+	}
+	flags = spin_lock_irqsave(&pit_lock);
+	pit_hz = hz;
+	pit_divisor = source->freq/hz;
+	residual_counts = 0;
+	if(!tickless){
+		source->periodic(pit_divisor);
+	}
+	spin_unlock_irqrestore(&pit_lock, flags);
+	return 0;
+}
+
+
+/* 
+ * pit_get_hz()
+ *   DESCRIPTION: Returns the tick frequency.  
  *   INPUTS: none 
  *   OUTPUTS: none 
- *   RETURN VALUE: The terminal currently being handled in scheduling   
- *   SIDE EFFECTS: none  
+ *   RETURN VALUE: ticks per second
+ *   SIDE EFFECTS: none
+ */
+uint32_t pit_get_hz(){
+	return pit_hz;
+}
+
+
+/* 
+ * pit_tickless()
+ *   DESCRIPTION: Tells whether the periodic tick is stopped.  
+ *   INPUTS: none 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: 1 in one-shot mode, 0 while ticking periodically
+ *   SIDE EFFECTS: none
+ */
+uint32_t pit_tickless(){
+	return tickless;
+}
+
+
+/* 
+ * pit_ms_to_ticks()
+ *   DESCRIPTION: Converts a duration to ticks at the current frequency, rounding to the nearest tick.  
+ *   INPUTS: ms - duration in milliseconds 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: number of ticks, at least 1
+ *   SIDE EFFECTS: none
+ */
+uint32_t pit_ms_to_ticks(uint32_t ms){
+	uint32_t ticks = (ms*pit_hz + 500)/1000;
+	return (ticks == 0) ? 1 : ticks;
+}
+
+
+/* 
+ * pit_calibrate_tsc()
+ *   DESCRIPTION: Measures the TSC frequency against the PIT's input clock: channel 2 (the speaker channel, with the 
+ *				  speaker off) counts down PIT_CALIBRATE_MS milliseconds in mode 0 while we poll its output, and the 
+ *				  TSC cycles that went by give the rate. Channel 0 keeps ticking meanwhile. The shortest of 
+ *				  PIT_CALIBRATE_RUNS runs is kept, a run that got interrupted only takes longer.  
+ *   INPUTS: none 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: TSC frequency in kHz
+ *   SIDE EFFECTS: uses channel 2, call with interrupts off
+ */
+uint32_t pit_calibrate_tsc(){
+	uint32_t counts = PIT_BASE_FREQ / (1000 / PIT_CALIBRATE_MS);
+	uint32_t run, cycles, best = 0xFFFFFFFF;
+	uint8_t gate;
+	uint64_t start, end;
+	gate = inb(PIT_GATE_PORT);
+	for(run = 0; run < PIT_CALIBRATE_RUNS; run++){
+		outb((gate & ~(PIT_SPEAKER_ON | PIT_GATE_CH2)), PIT_GATE_PORT);								// gate low: channel 2 holds 
+		outb(PIT_CH2_ONESHOT_CMD, MODE_COMMAND_REG);
+		outb(counts&0xFF,CHANNEL2);
+		outb(counts>>8,CHANNEL2);
+		outb((gate & ~PIT_SPEAKER_ON) | PIT_GATE_CH2, PIT_GATE_PORT);									// gate high: counting starts 
+		rdtsc(start);
+		while(!(inb(PIT_GATE_PORT) & PIT_OUT_CH2));													// output goes high at terminal count 
+		rdtsc(end);
+		cycles = (uint32_t)(end - start);
+		if(cycles < best){
+			best = cycles;
+		}
+	}
+	outb(gate, PIT_GATE_PORT);
+	return best / PIT_CALIBRATE_MS;
+}
+
+
+/* 
+ * pit_read_count()
+ *   DESCRIPTION: Latches and reads the current count of channel 0.  
+ *   INPUTS: none 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: input clock periods left before the channel reaches 0
+ *   SIDE EFFECTS: none
+ */
+static uint32_t pit_read_count(){
+	uint32_t lo, hi;
+	outb(PIT_LATCH_CMD, MODE_COMMAND_REG);															// Latch channel 0 so both bytes belong to the same count 
+	lo = inb(CHANNEL0);
+	hi = inb(CHANNEL0);
+	return (hi << 8) | lo;
+}
+
+
+/* 
+ * pit_periodic()
+ *   DESCRIPTION: Runs channel 0 in mode 2 (rate generator): an interrupt every counts input clock periods.  
+ *   INPUTS: counts - periods between interrupts, at most PIT_MAX_COUNT 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reprograms the PIT
+ */
+static void pit_periodic(uint32_t counts){
+	outb(PIT_PERIODIC_CMD, MODE_COMMAND_REG);														// 0x34 = 00110100b: Select Channel 0, Set Access Mode to lobyte/hibyte, Set the mode to mode 2 (rate generator)
+	outb(counts&0xFF,CHANNEL0);																		// Set the low byte (divisor&0xFF:selecting low byte) of the divisor 
+	outb(counts>>8,CHANNEL0);																		// Set the high byte (divisor>>8:selecting high byte) of the divisor 
+}
+
+
+/* 
+ * pit_oneshot()
+ *   DESCRIPTION: Runs channel 0 in mode 0 (interrupt on terminal count): one interrupt after counts input clock periods.  
+ *   INPUTS: counts - periods before the interrupt, at most PIT_MAX_COUNT 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reprograms the PIT
+ */
+static void pit_oneshot(uint32_t counts){
+	outb(PIT_ONESHOT_CMD, MODE_COMMAND_REG);														// 0x30 = 00110000b: Channel 0, lobyte/hibyte, mode 0 
+	outb(counts&0xFF,CHANNEL0);
+	outb(counts>>8,CHANNEL0);																		// counting starts once the high byte is written 
+}
+
+
+/* 
+ * pit_use_source()
+ *   DESCRIPTION: Moves the tick to another device (the boot command line's "timer=", see hpet_tick_source). The 
+ *				  device must already raise IRQ 0 when it fires. The tick rate stays, the ticks are re-expressed in 
+ *				  the new input clock, and the tick restarts in periodic mode on the new device (tickless mode picks 
+ *				  it up from there).  
+ *   INPUTS: new_source - device to tick with 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: 0 on success, -1 if the current tick rate is too fast for it
+ *   SIDE EFFECTS: reprograms the tick devices
+ */
+int32_t pit_use_source(const tick_source_t* new_source){
+	uint32_t flags;
+	if(pit_hz > new_source->max_hz){
+		return -1;
+	}
+	flags = spin_lock_irqsave(&pit_lock);
+	source = new_source;
+	pit_divisor = source->freq/pit_hz;
+	residual_counts = 0;
+	tickless = 0;
+	source->periodic(pit_divisor);
+	spin_unlock_irqrestore(&pit_lock, flags);
+	return 0;
+}
+
+
+/* 
+ * pit_get_source()
+ *   DESCRIPTION: Returns the device the tick runs on.  
+ *   INPUTS: none 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: the tick source
+ *   SIDE EFFECTS: none
+ */
+const tick_source_t* pit_get_source(){
+	return source;
+}
+
+
+/* 
+ * pit_tick_source()
+ *   DESCRIPTION: Returns channel 0 of the PIT as a tick source, to move the tick back to it.  
+ *   INPUTS: none 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: the PIT tick source
+ *   SIDE EFFECTS: none
+ */
+const tick_source_t* pit_tick_source(){
+	return &pit_source;
+}
+
+
+/* 
+ * pit_max_hz()
+ *   DESCRIPTION: Returns the fastest tick rate the current tick source allows.  
+ *   INPUTS: none 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: ticks per second
+ *   SIDE EFFECTS: none
+ */
+uint32_t pit_max_hz(){
+	return source->max_hz;
+}
+
+
+/* 
+ * pit_account_counts()
+ *   DESCRIPTION: Turns input clock periods spent in one-shot mode into ticks of the counter, keeping the remainder for later.  
+ *   INPUTS: counts - input clock periods that went by 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: advances the counter
+ */
+static void pit_account_counts(uint32_t counts){
+	residual_counts += counts;
+	counter += residual_counts / pit_divisor;
+	residual_counts %= pit_divisor;
+}
+
+
+/* 
+ * pit_arm_oneshot()
+ *   DESCRIPTION: Programs channel 0 in mode 0 (interrupt on terminal count) to fire once at the next deadline (the swap 
+ *				  scan or the first timer of the timer wheel), or after the longest delay the 16 bit counter allows 
+ *				  when the deadline is further away.  
+ *   INPUTS: none 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reprograms the PIT
+ */
+static void pit_arm_oneshot(){
+	int ticks = next_swap_scan - counter;
+	int wheel_ticks = (int)(timer_next_expiry() - (uint32_t)counter);
+	uint32_t counts;
+	if(wheel_ticks < ticks){
+		ticks = wheel_ticks;
+	}
+	if(ticks < 1){
+		ticks = 1;
+	}
+	if((uint32_t)ticks > source->max_count / pit_divisor + 1){										// fires before the deadline anyway, keeps the product in 32 bits 
+		ticks = source->max_count / pit_divisor + 1;
+	}
+	counts = (uint32_t)ticks * pit_divisor - residual_counts;										// the residual already counts towards the next tick 
+	if(counts > source->max_count){
+		counts = source->max_count;
+	}
+	oneshot_counts = counts;
+	oneshot_deadline = counter + ticks;
+	source->oneshot(counts);
+}
+
+
+/* 
+ * pit_stop_tick()
+ *   DESCRIPTION: Enters tickless mode: with at most one runnable process there is nothing to time slice, so the periodic 
+ *				  tick stops and the PIT only fires (one-shot) at the next timer deadline. The counter still advances by 
+ *				  the time that went by. Nothing to do if we already are tickless.  
+ *   INPUTS: none 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reprograms the PIT, call with interrupts off
+ */
+void pit_stop_tick(){
+	spin_lock(&pit_lock);
+	if(!tickless){
+		tickless = 1;
+		pit_arm_oneshot();
+	}
+	spin_unlock(&pit_lock);
+}
+
+
+/* 
+ * pit_restart_tick()
+ *   DESCRIPTION: Leaves tickless mode when a second process becomes runnable: the time spent in the current one-shot is 
+ *				  added to the counter and the periodic tick starts again. Nothing to do if the PIT is ticking.  
+ *   INPUTS: none 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: reprograms the PIT, call with interrupts off
+ */
+void pit_restart_tick(){
+	uint32_t left;
+	spin_lock(&pit_lock);
+	if(tickless){
+		tickless = 0;
+		left = source->read_left();
+		pit_account_counts((left <= oneshot_counts) ? oneshot_counts - left : oneshot_counts);		// a count above what we programmed means it already ran out and wrapped 
+		source->periodic(pit_divisor);
+	}
+	spin_unlock(&pit_lock);
+}
+
+
+/* 
+ * pit_timer_changed()
+ *   DESCRIPTION: Called by timer_add: in tickless mode a timer due before the armed one-shot would fire late, so the 
+ *				  time spent in the one-shot is added to the counter and a new one-shot is armed for it. Nothing to do 
+ *				  while ticking, or inside pit_handler (it arms the next one-shot itself once the timers ran).  
+ *   INPUTS: none 
+ *   OUTPUTS: none 
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may reprogram the PIT
  */
-int get_terminal_being_handled(){
-	return terminal_being_handled;
+void pit_timer_changed(){
+	uint32_t left;
+	uint32_t flags = spin_lock_irqsave(&pit_lock);
+	if(tickless && !in_handler && (int)(timer_next_expiry() - (uint32_t)oneshot_deadline) < 0){
+		left = source->read_left();
+		pit_account_counts((left <= oneshot_counts) ? oneshot_counts - left : oneshot_counts);
+		pit_arm_oneshot();
+	}
+	spin_unlock_irqrestore(&pit_lock, flags);
 }
 
 
@@ -57,77 +390,46 @@ int get_counter(){
 
 /* 
  * pit_handler()
- *   DESCRIPTION: Handler that deals with pit interrupts. On the first three interrupts, the 3 base shells for terminals 1, 2, and 3 are spawned. On the 
- *				  fourth interrupt, the first terminal is set as the "seen" terminal. The fourth and fifth interrupts are simply waiting periods to allow 
- *				  any processes from the prior interrupts to finish. After this waiting period, scheduling is activated. 
- * 
- * 			      Note that the terminal being handled for scheduling is based off of the counter that is incremented every time the pit_handler() is entered.
- *				  This value rotates between terminals 1, 2, and 3 in a cyclic pattern. This value is then passed into our scheduler function. 
+ *   DESCRIPTION: Handler that deals with pit interrupts. Every interrupt is charged to the running process' time slice: the
+ *				  interrupt is acknowledged first (we may not come back to this handler for a while) and sched_tick() hands 
+ *				  the CPU to another process when the slice is used up or a higher priority one is runnable. The base shells of terminals 1, 2 and 3 are queued by 
+ *				  scheduler_init(), so all three terminals make progress at the same time. The swap scan runs every 
+ *				  SWAP_SCAN_MS milliseconds and the timers of the timer wheel that are due run before the time slice is charged. 
+ *
+ *				  In tickless mode the interrupt is a one-shot: the counter advances by the time it covered and the next 
+ *				  one-shot is armed (schedule() switches back to periodic ticks when more than one process can run).
  *   INPUTS: none 
  *   OUTPUTS: none 
  *   RETURN VALUE: none 
- *   SIDE EFFECTS: Spawns the 3 base shells and sets up the round-robin for scheduling.   
+ *   SIDE EFFECTS: Switches processes.   
  */
 void pit_handler(){
 	
-	counter+=1;																					// Increment the pit counter 
-
-	terminal_being_handled = (counter%3)+1;  													// Calculate the terminal being handled for scheduling (1 index => we do +1, there are 3 terminal so we do %3 of the counter)
     mask_and_ack(PIT_IRQ_NUM);
-	
-	if(counter==0){																				/* Initialize Terminal 1's Shell */
-
-		clear();
-		enable_irq(PIT_IRQ_NUM); 
-		set_pos(1);																				// Update the cursor so it corresponds with terminal 1's position
-		set_seen_terminal_num(1);																// Set the "seen" terminal to terminal 1
-		terminal_data(1)->last_run_pcb = (pcb_t*)(0x800000 - (0x2000 * 1)); 					// Set the last_run_pcb for terminal 1 to point towards the PCB for shell 1 (8MB - 8KB) 
-		load_4MB_syscall_page(0);																// Map program image to 1st terminal's base shell
-		while(1)
-			system_execute((const uint8_t*)("shell"));
-	}
-	else if(counter==1){																		/* Initialize Terminal 2's Shell */
-
-		copy_terminal_data(2);																	// Map video memory to terminal 2's page 
-		enable_irq(PIT_IRQ_NUM); 
-		set_pos(2);																				// Update the cursor so it corresponds with terminal 2's position
-		set_seen_terminal_num(2);																// Set the "seen" terminal to terminal 2
-		terminal_data(2)->last_run_pcb = (pcb_t*)(0x800000 - (0x2000 * 2)); 					// Set the last_run_pcb for terminal 2 to point towards the PCB for shell 2 (8MB - 2*8KB)
-		load_4MB_syscall_page(1);																// Map program image to 2nd terminal's base shell
-		while(1)
-			system_execute((const uint8_t*)("shell"));
+	spin_lock(&pit_lock);
+	if(tickless){
+		pit_account_counts(oneshot_counts);
 	}
-	else if(counter==2){																		/* Initialize Terminal 3's Shell */
-
-		copy_terminal_data(3);																	// Map video memory to terminal 3's page 
-		enable_irq(PIT_IRQ_NUM); 
-		set_pos(3);																				// Update the cursor so it corresponds with terminal 3's position
-		set_seen_terminal_num(3); 																// Set the "seen" terminal to terminal 3
-		terminal_data(3)->last_run_pcb = (pcb_t*)(0x800000 - (0x2000 * 3)); 					// Set the last_run_pcb for terminal 3 to point towards the PCB for shell 3 (8MB - 3*8KB)
-		load_4MB_syscall_page(2);																// Map program image to 3rd terminal's base shell
-		while(1)
-			system_execute((const uint8_t*)("shell")); 
+	else{
+		counter+=1;																				// Increment the pit counter 
 	}
-	else if(counter==3){																		/* Start in Terminal 1 */
-
-		copy_terminal_data(0);																	// Map video memory to physical video memory 
-		set_pos(1);																				// Update the cursor so it corresponds with terminal 1's position
-		change_global_pcb(((terminal_t*)(terminal_data(1)))->last_run_pcb);						// Change the global pcb in syscall.c to point to the PCB of terminal 1's base shell (8MB - 8KB)
-		set_seen_terminal_num(1);																// Set the "seen" terminal to terminal 1
-		load_4MB_syscall_page(0); 																// Map the Process Image to the code for Terminal 1's shell 
-	}else if(counter == 4){
-		// Pass 
-	} else if(counter == 5){
-		// Pass 
+	in_handler = 1;
+	spin_unlock(&pit_lock);
+
+	clock_tick();																				// Moves the base of the monotonic clock's page forward
+
+	timer_run((uint32_t)counter);																// Expired timeouts: wakes sleepers, may add timers
+
+	if(counter >= next_swap_scan){																// Compress cold pages of processes idling in terminal_read
+		swap_scan();
+		next_swap_scan = counter + pit_ms_to_ticks(SWAP_SCAN_MS);
 	}
-	else{																						/* Start Scheduling */
-		enable_irq(PIT_IRQ_NUM);
-		sti();					
-		//schedule(terminal_being_handled);
-		return;
+	spin_lock(&pit_lock);
+	in_handler = 0;
+	if(tickless){
+		pit_arm_oneshot();
 	}
-	
-
+	spin_unlock(&pit_lock);
     enable_irq(PIT_IRQ_NUM);
-
+	sched_tick();
 }
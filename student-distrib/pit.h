@@ -11,14 +11,65 @@
 #include "schedule.h"
 
 #define PIT_IRQ_NUM 0
+
+/* Hardware behind the tick (and IRQ 0): the PIT by default, the HPET with "timer=hpet". Counts are periods of the
+ * device's input clock; the tick logic in pit.c only sees these. Called with pit_lock held. */
+typedef struct tick_source_t {
+    const char* name;
+    uint32_t freq;                              // input clock in Hz
+    uint32_t max_count;                         // longest one-shot in counts
+    uint32_t max_hz;                            // fastest tick it is good for
+    void (*periodic)(uint32_t counts);          // interrupts every counts periods from now on
+    void (*oneshot)(uint32_t counts);           // one interrupt after counts periods
+    uint32_t (*read_left)();                    // counts left before the one-shot fires, 0 (or more than armed) once it did
+} tick_source_t;
+
 /* Enables/Disables periodic interrupts from the PIT */
 void pit_init(); 
 /* Handler for PIT Interrupts */
 void pit_handler(); 
-/* Getter function for the active terminal */
-int get_terminal_being_handled(); 
 /* Getter function for the PIT counter */
 int get_counter(); 
+/* Stops the periodic tick, the PIT fires once at the next timer deadline instead */
+void pit_stop_tick();
+/* Starts the periodic tick again */
+void pit_restart_tick();
+/* Brings the tickless one-shot forward when a timer was added before it */
+void pit_timer_changed();
+/* Changes the tick frequency */
+int32_t pit_set_hz(uint32_t hz);
+/* Returns the tick frequency */
+uint32_t pit_get_hz();
+/* Returns 1 while the periodic tick is stopped */
+uint32_t pit_tickless();
+/* Converts milliseconds to ticks (at least one) */
+uint32_t pit_ms_to_ticks(uint32_t ms);
+/* Moves the tick to another device, returns -1 if the tick rate does not suit it */
+int32_t pit_use_source(const tick_source_t* source);
+/* Returns the device the tick runs on */
+const tick_source_t* pit_get_source();
+/* Returns the PIT's channel 0 as a tick source */
+const tick_source_t* pit_tick_source();
+/* Returns the fastest tick rate the device allows */
+uint32_t pit_max_hz();
+/* Measures the TSC frequency against channel 2, in kHz */
+uint32_t pit_calibrate_tsc();
+
+#define PIT_BASE_FREQ    1193180      //   Input clock rate of the PIT in Hz
+#define PIT_MAX_COUNT    0xFFFF       //   Largest count of the 16 bit counters (about 55ms)
+#define PIT_DEFAULT_HZ   20           //   Tick frequency unless the boot command line says otherwise
+#define PIT_MIN_HZ       19           //   Slowest rate the 16 bit divisor allows
+#define PIT_MAX_HZ       1000
+#define PIT_PERIODIC_CMD 0x34         //   Channel 0, lobyte/hibyte, mode 2 (rate generator)
+#define PIT_ONESHOT_CMD  0x30         //   Channel 0, lobyte/hibyte, mode 0 (interrupt on terminal count)
+#define PIT_LATCH_CMD    0x00         //   Channel 0, latch count
+#define PIT_CH2_ONESHOT_CMD 0xB0      //   Channel 2, lobyte/hibyte, mode 0
+#define PIT_CALIBRATE_MS 10           //   Length of one TSC calibration run
+#define PIT_CALIBRATE_RUNS 3          //   Runs, the shortest one counts
+#define PIT_GATE_PORT    0x61         //   Channel 2 gate (bit 0), speaker enable (bit 1), channel 2 output (bit 5)
+#define PIT_GATE_CH2     0x01
+#define PIT_SPEAKER_ON   0x02
+#define PIT_OUT_CH2      0x20
 
 #define CHANNEL0 0x40                 //Channel 0 data port (read/write)
 #define CHANNEL1 0x41                 //   Channel 1 data port (read/write)
@@ -1,12 +1,79 @@
-
-/* rtc.c - Initializes RTC interrupts */
+/* rtc.c - Initializes RTC interrupts, and multiplexes them into one virtual RTC per open descriptor */
 
 
 #include "rtc.h"
 #include "lib.h"
 #include "syscall.h"
+#include "wait_queue.h"
+#include "hpet.h"
+
+static volatile uint32_t rtc_ticks=0;                   // Number of RTC interrupts so far
+static uint32_t rtc_hw_freq = 0;                        // Rate the chip interrupts at: the highest rate any descriptor asked for (0: not set yet)
+static rtc_vdev_t rtc_vdevs[PCB_ARR_MAX_COUNT][RTC_MAX_FDS];   // Virtual RTC of each descriptor of each process slot
+static spinlock_t rtc_lock = SPINLOCK_INIT("rtc");      // Guards the RTC registers, rtc_ticks and the virtual RTCs
+
+
+/* 
+ * rtc_vdev()
+ *   DESCRIPTION: Returns the virtual RTC behind descriptor fd of the current process  
+ *   INPUTS: fd - RTC descriptor
+ *   OUTPUTS: none
+ *   RETURN VALUE: the virtual RTC, NULL outside of a process or for a bad descriptor
+ *   SIDE EFFECTS: none
+ */ 
+static rtc_vdev_t* rtc_vdev(int32_t fd){
+    pcb_t* pcb = pcb_ptr();
+    if(pcb == NULL || fd < 0 || fd >= RTC_MAX_FDS){
+        return NULL;
+    }
+    return &rtc_vdevs[pcb->process_num][fd];
+}
 
-static int rtc_flag=0;                                  // Set the flag to 1 when an interrupt happens
+
+/* 
+ * rtc_set_hw_rate()
+ *   DESCRIPTION: Runs the chip at the highest frequency any open virtual RTC wants (RTC_MIN_FREQ when none is open) 
+ *                and gives every virtual RTC the divider that turns it into its own rate. Call with rtc_lock held, 
+ *                after a frequency changed.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may change the rate in Status Register A (and of the HPET timer standing in for the chip)
+ */ 
+static void rtc_set_hw_rate(){
+    uint32_t p, fd, freq = RTC_MIN_FREQ;
+    uint8_t rate = 0x01, prev;
+    rtc_vdev_t* v;
+    for(p = 0; p < PCB_ARR_MAX_COUNT; p++){
+        for(fd = 0; fd < RTC_MAX_FDS; fd++){
+            if(rtc_vdevs[p][fd].freq > freq){
+                freq = rtc_vdevs[p][fd].freq;
+            }
+        }
+    }
+    if(freq != rtc_hw_freq){
+        while((32768 >> (rate-1)) > freq){      // frequency = 32768 >> (rate-1), see rtc_write
+            rate++;
+        }
+        outb(0x8A, RTC_INDEX_PORT);             // Disable NMI, Read from Register A
+        prev = inb(RTC_DATA_PORT);
+        outb(0x8A, RTC_INDEX_PORT);
+        outb((prev & 0xF0) | (rate & 0x0F), RTC_DATA_PORT);
+        rtc_hw_freq = freq;
+        hpet_rtc_rate(freq);                    // HPET timer 1 stands in for the chip while it drives IRQ 8
+    }
+    for(p = 0; p < PCB_ARR_MAX_COUNT; p++){
+        for(fd = 0; fd < RTC_MAX_FDS; fd++){
+            v = &rtc_vdevs[p][fd];
+            if(v->freq != 0){
+                v->divider = rtc_hw_freq / v->freq;
+                if(v->countdown == 0 || v->countdown > v->divider){
+                    v->countdown = v->divider;
+                }
+            }
+        }
+    }
+}
 
 
 /* 
@@ -16,14 +83,14 @@ static int rtc_flag=0;                                  // Set the flag to 1 whe
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Sets the enable_periodic_interrupts bit in Register B to 1 or 0 (depending on RTC_ON). Links RTC interrupts to IRQ8 on the PIC.
+ *   SIDE EFFECTS: Sets the enable_periodic_interrupts bit in Register B to 1 or 0 (depending on RTC_ON) and the rate to RTC_MIN_FREQ. Links RTC interrupts to IRQ8 on the PIC.
  *   NOTES: When accessing Register B, use outb(0x8B, RTC_INDEX_PORT). 0x8B tells the RTC chip that we want to access the register at index 0x0B. By setting the highest bit of this
  *          to 1 (0x8B), this disables NMI interrupts as we read/write to/from Register B. 
  */ 
 void rtc_init(){
     
     
-    cli();                                              // Disable interrupts 
+    uint32_t flags = spin_lock_irqsave(&rtc_lock);      // Register index and data writes must not be split 
      
     
     if(RTC_ON == 1){                                    // Enable/Disable RTC Interrupts depending on the value of RTC_ON in tests.h
@@ -31,205 +98,198 @@ void rtc_init(){
         char old_B = inb(RTC_DATA_PORT);        
         outb(0x8B, RTC_INDEX_PORT);                     // Write to Register B   
         outb(old_B | 0x40, RTC_DATA_PORT);              // Enable periodic interrupts by setting the enable_periodic_interrupt bit = 1 (ORing with 0x40 = 0100 0000 = sets enable flag)
-        enable_irq(RTC_IRQ_NUM); 
     }
     else{
         outb(0x8B, RTC_INDEX_PORT);                     // Disable NMI, Read from Register B 
         char old_B = inb(RTC_DATA_PORT);    
         outb(0x8B, RTC_INDEX_PORT);                     // Write to Register B
         outb(old_B & 0xBF, RTC_DATA_PORT);              // Disable periodic interrupts by setting the enable_periodic_interrupt bit = 0 (ANDing with 0xBF = 1011 1111 = enable flag is 0)
-        enable_irq(RTC_IRQ_NUM);
     }
+    rtc_set_hw_rate();                                  // Start slow (RTC_MIN_FREQ) until a descriptor asks for more
     
     
-    sti();                                              // Enable Interrupts 
+    spin_unlock_irqrestore(&rtc_lock, flags);
+    enable_irq(RTC_IRQ_NUM);
 }
 
 
 /* 
  * rtc_handler()
- *   DESCRIPTION: Handler for RTC Interrupts. Calls the test_interrupts() routine provided in lib.c every time an RTC interrupt is raised.    
+ *   DESCRIPTION: Handler for RTC Interrupts. Counts the interrupt and advances every open virtual RTC: one whose divider 
+ *                runs out gets a pending tick and its reader is woken. A tick nobody reads stays pending, up to one 
+ *                second's worth.    
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Reads Register C such that we are able to recieve more than one RTC Interrupt. 
+ *   SIDE EFFECTS: Reads Register C such that we are able to recieve more than one RTC Interrupt. May switch processes. 
  */ 
 void rtc_handler(){
-    rtc_flag=1;
-
+    uint32_t p, fd;
+    rtc_vdev_t* v;
     mask_and_ack(RTC_IRQ_NUM);           // Mask RTC Interrupts
 
+    spin_lock(&rtc_lock);
+    rtc_ticks++;
     outb(0x0C, RTC_INDEX_PORT);          // Read Register C and do nothing with this information 
     inb(RTC_DATA_PORT);
-    //printf(" RTC Interrupt!\n");
+    for(p = 0; p < PCB_ARR_MAX_COUNT; p++){
+        for(fd = 0; fd < RTC_MAX_FDS; fd++){
+            v = &rtc_vdevs[p][fd];
+            if(v->freq == 0 || --v->countdown > 0){
+                continue;
+            }
+            v->countdown = v->divider;
+            if(v->pending < v->freq){
+                v->pending++;
+            }
+            sched_wake_up(&v->waiters);
+        }
+    }
+    spin_unlock(&rtc_lock);
  
-    //test_interrupts();                 // Call routine to handle interrupt 
-    
     enable_irq(RTC_IRQ_NUM);             // Enable RTC Interrupts
+    sched_preempt();
 }
 
 
 /* 
  * rtc_open
- *   DESCRIPTION: Resets the RTC frequency to 2Hz.   
+ *   DESCRIPTION: Opens a virtual RTC ticking at 2Hz for the current process. Other descriptors keep their own rates.   
  *   INPUTS: filename - filename that corresponds to a a directory entry
  *   OUTPUTS: none
- *   RETURN VALUE: 0 on successfull execution
- *   SIDE EFFECTS: Sets the last 4 bits of Status Register A to the rate for which frequency=2Hz.
+ *   RETURN VALUE: the descriptor on success, -1 if filename is not the RTC or no descriptor is free
+ *   SIDE EFFECTS: may lower the rate the chip interrupts at
  *
  *   Refer to:  https://wiki.osdev.org/RTC#Changing_Interrupt_Rate
  */ 
 int32_t rtc_open(const uint8_t* filename){
     dentry_t dentry;
+    rtc_vdev_t* v;
+    int32_t fd;
+    uint32_t flags;
 
-    uint8_t rate = 0x01;                        // Initialize the rate to 0x01
-    int32_t frequency=2;                        //  Set the frequency to 2Hz
-    //rate=15 -> frequency= 2Hz
-    while((32768 >> (rate-1)) > frequency){     // The formula to calculate the interrupt rate: frequency =  32768 >> (rate-1) where 32768 is the default frequency
-        rate++;                                 // 0x8000 , original rate in rtc, any frequency is this number divide by some power of 2
-    }
-    rate &= 0x0F;	                            // rate is the lower 4 bits of status register A
-
-    cli();                                      // Disable interrupts 
-
-    outb(0x8A, RTC_INDEX_PORT);                 // Disable NMI, Read from Register A
-    uint8_t prev = inb(RTC_DATA_PORT);          // get initial value of register A
-    outb(0x8A, RTC_INDEX_PORT);                 // reset index to A
-    outb((prev & 0xF0) | rate, RTC_DATA_PORT);  // write only our rate to A. Note, rate is the bottom 4 bits.
-
-    
     int retval = read_dentry_by_name (filename, &dentry);
     // check if file type is 0, which is rtc
     if (retval != 0 || dentry.file_type!=0) {
         /*return fail if file type is not a rtc*/
         return -1;
     }
-    int i; 
-    // 2 as stdin and stdout is the first 2, 8 as the array length is 8
-    for(i=2; i<8; i++){         
-        if(pcb_ptr()->fds[i].flags==0){
-            //ignore index node number and file position as we are dealing with rtc
-            pcb_ptr()->fds[i].inode_num = 0;
-            pcb_ptr()->fds[i].file_pos = 0; 
-            pcb_ptr()->fds[i].flags = 1;        //Mark rtc file as in use
-            return i; 
-        }
+    //ignore index node number and file position as we are dealing with rtc, -1 if every descriptor is in use
+    fd = fd_alloc(0);
+    if(fd == -1 || (v = rtc_vdev(fd)) == NULL){
+        return fd;
     }
-    sti();                                      // Enable Interrupts 
-
-    return -1;
+    flags = spin_lock_irqsave(&rtc_lock);
+    v->freq = RTC_MIN_FREQ;
+    v->pending = 0;
+    v->countdown = 0;                           // rtc_set_hw_rate starts a full period
+    rtc_set_hw_rate();
+    spin_unlock_irqrestore(&rtc_lock, flags);
+    return fd;
 }
 
 
 /* 
  * rtc_read
- *   DESCRIPTION: Returns after an RTC interrupt has occurred otherwise waits.(rtc_flag is set to 1 in the rtc_handler)   
- *   INPUTS: fd - N/a
+ *   DESCRIPTION: Blocks until the next tick of this descriptor's virtual RTC (rtc_handler wakes us), the CPU goes to other 
+ *                processes meanwhile. A tick that came since the last read is taken right away, so a reader that is 
+ *                late for one tick keeps its rate.   
+ *   INPUTS: fd - RTC descriptor
  *           buf - N/a
  *           nbytes- N/a
  *
  *   OUTPUTS: none
- *   RETURN VALUE: 0 after an RTC interrupt has occurred
+ *   RETURN VALUE: 0 after a tick, -1 if fd is not an open RTC
  *   SIDE EFFECTS: none
  */ 
 int32_t rtc_read (int32_t fd, void* buf, int32_t nbytes){
-
-    while(rtc_flag==0){                         // Wait for an RTC interrupt 
-        continue;
+    rtc_vdev_t* v = rtc_vdev(fd);
+    uint32_t flags;
+    if(v == NULL){
+        return -1;
     }
-    //printf("rtc_read: Interrupt fired!\n");
-    rtc_flag=0;                                 // Set the RTC flag back to 0 
+    flags = spin_lock_irqsave(&rtc_lock);       // No interrupt may come between testing pending and going to sleep
+    while(v->freq != 0 && v->pending == 0){     // Wait for a tick
+        sched_sleep_on_lock(&v->waiters, &rtc_lock);
+    }
+    if(v->freq == 0){
+        spin_unlock_irqrestore(&rtc_lock, flags);
+        return -1;
+    }
+    v->pending--;
+    spin_unlock_irqrestore(&rtc_lock, flags);
     return 0;
 }
 
 
 /* 
  * rtc_write
- *   DESCRIPTION: Changes the rtc frequency.
- *   INPUTS: fd - N/a
+ *   DESCRIPTION: Changes the frequency of this descriptor's virtual RTC. The chip runs at the highest frequency asked for, 
+ *                slower virtual RTCs tick every few interrupts.
+ *   INPUTS: fd - RTC descriptor
  *           buf - teh buffer pointer that points to the frequency
  *           nbytes- N/a
  *
  *   OUTPUTS: none
- *   RETURN VALUE: 0 on successfull execution
+ *   RETURN VALUE: nbytes on successfull execution
  *                 -1 when frequency is invalid
- *   SIDE EFFECTS: Sets the last 4 bits of Status Register A to the rate (depending on frequency).
+ *   SIDE EFFECTS: may change the rate in Status Register A
  */ 
 int32_t rtc_write(int32_t fd, const void* buf, int32_t nbytes){
-    int32_t frequency= *(int32_t*) buf;
-
-    if((frequency & (frequency - 1)) != 0){     // Formula to check if a number is a power of two: (freq & (freq - 1)) == 0
-        return -1;                              // If not a power of 2 then return -1
-    }
-
-
-    uint8_t rate = 0x01;                        // Initialize the rate to 0x01
-
-  
-    while((32768 >> (rate-1)) > frequency){     // The formula to calculate the interrupt rate: frequency =  32768 >> (rate-1) where 32768 is the default frequency
-        rate++;                                 // 0x8000 , original rate in rtc, any frequency is this number divide by some power of 2
-    }
+    rtc_vdev_t* v = rtc_vdev(fd);
+    uint32_t flags;
+    int32_t frequency;
 
-    
-    
-    if(rate > 15){                              // rate must be below 15(corresponding freq=2 Hz) 
+    if(v == NULL || buf == NULL){
         return -1;
-    } 
-    else if(rate < 6){                          // rate must be on or above 6(corresponding freq=1024 Hz) because an operating system shouldn’t allow userspace programs to 
-        return -1;                              // generate more than 1024 interrupts per second by default.
+    }
+    frequency = *(int32_t*) buf;
+    if(frequency < RTC_MIN_FREQ || frequency > RTC_MAX_FREQ || (frequency & (frequency - 1)) != 0){   // Powers of two only: 2Hz (rate 15) to 1024Hz (rate 6),
+        return -1;                                                                                  // userspace may not get more than 1024 interrupts per second
     }
 
-    
-    rate &= 0x0F;	                            // rate is the lower 4 bit of status register A (0x0F is the mask to get the lower 4 bits)
-
-
-    //Possible frequencies:
-    //rate=6 -> frequency= 1024Hz
-    //rate=7 -> frequency= 512Hz
-    //rate=8 -> frequency= 256Hz
-    //rate=9 -> frequency= 128Hz
-    //rate=10 -> frequency= 64Hz
-    //rate=11 -> frequency= 32Hz
-    //rate=12 -> frequency= 16Hz
-    //rate=13 -> frequency= 8Hz
-    //rate=14 -> frequency= 4Hz
-    //rate=15 -> frequency= 2Hz	
-
-    cli();                                      // Disable Interrupts
-
-    outb( 0x8A ,  RTC_INDEX_PORT);		        // set index to register A, disable NMI
-    uint8_t prev = inb(RTC_DATA_PORT);	        // get initial value of register A
-    outb( 0x8A ,  RTC_INDEX_PORT);	            // reset index to A
-    outb((prev & 0xF0) | rate , RTC_DATA_PORT); // write only our rate to A. Note, rate is the bottom 4 bits.
-
-   
-    sti();                                      // Enable Interrupts
+    flags = spin_lock_irqsave(&rtc_lock);
+    v->freq = frequency;
+    v->pending = 0;
+    v->countdown = 0;
+    rtc_set_hw_rate();
+    spin_unlock_irqrestore(&rtc_lock, flags);
 
     return nbytes;
-
-   
-    
 }
 
 
 /* 
  * rtc_close
- *   DESCRIPTION: Currently does not do anything and returns a constant value
- *   INPUTS: fd - N/a
+ *   DESCRIPTION: Closes the descriptor's virtual RTC, the chip slows down if it was the fastest one
+ *   INPUTS: fd - RTC descriptor
  *   OUTPUTS: none
- *   RETURN VALUE: 0 always
- *   SIDE EFFECTS: nopne
+ *   RETURN VALUE: 0 on success, -1 if fd was not open
+ *   SIDE EFFECTS: may lower the rate in Status Register A
  */ 
 int32_t rtc_close(int32_t fd){
-    /*check if the fd array has fd's flag that's on*/
-    if(pcb_ptr()->fds[fd].flags !=0 ){
-        /*sets the flag to 0 to close the files*/
-        pcb_ptr()->fds[fd].flags = 0;
-        /*return success*/
-        return 0; 
+    rtc_vdev_t* v = rtc_vdev(fd);
+    uint32_t flags;
+    if(v != NULL){
+        flags = spin_lock_irqsave(&rtc_lock);
+        v->freq = 0;
+        v->pending = 0;
+        rtc_set_hw_rate();
+        spin_unlock_irqrestore(&rtc_lock, flags);
     }
-
-    /*return -1 if falied to close*/
-    return -1; 
+    /*sets the flag to 0 to close the file, -1 if it was not open*/
+    return fd_free(fd);
 }
 
+
+/* 
+ * rtc_get_hw_freq
+ *   DESCRIPTION: Returns the rate the chip interrupts at, the highest one any open descriptor asked for
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: interrupts per second
+ *   SIDE EFFECTS: none
+ */ 
+uint32_t rtc_get_hw_freq(){
+    return rtc_hw_freq;
+}
@@ -5,6 +5,7 @@
 #include "lib.h"
 #include "tests.h"
 #include "types.h"
+#include "wait_queue.h"
 
 
 /* Update Rate */
@@ -26,6 +27,22 @@
 #define ENABLE_ALARM_INTERRUPT 0x20
 #define ENABLE_UPDATE_ENDED_INTERRUPT 0x10
 
+/* Frequencies a virtual RTC may run at (powers of two) */
+#define RTC_MIN_FREQ 2
+#define RTC_MAX_FREQ 1024
+
+/* Descriptors per process */
+#define RTC_MAX_FDS 8
+
+/* Virtual RTC of one open descriptor: the chip runs at the fastest rate asked for, divider interrupts make one tick here */
+typedef struct rtc_vdev_t {
+    uint32_t freq;                          // ticks per second, 0 while the descriptor is not an open RTC
+    uint32_t divider;                       // chip interrupts per tick
+    uint32_t countdown;                     // chip interrupts left until the next tick
+    uint32_t pending;                       // ticks not read yet
+    wait_queue_t waiters;                   // the reader, until the next tick
+} rtc_vdev_t;
+
 
 
 /* RTC DRIVER FUNCTIONS */
@@ -38,6 +55,9 @@ int32_t rtc_write (int32_t fd, const void* buf, int32_t nbytes);
 /* Close the RTC */
 int32_t rtc_close(int32_t fd);
 
+/* Returns the rate the chip interrupts at */
+uint32_t rtc_get_hw_freq();
+
 /* Enables/Disables periodic interrupts from the RTC depending on the RTC_ON macro from tests.h */
 void rtc_init(); 
 
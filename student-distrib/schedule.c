@@ -1,94 +1,1009 @@
 #include "schedule.h"
 #include "syscall.h"
+#include "context_switch.h"
+#include "pit.h"
+#include "fpu.h"
+#include "smp.h"
+#include "timer.h"
+
+#define BOOT_FRAME_WORDS 7                                  // eflags, edi, esi, ebx, ebp, return address, fake return of the thread
+#define KTHREAD_FRAME_WORDS 9                               // same, then the function and argument kthread_start is called with
+
+/* Scheduler state of one CPU */
+typedef struct run_queue_t {
+    pcb_t idle_pcb;                                         // The CPU's boot thread, runs (hlt) when the run queue is empty
+    pcb_t* current;                                         // Process owning the CPU
+    pcb_t* queue[SCHED_NUM_LEVELS];                         // Head of the circular run queue of each priority level
+    uint32_t ready_bitmap;                                  // Bit l set when level l has a runnable process
+    uint32_t need_resched;                                  // Set when a woken process outranks the current one
+    uint32_t nr_running;                                    // Processes in the run queues
+} run_queue_t;
+
+static run_queue_t run_queues[MAX_CPUS] = { [0] = { .current = &run_queues[0].idle_pcb } };   // Other CPUs: sched_init_cpu
+static uint32_t boost_counter = 0;                          // Ticks since every process was last put back at its base level
+static uint32_t quantum_ms = SCHED_DEFAULT_QUANTUM_MS;      // Time slice of the top levels, see sched_slice
+static pcb_t kthreads[MAX_KTHREADS];                        // Kernel threads, apart from the process slots
+static uint32_t num_kthreads = 0;
+static uint64_t cpu_acct_stamp[MAX_CPUS];                   // TSC when each CPU last charged time to a process, see sched_account
+
+#define this_rq()   (&this_cpu_var(run_queues))             // Run queue of the running CPU
+#define pcb_rq(pcb) (&run_queues[(pcb)->sched_cpu])         // Run queue a process is (or will be) on
+#define acct_stamp  this_cpu_var(cpu_acct_stamp)
+
+
+/* 
+ * first_ready_level()
+ *   DESCRIPTION: Finds the highest priority (lowest numbered) level with a runnable process in one instruction.
+ *   INPUTS: rq - run queue
+ *   OUTPUTS: none
+ *   RETURN VALUE: level number, only meaningful when rq->ready_bitmap is not 0
+ *   SIDE EFFECTS: none
+ */
+static inline uint32_t first_ready_level(run_queue_t* rq){
+    uint32_t level;
+    asm("bsfl %1, %0" : "=r"(level) : "r"(rq->ready_bitmap));
+    return level;
+}
+
+
+/* 
+ * base_level()
+ *   DESCRIPTION: Level a process starts at and returns to on the periodic boost, set by its nice value.
+ *   INPUTS: pcb - process
+ *   OUTPUTS: none
+ *   RETURN VALUE: level in [0, SCHED_NUM_LEVELS-1]
+ *   SIDE EFFECTS: none
+ */
+static uint32_t base_level(pcb_t* pcb){
+    return pcb->sched_nice - SCHED_NICE_MIN;
+}
+
+
+/* 
+ * top_level()
+ *   DESCRIPTION: Highest level a process may reach, by being interactive: SCHED_INTERACTIVE_BOOST above its base level.
+ *   INPUTS: pcb - process
+ *   OUTPUTS: none
+ *   RETURN VALUE: level in [0, SCHED_NUM_LEVELS-1]
+ *   SIDE EFFECTS: none
+ */
+static uint32_t top_level(pcb_t* pcb){
+    uint32_t base = base_level(pcb);
+    return (base > SCHED_INTERACTIVE_BOOST) ? base - SCHED_INTERACTIVE_BOOST : 0;
+}
+
+
+/* 
+ * sched_slice()
+ *   DESCRIPTION: Time slice of a level: (level/2 + 1) quanta, so CPU bound processes that sank run less often but longer.
+ *   INPUTS: level - priority level
+ *   OUTPUTS: none
+ *   RETURN VALUE: time slice in PIT ticks, at least 1
+ *   SIDE EFFECTS: none
+ */
+uint32_t sched_slice(uint32_t level){
+    return (level/2 + 1) * pit_ms_to_ticks(quantum_ms);
+}
+
+
+/* 
+ * sched_set_quantum()
+ *   DESCRIPTION: Sets the scheduling quantum (boot command line "quantum=", or the timer_config system call). Processes 
+ *                get the new slices the next time their slice is refilled.
+ *   INPUTS: ms - quantum in milliseconds, 1 to SCHED_MAX_QUANTUM_MS (rounded to whole PIT ticks, at least one)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if ms is out of range
+ *   SIDE EFFECTS: none
+ */
+int32_t sched_set_quantum(uint32_t ms){
+    if(ms == 0 || ms > SCHED_MAX_QUANTUM_MS){
+        return -1;
+    }
+    quantum_ms = ms;
+    return 0;
+}
+
+
+/* 
+ * set_level()
+ *   DESCRIPTION: Moves a process to a level with a fresh time slice. A queued process goes to the tail of the new level.
+ *   INPUTS: pcb   - process
+ *           level - new level
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the run queues, must be called with interrupts off
+ */
+static void set_level(pcb_t* pcb, uint32_t level){
+    uint32_t queued = pcb->on_run_queue;
+    if(queued){
+        sched_dequeue(pcb);
+    }
+    pcb->sched_level = level;
+    pcb->sched_ticks_left = sched_slice(level);
+    if(queued){
+        sched_enqueue(pcb);
+    }
+}
+
+
+/* 
+ * resched_cpu()
+ *   DESCRIPTION: Makes a CPU run schedule() at its next sched_preempt(): right away for this CPU, through an 
+ *                IPI_RESCHED interrupt for another one.
+ *   INPUTS: cpu - CPU whose run queue changed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may interrupt another CPU
+ */
+static void resched_cpu(uint32_t cpu){
+    run_queues[cpu].need_resched = 1;
+    if(cpu != this_cpu_id()){
+        smp_send_ipi(cpu, IPI_RESCHED_VECTOR);
+    }
+}
+
+
+/* 
+ * terminal_thread()
+ *   DESCRIPTION: Body of a terminal's base thread: runs the base shell, and runs it again whenever it exits. 
+ *                A freshly queued terminal thread is entered here by switch_to.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: executes "shell" on the terminal of the current process
+ */
+static void terminal_thread(){
+    while(1)
+        system_execute((const uint8_t*)("shell"));
+}
+
+
+/* 
+ * sched_enqueue()
+ *   DESCRIPTION: Adds a process at the tail of the circular run queue of its level (just behind the head), on the 
+ *                CPU given by pcb->sched_cpu.
+ *   INPUTS: pcb - process to make runnable
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the run queue, must be called with interrupts off
+ */
+void sched_enqueue(pcb_t* pcb){
+    run_queue_t* rq = pcb_rq(pcb);
+    uint32_t level = pcb->sched_level;
+    if(pcb->on_run_queue){
+        return;
+    }
+    if(rq->queue[level] == NULL){
+        pcb->run_next = pcb;
+        pcb->run_prev = pcb;
+        rq->queue[level] = pcb;
+        rq->ready_bitmap |= 1 << level;
+    }
+    else{
+        pcb->run_next = rq->queue[level];
+        pcb->run_prev = rq->queue[level]->run_prev;
+        rq->queue[level]->run_prev->run_next = pcb;
+        rq->queue[level]->run_prev = pcb;
+    }
+    pcb->on_run_queue = 1;
+    if(++rq->nr_running > 1){                               // Time slicing is needed again
+        pit_restart_tick();
+    }
+    if(rq->current == &rq->idle_pcb){                       // Wake the CPU up if it sits in its idle loop
+        resched_cpu(pcb->sched_cpu);
+    }
+}
+
+
+/* 
+ * sched_account()
+ *   DESCRIPTION: Charges the TSC cycles since the last call on this CPU to the process it runs, as user or kernel 
+ *                time. Called where the CPU changes hands: the kernel lock is taken on entry from user mode (user 
+ *                time ends) and released on the way back (kernel time ends), and schedule() and sched_replace() 
+ *                charge the kernel time before the CPU moves to another process. The idle thread's "user" time is 
+ *                the time it spent halted, and system calls that run without the kernel lock count as user time.
+ *   INPUTS: user - 1 if the time since the last call was spent in user mode
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void sched_account(uint32_t user){
+    uint64_t now;
+    pcb_t* current = this_rq()->current;
+    rdtsc(now);
+    if(current != NULL && acct_stamp != 0){
+        if(user){
+            current->user_cycles += now - acct_stamp;
+        }
+        else{
+            current->kernel_cycles += now - acct_stamp;
+        }
+    }
+    acct_stamp = now;
+}
+
+
+/* 
+ * sched_start()
+ *   DESCRIPTION: Queues a process that has not run yet (a spawned child) at its base level with a fresh time slice.
+ *   INPUTS: pcb - new process, its kernel_esp points at the frame switch_to enters it with
+ *           cpu - CPU whose run queue it starts on
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the run queue, must be called with interrupts off
+ */
+void sched_start(pcb_t* pcb, uint32_t cpu){
+    pcb->sched_cpu = cpu;
+    pcb->sched_level = base_level(pcb);
+    pcb->sched_ticks_left = sched_slice(pcb->sched_level);
+    pcb->sched_last_ran = 0;
+    sched_enqueue(pcb);
+}
+
+
+/* 
+ * sched_dequeue()
+ *   DESCRIPTION: Removes a process from the run queue.
+ *   INPUTS: pcb - process to remove
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the run queue, must be called with interrupts off
+ */
+void sched_dequeue(pcb_t* pcb){
+    run_queue_t* rq = pcb_rq(pcb);
+    uint32_t level = pcb->sched_level;
+    if(!pcb->on_run_queue){
+        return;
+    }
+    if(pcb->run_next == pcb){                               // Last one in the queue of its level
+        rq->queue[level] = NULL;
+        rq->ready_bitmap &= ~(1 << level);
+    }
+    else{
+        pcb->run_prev->run_next = pcb->run_next;
+        pcb->run_next->run_prev = pcb->run_prev;
+        if(rq->queue[level] == pcb){
+            rq->queue[level] = pcb->run_next;
+        }
+    }
+    pcb->run_next = NULL;
+    pcb->run_prev = NULL;
+    pcb->on_run_queue = 0;
+    rq->nr_running--;
+}
+
+
+/* 
+ * sched_replace()
+ *   DESCRIPTION: Puts new where old sits in the run queue. A terminal only ever has one runnable process, the one 
+ *                at the bottom of its execute chain: execute hands the terminal's turn from the parent to the child 
+ *                and halt hands it back. The turn keeps its priority level and time slice, within the range new's 
+ *                nice value allows.
+ *   INPUTS: old - process leaving the run queue
+ *           new - process taking its place
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the run queue and the current process, must be called with interrupts off
+ */
+void sched_replace(pcb_t* old, pcb_t* new){
+    run_queue_t* rq = pcb_rq(old);
+    uint32_t level = old->sched_level;
+    if(old == new){                                         // A base shell started by its own terminal thread
+        return;
+    }
+    if(rq->current == old){                                 // The time so far was spent on behalf of old
+        sched_account(0);
+    }
+    new->sched_cpu = old->sched_cpu;                        // The turn stays on old's CPU
+    if(level < top_level(new)){
+        level = top_level(new);
+    }
+    new->sched_ticks_left = old->sched_ticks_left;
+    if(old->on_run_queue && level == old->sched_level){     // Same level: take old's place in the list
+        new->sched_level = level;
+        if(old->run_next == old){
+            new->run_next = new;
+            new->run_prev = new;
+        }
+        else{
+            new->run_next = old->run_next;
+            new->run_prev = old->run_prev;
+            old->run_prev->run_next = new;
+            old->run_next->run_prev = new;
+        }
+        if(rq->queue[level] == old){
+            rq->queue[level] = new;
+        }
+        new->on_run_queue = 1;
+        old->on_run_queue = 0;
+    }
+    else{
+        sched_dequeue(old);
+        new->sched_level = level;
+        sched_enqueue(new);
+    }
+    old->run_next = NULL;
+    old->run_prev = NULL;
+    if(rq->current == old){                                 // The CPU now runs on behalf of new
+        rq->current = new;
+    }
+}
+
+
+/* 
+ * sched_set_nice()
+ *   DESCRIPTION: Changes the nice value of a process, clamped to [SCHED_NICE_MIN, SCHED_NICE_MAX]. The process 
+ *                moves to its new base level right away.
+ *   INPUTS: pcb  - process
+ *           nice - new nice value, lower runs first
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the run queues
+ */
+void sched_set_nice(pcb_t* pcb, int32_t nice){
+    uint32_t flags;
+    cli_and_save(flags);
+    if(nice < SCHED_NICE_MIN){
+        nice = SCHED_NICE_MIN;
+    }
+    if(nice > SCHED_NICE_MAX){
+        nice = SCHED_NICE_MAX;
+    }
+    pcb->sched_nice = nice;
+    set_level(pcb, base_level(pcb));
+    restore_flags(flags);
+}
+
+
+/* 
+ * sched_boost()
+ *   DESCRIPTION: Rewards a process that waited for the user (a line from terminal_read): it goes to its top level with 
+ *                a fresh time slice, ahead of the CPU bound processes that sank below it.
+ *   INPUTS: pcb - interactive process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the run queues
+ */
+void sched_boost(pcb_t* pcb){
+    uint32_t flags;
+    cli_and_save(flags);
+    set_level(pcb, top_level(pcb));
+    restore_flags(flags);
+}
+
+
+/* 
+ * find_busiest()
+ *   DESCRIPTION: Finds the CPU with the most processes in its run queue, provided some of them are waiting (more than 
+ *                one) and it has at least two more than the CPU asking, so that moving one evens things out.
+ *   INPUTS: cpu - CPU looking for work, NO_CPU to look for any CPU with waiting processes
+ *   OUTPUTS: none
+ *   RETURN VALUE: the busiest CPU, NO_CPU if no CPU has work to give
+ *   SIDE EFFECTS: none
+ */
+static uint32_t find_busiest(uint32_t cpu){
+    uint32_t i, busiest = NO_CPU, most = 1;
+    uint32_t have = (cpu == NO_CPU) ? 0 : run_queues[cpu].nr_running;
+    for(i = 0; i < MAX_CPUS; i++){
+        if(i != cpu && run_queues[i].nr_running > most && run_queues[i].nr_running >= have + 2){
+            most = run_queues[i].nr_running;
+            busiest = i;
+        }
+    }
+    return busiest;
+}
+
+
+/* 
+ * steal_candidate()
+ *   DESCRIPTION: Picks the process to take from a CPU: the one that would wait longest there, the tail of its lowest 
+ *                priority non empty level. Never the process the CPU is running, the one whose state is in its FPU 
+ *                registers or a kernel thread (they stay on the CPU they were started on), and a cache cold process (not run for SCHED_CACHE_HOT_MS) before a cache hot one, so a 
+ *                process rarely leaves the CPU whose cache holds its data.
+ *   INPUTS: victim - CPU to take from
+ *   OUTPUTS: none
+ *   RETURN VALUE: the process, NULL if none can move
+ *   SIDE EFFECTS: none
+ */
+static pcb_t* steal_candidate(uint32_t victim){
+    run_queue_t* rq = &run_queues[victim];
+    uint32_t now = get_counter();
+    uint32_t hot_ticks = pit_ms_to_ticks(SCHED_CACHE_HOT_MS);
+    pcb_t* hot = NULL;
+    pcb_t* pcb;
+    int level;
+    for(level = SCHED_NUM_LEVELS-1; level >= 0; level--){
+        if(rq->queue[level] == NULL){
+            continue;
+        }
+        pcb = rq->queue[level]->run_prev;                   // tail
+        do{
+            if(pcb != rq->current && pcb != fpu_owner_on(victim) && !pcb->kthread){
+                if(now - pcb->sched_last_ran >= hot_ticks){
+                    return pcb;
+                }
+                if(hot == NULL){
+                    hot = pcb;
+                }
+            }
+            pcb = pcb->run_prev;
+        } while(pcb != rq->queue[level]->run_prev);
+    }
+    return hot;
+}
+
+
+/* 
+ * sched_steal()
+ *   DESCRIPTION: Work stealing: a CPU with an empty run queue takes one waiting process from the busiest CPU (see 
+ *                find_busiest and steal_candidate). The process keeps its level and time slice and from now on runs 
+ *                on its new CPU, until it is stolen again.
+ *   INPUTS: cpu - CPU that wants work
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if a process was moved to cpu, 0 otherwise
+ *   SIDE EFFECTS: changes the run queues, must be called with interrupts off
+ */
+uint32_t sched_steal(uint32_t cpu){
+    uint32_t victim = find_busiest(cpu);
+    pcb_t* pcb;
+    if(victim == NO_CPU || (pcb = steal_candidate(victim)) == NULL){
+        return 0;
+    }
+    sched_dequeue(pcb);
+    pcb->sched_cpu = cpu;
+    sched_enqueue(pcb);
+    return 1;
+}
+
+
+/* 
+ * sched_nr_running()
+ *   DESCRIPTION: Returns how many processes a CPU has in its run queue
+ *   INPUTS: cpu - CPU number
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of runnable processes, the one running included
+ *   SIDE EFFECTS: none
+ */
+uint32_t sched_nr_running(uint32_t cpu){
+    return run_queues[cpu].nr_running;
+}
+
+
+/* 
+ * sched_tick()
+ *   DESCRIPTION: Charges a PIT tick to the current process. A process that uses up its time slice is CPU bound: it is 
+ *                demoted one level (with the longer slice of that level) and goes to the tail of it. Every 
+ *                SCHED_BOOST_MS milliseconds all processes go back to their base level so demoted ones cannot starve. 
+ *                Then the CPU goes to the first process of the highest non empty level. CPU 0 takes the PIT 
+ *                interrupt and forwards it (IPI_TICK) to the other CPUs that have time slicing to do but no local 
+ *                APIC timer running yet, and wakes the idle ones up to steal work while another CPU has processes 
+ *                waiting.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may switch processes, called from the PIT (IPI_TICK, local APIC timer) handler with interrupts off
+ */
+void sched_tick(){
+    int i;
+    uint32_t cpu, busiest;
+    pcb_t* pcb;
+    run_queue_t* rq = this_rq();
+    pcb_t* current = rq->current;
+    if(current != &rq->idle_pcb && current->on_run_queue && --current->sched_ticks_left <= 0){
+        set_level(current, (current->sched_level < SCHED_NUM_LEVELS-1) ? current->sched_level+1 : current->sched_level);
+    }
+    if(this_cpu_id() != 0){                                 // A tick forwarded by CPU 0 (IPI_TICK) or of our own timer
+        schedule();
+        return;
+    }
+    busiest = find_busiest(NO_CPU);
+    for(cpu = 1; cpu < smp_num_cpus(); cpu++){              // Only CPU 0 gets the PIT, the others share the CPU time they need sliced
+        if(run_queues[cpu].nr_running > 1 && !lapic_timer_running(cpu)){
+            smp_send_ipi(cpu, IPI_TICK_VECTOR);             // Its schedule() starts its own timer
+        }
+        else if(run_queues[cpu].nr_running == 0 && busiest != NO_CPU){
+            resched_cpu(cpu);                               // An idle CPU while another has work waiting: let it steal
+        }
+    }
+    if(++boost_counter >= pit_ms_to_ticks(SCHED_BOOST_MS)){
+        boost_counter = 0;
+        for(i = 0; i < PCB_ARR_MAX_COUNT; i++){
+            pcb = pcb_by_num(i);
+            if(pcb->on_run_queue && pcb->sched_level > base_level(pcb)){
+                set_level(pcb, base_level(pcb));
+            }
+        }
+    }
+    schedule();
+}
+
+
+/* 
+ * sched_pick_next()
+ *   DESCRIPTION: O(1) pick: the head of the highest priority level of this CPU's run queue that has a runnable process.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the process to run next, the idle thread when nothing is runnable
+ *   SIDE EFFECTS: none
+ */
+pcb_t* sched_pick_next(){
+    run_queue_t* rq = this_rq();
+    if(rq->ready_bitmap == 0){
+        return &rq->idle_pcb;
+    }
+    return rq->queue[first_ready_level(rq)];
+}
+
+
+/* 
+ * sched_current()
+ *   DESCRIPTION: Returns the process the scheduler is running on this CPU.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the current process' pcb, the idle pcb before any process runs
+ *   SIDE EFFECTS: none
+ */
+pcb_t* sched_current(){
+    return this_rq()->current;
+}
+
+
+/* 
+ * sched_load()
+ *   DESCRIPTION: Installs everything a process expects to find when it runs: the global pcb in syscall.c, esp0 in 
+ *                the TSS (top of its kernel stack), its program/heap/shared memory page tables, its screen (video 
+ *                memory or its terminal's background page) and its vidmap page. A kernel thread only gets back the 
+ *                output terminal schedule() saved for it.
+ *   INPUTS: pcb - process about to run
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes paging, the TSS and the output terminal
+ */
+void sched_load(pcb_t* pcb){
+    change_global_pcb(pcb);
+    this_cpu()->tss->ss0 = KERNEL_DS;
+    this_cpu()->tss->esp0 = pcb->kernel_stack_top;
+    if(pcb->kthread){                                       // Kernel threads run on whatever user space is mapped
+        set_output_terminal(pcb->terminal);                 // but draw where they drew when they were switched out
+        return;
+    }
+    load_4MB_syscall_page(pcb->process_num);
+    set_output_terminal(pcb->terminal);
+    if(pcb->vidmap){
+        vidmap_directory_entry_init(VIDMAP_PDE_INDEX);
+        vidmap_init(VIDMAP_PDE_INDEX);
+    }
+    else{
+        deallocate_page(VIDMAP_PDE_INDEX);
+        tlb_flush();
+    }
+}
+
 
 /* 
  * schedule()
- *   DESCRIPTION: This function handles each terminal in a round robin fashion. The terminal to be handled is handled by the PIT. To switch to the next terminal to handle,
- *                we do the following: 
- *                  1) Save the last run pcb of the terminal we are leaving 
- *                  2) Calculate the number for the terminal we must switch to 
- *                  3) Aquire our kernel stack ESP and EBP such that later we can position ourselves to be looking at the kernel stack of the next process we want to switch to 
- *                  4) Change the global pcb in syscall.c to be last run pcb of the terminal we are switching to 
- *                  5) Map the program image to the program page for the terminal we are going to
- *                  6) Set the esp0 in TSS based off of the new current terminal's stack 
- *                  7) Map video memory either to the seen screen (if we are servicing the seen terminal) or to the not-seen terminal's page 
- *                  8) Save the ESP and EBP of the terminal we are leaving into that terminal's terminal struct, inside of the last_run_pcb
- *                  9) Put the ESP and EBP values we saved earlier for the terminal we are switching to into the actual ESP and EBP registers
- *   INPUTS: terminal_being_handled - 1 or 2 or 3 for each terminal
- *   OUTPUTS: none 
- *   RETURN VALUE: none
- *   SIDE EFFECTS: Allows for us to continuously rotate through all of the terminals and service their current processes for 50ms. 
- */
-void schedule(int terminal_being_handled){
-    // uint32_t new_esp, new_ebp, next_terminal;
-    // int i;
-
-    // //Save the last run pcb of the terminal we are leaving 
-    // terminal_data(terminal_being_handled)->last_run_pcb = pcb_ptr(); 
-    // //
-
-    // // next terminal to switch to
-    // next_terminal = (terminal_being_handled % 3) +1;
-
-    // // set esp and ebp to the next terminal process' value
-    // new_esp = terminal_data(next_terminal)->last_run_pcb->esp;
-    // new_ebp = terminal_data(next_terminal)->last_run_pcb->ebp;
-
-    // // for(i = 1 ; i < 4 ; i++){
-    // //     printf("terminal_data(%d)->last_run_pcb->esp is %d\n",i,terminal_data(i)->last_run_pcb->esp);
-    // //     printf("terminal_data(%d)->last_run_pcb->ebp is %d\n",i,terminal_data(i)->last_run_pcb->ebp);
-    // // }
-    
-    // // while(1){
-    // //     //
-    // // }
-
-    // // change the pcb we are accessing to the current process' pcb
-    // change_global_pcb(terminal_data(next_terminal)->last_run_pcb);                        
-
-    // // load the corresponding code for the process into program virtual page
-    // load_4MB_syscall_page(terminal_data(next_terminal)->last_run_pcb->process_num);
-
-    // // set the esp0 to the esp value of the current terminal's process' esp
-    // // plus 1 as process num is 0 based
-    // tss.esp0 = 0x800000-(0x2000 * (terminal_data(next_terminal)->last_run_pcb->process_num + 1));  
-
-    // // if the terminal we r handling is the one on the screen
-    // // if(next_terminal==get_seen_terminal_num()){
-    // //     // map to 0 -> enable printf to show on screen
-    // //     copy_terminal_data(0);
-    // // }
-    // // else{
-    // //     // map to buffer -> "background"
-    // //     copy_terminal_data(next_terminal);
-    // // }  
-
-    // // stored the old esp and ebp
-    // asm("movl %%ebp, %0;" : "=r" (terminal_data(terminal_being_handled)->last_run_pcb->ebp):);   // Save current EBP
-    // asm("movl %%esp, %0;" : "=r" (terminal_data(terminal_being_handled)->last_run_pcb->esp):);   // Save current ESP 
-
-    // // asm("movl %0, %%ebp;" : :"r" (terminal_data(next_terminal)->last_run_pcb->ebp));   // Save current EBP
-    // // asm("movl %0, %%esp;" : :"r" (terminal_data(next_terminal)->last_run_pcb->esp));   // Save current EBP
-    // // // assign the new esp and ebp
-    // // uint32_t move_to_this_ebp;
-    // // uint32_t move_to_this_esp;
-    
-    // uint32_t a=terminal_data(next_terminal)->last_run_pcb->ebp, b;
-    // Move the esp and ebp for the next terminal to service into registers esp and ebp with inline assembly. 
-    // asm ("movl %1, %%ebp; 
-    //         movl %%ebp, %0;"
-    //         :"=r"(b)        /* output */
-    //         :"r"(a)         /* input */
-    //         :"%ebp"         /* clobbered register */
-    //     );       
-
-    // uint32_t c=terminal_data(next_terminal)->last_run_pcb->esp, d;
-    // asm ("movl %1, %%esp; 
-    //         movl %%esp, %0;"
-    //         :"=r"(d)        /* output */
-    //         :"r"(c)         /* input */
-    //         :"%esp"         /* clobbered register */
-    //     );     
+ *   DESCRIPTION: Gives the CPU to the process picked by sched_pick_next (the idle thread when nothing is runnable): 
+ *                its address space, esp0 and screen are installed with sched_load and switch_to moves onto its kernel 
+ *                stack. We return here when the process we left is picked again. A CPU whose run queue is empty first 
+ *                tries to steal a waiting process from the busiest CPU. With at most one runnable process on every 
+ *                CPU the periodic tick is stopped (tickless idle), sched_enqueue starts it again. CPUs other than 0 
+ *                run their local APIC timer exactly while their own run queue needs slicing. A process that turned 
+ *                preemption off keeps the CPU while it is runnable.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: switches processes
+ */
+void schedule(){
+    uint32_t flags, cpu;
+    pcb_t* prev;
+    pcb_t* next;
+    run_queue_t* rq;
 
+    cli_and_save(flags);
+    rq = this_rq();
+    prev = rq->current;
+    if(prev->preempt_count && prev->on_run_queue){         // Not preemptible: sched_preempt_enable switches later
+        rq->need_resched = 1;
+        restore_flags(flags);
+        return;
+    }
+    rq->need_resched = 0;
+    if(rq->ready_bitmap == 0 && smp_num_cpus() > 1){        // Nothing to do here: look for waiting work elsewhere
+        sched_steal(this_cpu_id());
+    }
+    next = sched_pick_next();
+    for(cpu = 0; cpu < smp_num_cpus() && run_queues[cpu].nr_running <= 1; cpu++);
+    if(cpu == smp_num_cpus()){                              // No CPU has anything to time slice
+        pit_stop_tick();
+    }
+    if(this_cpu_id() != 0){
+        lapic_timer_slice(rq->nr_running > 1);
+    }
+    if(next != prev){
+        sched_account(0);
+        if(prev->on_run_queue){                             // Still runnable: preempted
+            prev->invol_switches++;
+        }
+        else{                                               // Went to sleep or halted
+            prev->vol_switches++;
+        }
+        if(prev->kthread){                                  // Its output terminal, for sched_load
+            prev->terminal = get_output_terminal();
+        }
+        rq->current = next;
+        if(next != &rq->idle_pcb){
+            next->sched_last_ran = get_counter();
+            sched_load(next);
+        }
+        fpu_switch(next);
+        switch_to(prev, next);
+    }
+    restore_flags(flags);
+}
+
+
+/* 
+ * sched_sleep_on()
+ *   DESCRIPTION: Blocks the current process until the event behind wq happens: it leaves the run queue, joins the tail 
+ *                of wq and the CPU goes to other work (or the idle thread's hlt). The caller tests its condition with 
+ *                interrupts off and keeps them off until here, so a wake up cannot slip in between; it tests the 
+ *                condition again when we return. Before the scheduler runs (no process yet) we just halt until the 
+ *                next interrupt, with the kernel lock released.
+ *   INPUTS: wq - wait queue to sleep on
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: switches processes, must be called with interrupts off
+ */
+void sched_sleep_on(wait_queue_t* wq){
+    sched_sleep_on_lock(wq, NULL);
+}
+
+
+/* 
+ * sched_sleep_on_lock()
+ *   DESCRIPTION: sched_sleep_on for a caller that tested its condition under lock (taken with spin_lock_irqsave): the 
+ *                process is on wq before lock is released, so whoever changes the condition under lock and then 
+ *                wakes wq cannot miss it. lock is held again when we return.
+ *   INPUTS: wq   - wait queue to sleep on
+ *           lock - spinlock guarding the condition, NULL for none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: switches processes, must be called with interrupts off
+ */
+void sched_sleep_on_lock(wait_queue_t* wq, spinlock_t* lock){
+    run_queue_t* rq = this_rq();
+    pcb_t* current = rq->current;
+    if(current == &rq->idle_pcb){
+        if(lock != NULL){
+            spin_unlock(lock);
+        }
+        kernel_unlock();
+        asm volatile("sti; hlt; cli" ::: "memory");         // sti only takes effect after hlt, so no interrupt is missed
+        kernel_lock();
+        if(lock != NULL){
+            spin_lock(lock);
+        }
+        return;
+    }
+    sched_dequeue(current);
+    current->wait_next = NULL;
+    if(wq->tail == NULL){
+        wq->head = current;
+    }
+    else{
+        wq->tail->wait_next = current;
+    }
+    wq->tail = current;
+    if(lock != NULL){
+        spin_unlock(lock);
+    }
+    schedule();
+    if(lock != NULL){
+        spin_lock(lock);
+    }
+}
+
+
+/* A process in sched_sleep_on_lock_timeout, for its timer */
+typedef struct sleep_timeout_t {
+    wait_queue_t* wq;
+    pcb_t* pcb;
+    uint32_t timed_out;                                     // set by the timer when it woke the process
+} sleep_timeout_t;
+
+
+/* 
+ * wake_one()
+ *   DESCRIPTION: Puts a process taken off its wait queue back in the run queue of its CPU, and asks that CPU to 
+ *                reschedule if the process outranks the one it runs. Call with interrupts off.
+ *   INPUTS: pcb - process to wake
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the run queues
+ */
+static void wake_one(pcb_t* pcb){
+    run_queue_t* rq;
+    pcb->wait_next = NULL;
+    sched_enqueue(pcb);
+    rq = pcb_rq(pcb);
+    if(rq->current == &rq->idle_pcb || !rq->current->on_run_queue || pcb->sched_level < rq->current->sched_level){
+        resched_cpu(pcb->sched_cpu);
+    }
+}
+
+
+/* 
+ * sleep_timeout_fire()
+ *   DESCRIPTION: Timer function of sched_sleep_on_lock_timeout: takes the process off its wait queue and wakes it, 
+ *                unless a wake up of the queue came first (it is not on the queue anymore).
+ *   INPUTS: arg - the sleeper's sleep_timeout_t
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the wait queue and the run queues
+ */
+static void sleep_timeout_fire(void* arg){
+    sleep_timeout_t* sleeper = (sleep_timeout_t*)arg;
+    wait_queue_t* wq = sleeper->wq;
+    pcb_t* prev = NULL;
+    pcb_t* pcb;
+    uint32_t flags;
+    cli_and_save(flags);
+    for(pcb = wq->head; pcb != NULL && pcb != sleeper->pcb; pcb = pcb->wait_next){
+        prev = pcb;
+    }
+    if(pcb != NULL){
+        if(prev == NULL){
+            wq->head = pcb->wait_next;
+        }
+        else{
+            prev->wait_next = pcb->wait_next;
+        }
+        if(wq->tail == pcb){
+            wq->tail = prev;
+        }
+        sleeper->timed_out = 1;
+        wake_one(pcb);
+    }
+    restore_flags(flags);
 }
 
+
+/* 
+ * sched_sleep_on_lock_timeout()
+ *   DESCRIPTION: sched_sleep_on_lock that also ends after ticks PIT ticks: a timer of the timer wheel takes the process 
+ *                off wq if no wake up came by then. The timer lives on our kernel stack and is cancelled before we 
+ *                return; its function cannot be running at that point, timer functions run in the PIT handler under 
+ *                the kernel lock we hold. Before the scheduler runs we halt until the next interrupt, as 
+ *                sched_sleep_on_lock does.
+ *   INPUTS: wq    - wait queue to sleep on
+ *           lock  - spinlock guarding the condition, NULL for none
+ *           ticks - longest sleep in PIT ticks
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the time ran out, 0 if woken up (or halted with no process)
+ *   SIDE EFFECTS: switches processes, must be called with interrupts off
+ */
+int32_t sched_sleep_on_lock_timeout(wait_queue_t* wq, spinlock_t* lock, uint32_t ticks){
+    sleep_timeout_t sleeper;
+    ktimer_t timer = TIMER_INIT(sleep_timeout_fire, &sleeper);
+    sleeper.wq = wq;
+    sleeper.pcb = this_rq()->current;
+    sleeper.timed_out = 0;
+    timer_add(&timer, ticks);
+    sched_sleep_on_lock(wq, lock);
+    timer_cancel(&timer);
+    return sleeper.timed_out;
+}
+
+
+/* 
+ * sched_wake_up()
+ *   DESCRIPTION: Puts every process sleeping on wq back in the run queue of its CPU. If one of them outranks the 
+ *                process that CPU runs, the next sched_preempt() there switches to it (another CPU is sent an IPI_RESCHED).
+ *   INPUTS: wq - wait queue whose event happened
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the run queues
+ */
+void sched_wake_up(wait_queue_t* wq){
+    uint32_t flags;
+    pcb_t* pcb;
+    cli_and_save(flags);
+    while((pcb = wq->head) != NULL){
+        wq->head = pcb->wait_next;
+        wake_one(pcb);
+    }
+    wq->tail = NULL;
+    restore_flags(flags);
+}
+
+
+/* 
+ * sched_preempt_disable()
+ *   DESCRIPTION: Keeps the current process on the CPU: schedule() leaves it running (remembering that it should 
+ *                switch) until the matching sched_preempt_enable. Calls nest. The process must not sleep meanwhile.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void sched_preempt_disable(){
+    uint32_t flags;
+    cli_and_save(flags);                                    // A preempted process may move to another CPU's run queue
+    this_rq()->current->preempt_count++;
+    restore_flags(flags);
+}
+
+
+/* 
+ * sched_preempt_enable()
+ *   DESCRIPTION: Undoes one sched_preempt_disable. The outermost one switches right away if a switch was held back.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may switch processes
+ */
+void sched_preempt_enable(){
+    uint32_t flags;
+    cli_and_save(flags);
+    if(--this_rq()->current->preempt_count == 0){
+        sched_preempt();
+    }
+    restore_flags(flags);
+}
+
+
+/* 
+ * sched_preempt()
+ *   DESCRIPTION: Switches to a process woken by this interrupt if it outranks the one interrupted, instead of letting it 
+ *                wait for the end of the current time slice. Called last in an interrupt handler (after the EOI).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may switch processes
+ */
+void sched_preempt(){
+    if(this_rq()->need_resched){
+        schedule();
+    }
+}
+
+
+/* 
+ * scheduler_init()
+ *   DESCRIPTION: Turns the boot thread into the idle thread and queues one thread per terminal. Each thread stands in 
+ *                the pcb of its terminal's base shell (slots 0, 1, 2) and gets a small bootstrap kernel stack, prepared 
+ *                so that the first switch_to to it "returns" into terminal_thread. The shell's own kernel stack is only 
+ *                taken by execute. The terminals are spread over the CPUs online. The screens of terminals 2 and 3 
+ *                start blank.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: allocates kernel stacks, fills the run queue; the PIT starts switching to the terminals afterwards
+ */
+void scheduler_init(){
+    int t, prev_terminal;
+    uint32_t flags;
+    uint32_t stack_top;
+    uint32_t* frame;
+    pcb_t* root;
+
+    cli_and_save(flags);
+    for(t = 2; t <= NUM_TERMINALS; t++){                    // Blank background screens
+        prev_terminal = set_output_terminal(t);
+        clear();
+        set_output_terminal(prev_terminal);
+    }
+    this_rq()->idle_pcb.terminal = get_seen_terminal_num();
+    for(t = 1; t <= NUM_TERMINALS; t++){
+        if((stack_top = kernel_stack_alloc(1)) == 0){
+            printf("Out of Kernel Stacks\n");
+            break;
+        }
+        root = pcb_by_num(t-1);
+        root->process_num = t-1;
+        root->terminal = t;
+        root->parent_id = -1;
+        root->vidmap = 0;
+        root->sched_nice = 0;
+        root->sched_level = base_level(root);
+        root->sched_ticks_left = sched_slice(root->sched_level);
+        root->sched_cpu = (t-1) % smp_num_cpus();           // Spread the terminals over the CPUs
+        frame = (uint32_t*)stack_top - BOOT_FRAME_WORDS;
+        frame[0] = 0x2;                                     // eflags: interrupts stay off until execute turns them on
+        frame[1] = 0;                                       // edi
+        frame[2] = 0;                                       // esi
+        frame[3] = 0;                                       // ebx
+        frame[4] = 0;                                       // ebp
+        frame[5] = (uint32_t)terminal_thread;               // switch_to returns here
+        frame[6] = 0;
+        root->kernel_esp = (uint32_t)frame;
+        terminal_data(t)->last_run_pcb = root;
+        sched_enqueue(root);
+    }
+    restore_flags(flags);
+}
+
+
+/* 
+ * kthread_start()
+ *   DESCRIPTION: First code run by a kernel thread, switch_to enters it with the frame set up by kthread_create. 
+ *                Runs the thread's function; if it returns the thread leaves the run queue for good.
+ *   INPUTS: fn  - body of the thread
+ *           arg - its argument
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: none
+ */
+static void kthread_start(void (*fn)(void*), void* arg){
+    fn(arg);
+    while(1){
+        cli();
+        sched_dequeue(this_rq()->current);
+        schedule();
+    }
+}
+
+
+/* 
+ * kthread_create()
+ *   DESCRIPTION: Starts a kernel thread: a pcb outside the process slots, with its own kernel stack and no user 
+ *                address space. It starts at the top priority level, so the work it is woken for (interrupt bottom 
+ *                halves) runs ahead of user processes, and with interrupts on, like any kernel code.
+ *   INPUTS: fn  - body of the thread, called with arg
+ *           arg - argument of fn
+ *           cpu - CPU whose run queue it starts on
+ *   OUTPUTS: none
+ *   RETURN VALUE: the thread's pcb, NULL if there is no pcb or kernel stack left
+ *   SIDE EFFECTS: queues the thread
+ */
+pcb_t* kthread_create(void (*fn)(void*), void* arg, uint32_t cpu){
+    uint32_t flags, stack_top;
+    uint32_t* frame;
+    pcb_t* thread;
+
+    cli_and_save(flags);
+    if(num_kthreads == MAX_KTHREADS || (stack_top = kernel_stack_alloc(1)) == 0){
+        restore_flags(flags);
+        return NULL;
+    }
+    thread = &kthreads[num_kthreads++];
+    thread->kthread = 1;
+    thread->in_use = 1;
+    thread->parent_id = -1;
+    thread->terminal = get_seen_terminal_num();
+    thread->kernel_stack_top = stack_top;
+    thread->sched_nice = SCHED_NICE_MIN;
+    thread->sched_level = base_level(thread);
+    thread->sched_ticks_left = sched_slice(thread->sched_level);
+    thread->sched_cpu = cpu;
+    frame = (uint32_t*)stack_top - KTHREAD_FRAME_WORDS;
+    frame[0] = 0x202;                                       // eflags: interrupts on
+    frame[1] = 0;                                           // edi
+    frame[2] = 0;                                           // esi
+    frame[3] = 0;                                           // ebx
+    frame[4] = 0;                                           // ebp
+    frame[5] = (uint32_t)kthread_start;                     // switch_to returns here
+    frame[6] = 0;                                           // kthread_start never returns
+    frame[7] = (uint32_t)fn;
+    frame[8] = (uint32_t)arg;
+    thread->kernel_esp = (uint32_t)frame;
+    sched_enqueue(thread);
+    restore_flags(flags);
+    return thread;
+}
+
+
+/* 
+ * sched_init_cpu()
+ *   DESCRIPTION: Sets up the run queue of an application processor: the code it runs now becomes its idle thread.
+ *   INPUTS: cpu - CPU number, called on that CPU
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void sched_init_cpu(uint32_t cpu){
+    run_queues[cpu].idle_pcb.terminal = get_seen_terminal_num();
+    run_queues[cpu].idle_pcb.sched_cpu = cpu;
+    run_queues[cpu].current = &run_queues[cpu].idle_pcb;
+}
@@ -10,8 +10,81 @@
 #include "keyboard.h"
 #include "schedule.h"
 #include "x86_desc.h"
+#include "wait_queue.h"
 
-/* schedule function itself*/
-extern void schedule(int terminal_being_handled);
+/* Number of terminals, each runs its own base shell */
+#define NUM_TERMINALS 3
+
+/* Multilevel feedback queue: level 0 runs first. A process starts at the level given by its nice value, sinks one 
+ * level each time it uses up a time slice, and rises to SCHED_INTERACTIVE_BOOST levels above its base when it gets 
+ * a line from the keyboard. Lower levels get longer slices. */
+#define SCHED_NUM_LEVELS        8
+#define SCHED_NICE_MIN          (-4)                        // nice SCHED_NICE_MIN is base level 0
+#define SCHED_NICE_MAX          3                           // nice SCHED_NICE_MAX is base level SCHED_NUM_LEVELS-1
+#define SCHED_INTERACTIVE_BOOST 2
+#define SCHED_DEFAULT_QUANTUM_MS 50                         // time slice of levels 0 and 1, level l gets (l/2 + 1) quanta
+#define SCHED_MAX_QUANTUM_MS    1000
+#define SCHED_BOOST_MS          5000                        // every 5s all processes go back to their base level
+#define SCHED_CACHE_HOT_MS      20                          // a process that ran this recently still has its cache, avoid moving it
+
+/* Kernel threads (work queue workers), see kthread_create */
+#define MAX_KTHREADS            4
+
+/* Sets up the idle thread and queues one base shell thread per terminal */
+extern void scheduler_init();
+
+/* Starts a kernel thread running fn(arg) on cpu, at the top priority level */
+extern pcb_t* kthread_create(void (*fn)(void*), void* arg, uint32_t cpu);
+
+/* Sets up the run queue of an application processor */
+extern void sched_init_cpu(uint32_t cpu);
+
+/* Moves a waiting process from the busiest CPU to cpu, returns 1 if one was moved */
+extern uint32_t sched_steal(uint32_t cpu);
+
+/* Returns the number of processes in the run queue of a CPU */
+extern uint32_t sched_nr_running(uint32_t cpu);
+
+/* Switches to the first process of the highest non empty level */
+extern void schedule();
+
+/* Charges a PIT tick to the current process, demotes it when its slice is used up, then schedules */
+extern void sched_tick();
+
+/* Returns the process schedule() would run next */
+extern pcb_t* sched_pick_next();
+
+/* Sets the nice value of a process and moves it to its base level */
+extern void sched_set_nice(pcb_t* pcb, int32_t nice);
+
+/* Moves an interactive process up to its top level */
+extern void sched_boost(pcb_t* pcb);
+
+/* Sets the scheduling quantum in milliseconds, the time slice of every level derives from it */
+extern int32_t sched_set_quantum(uint32_t ms);
+
+/* Returns the time slice of a level in PIT ticks */
+extern uint32_t sched_slice(uint32_t level);
+
+/* Charges the cycles since the last call to the running process as user (user = 1) or kernel time */
+extern void sched_account(uint32_t user);
+
+/* Gives a new process (a spawned child) its own turn on cpu, at its base level */
+extern void sched_start(pcb_t* pcb, uint32_t cpu);
+
+/* Adds a process at the tail of the run queue */
+extern void sched_enqueue(pcb_t* pcb);
+
+/* Removes a process from the run queue */
+extern void sched_dequeue(pcb_t* pcb);
+
+/* Puts new in the run queue position of old (execute/halt hand the terminal's turn to the child/parent) */
+extern void sched_replace(pcb_t* old, pcb_t* new);
+
+/* Installs the address space, esp0 and screen of a process about to run */
+extern void sched_load(pcb_t* pcb);
+
+/* Returns the process the scheduler is currently running (the idle thread before any other) */
+extern pcb_t* sched_current();
 
 #endif
@@ -0,0 +1,197 @@
+/* shm.c - Shared memory segments mapped into several processes' page tables */
+
+#include "shm.h"
+#include "syscall.h"
+#include "lib.h"
+
+static shm_segment_t segments[SHM_MAX_SEGMENTS];           // Every shared memory segment in the system, indexed by segment id
+
+
+/* 
+ * shm_release()
+ *   DESCRIPTION: Returns the frames of a segment to the frame pool and marks its slot free. 
+ *   INPUTS: seg - segment to release
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees frames
+ */
+static void shm_release(shm_segment_t* seg){
+    uint32_t i;
+    for(i = 0; i < seg->num_pages; i++){
+        free_frame(seg->frames[i]);
+    }
+    seg->in_use = 0;
+}
+
+
+/* 
+ * shm_get(int32_t key, uint32_t size)
+ *   DESCRIPTION: Returns the id of the segment created with key. If no such segment exists (or it was removed), a 
+ *                new one of size bytes (rounded up to whole pages) is created and its frames are allocated up front, so 
+ *                attaching never fails for lack of memory. The segment lives until shm_remove, attached or not. 
+ *   INPUTS: key  - user chosen key identifying the segment
+ *           size - size in bytes, only used when the segment is created
+ *   OUTPUTS: none
+ *   RETURN VALUE: segment id on success, -1 if size is invalid or no slot/frames are left
+ *   SIDE EFFECTS: may allocate frames
+ */
+int32_t shm_get(int32_t key, uint32_t size){
+    int32_t i, id = -1;
+    uint32_t j, num_pages = (size + FRAME_SIZE - 1)/FRAME_SIZE;
+    unsigned long flags;
+
+    cli_and_save(flags);
+    for(i = 0; i < SHM_MAX_SEGMENTS; i++){                         // Look for an existing segment with this key first
+        if(segments[i].in_use && !segments[i].removed && segments[i].key == key){
+            restore_flags(flags);
+            return i;
+        }
+        if(!segments[i].in_use && id == -1){
+            id = i;
+        }
+    }
+    if(id == -1 || num_pages == 0 || num_pages > SHM_MAX_PAGES){
+        restore_flags(flags);
+        return -1;
+    }
+
+    segments[id].in_use = 1;
+    segments[id].key = key;
+    segments[id].attach_count = 0;
+    segments[id].zeroed = 0;
+    segments[id].removed = 0;
+    segments[id].num_pages = 0;
+    for(j = 0; j < num_pages; j++){
+        if((segments[id].frames[j] = allocate_frame()) == 0){         // Out of frames: undo what we have so far
+            shm_release(&segments[id]);
+            restore_flags(flags);
+            return -1;
+        }
+        segments[id].num_pages++;
+    }
+    restore_flags(flags);
+    return id;
+}
+
+
+/* 
+ * shm_attach(int32_t id)
+ *   DESCRIPTION: Maps every frame of segment id into the current process' shared memory window. Segment i always 
+ *                lives at SHM_START + i*SHM_SEG_SPAN, so all processes see it at the same address. 
+ *   INPUTS: id - segment id returned by shm_get
+ *   OUTPUTS: none
+ *   RETURN VALUE: user address of the segment, -1 if id is invalid or the segment was removed
+ *   SIDE EFFECTS: maps pages, zeroes the segment on its first attachment
+ */
+int32_t shm_attach(int32_t id){
+    pcb_t* pcb = pcb_ptr();
+    uint32_t i, addr;
+    unsigned long flags;
+
+    if(id < 0 || id >= SHM_MAX_SEGMENTS){
+        return -1;
+    }
+    addr = SHM_START + id*SHM_SEG_SPAN;
+    cli_and_save(flags);
+    if(!segments[id].in_use || (segments[id].removed && !(pcb->shm_attached & (1 << id)))){
+        restore_flags(flags);
+        return -1;
+    }
+    if(!(pcb->shm_attached & (1 << id))){                          // Attaching twice just returns the same address
+        for(i = 0; i < segments[id].num_pages; i++){
+            shm_map_page(pcb->process_num, id*SHM_MAX_PAGES + i, segments[id].frames[i]);
+        }
+        pcb->shm_attached |= (1 << id);
+        segments[id].attach_count++;
+        if(!segments[id].zeroed){                                   // Never hand out another process' old data
+            memset((void*)addr, 0, segments[id].num_pages*FRAME_SIZE);
+            segments[id].zeroed = 1;
+        }
+    }
+    restore_flags(flags);
+    return (int32_t)addr;
+}
+
+
+/* 
+ * shm_detach(uint32_t addr)
+ *   DESCRIPTION: Unmaps the segment at addr from the current process. Its contents stay for the next process to 
+ *                attach, unless it was removed: then the last detach destroys it. 
+ *   INPUTS: addr - address returned by shm_attach
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if nothing is attached at addr
+ *   SIDE EFFECTS: unmaps pages, may free frames
+ */
+int32_t shm_detach(uint32_t addr){
+    pcb_t* pcb = pcb_ptr();
+    uint32_t i, id;
+    unsigned long flags;
+
+    if(addr < SHM_START || addr >= SHM_START + SHM_MAX_SEGMENTS*SHM_SEG_SPAN || (addr - SHM_START) % SHM_SEG_SPAN != 0){
+        return -1;
+    }
+    id = (addr - SHM_START)/SHM_SEG_SPAN;
+    cli_and_save(flags);
+    if(!(pcb->shm_attached & (1 << id))){
+        restore_flags(flags);
+        return -1;
+    }
+    for(i = 0; i < segments[id].num_pages; i++){
+        shm_unmap_page(pcb->process_num, id*SHM_MAX_PAGES + i);
+    }
+    pcb->shm_attached &= ~(1 << id);
+    if(--segments[id].attach_count == 0 && segments[id].removed){
+        shm_release(&segments[id]);
+    }
+    restore_flags(flags);
+    return 0;
+}
+
+
+/* 
+ * shm_remove(int32_t id)
+ *   DESCRIPTION: Removes segment id: its key no longer finds it (shm_get with the key creates a new segment) and no 
+ *                process can attach it anymore. It is destroyed at once if nothing has it attached, otherwise by the 
+ *                last detach, so processes still using it keep their data. 
+ *   INPUTS: id - segment id returned by shm_get
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if id is invalid or already removed
+ *   SIDE EFFECTS: may free frames
+ */
+int32_t shm_remove(int32_t id){
+    unsigned long flags;
+
+    if(id < 0 || id >= SHM_MAX_SEGMENTS){
+        return -1;
+    }
+    cli_and_save(flags);
+    if(!segments[id].in_use || segments[id].removed){
+        restore_flags(flags);
+        return -1;
+    }
+    segments[id].removed = 1;
+    if(segments[id].attach_count == 0){
+        shm_release(&segments[id]);
+    }
+    restore_flags(flags);
+    return 0;
+}
+
+
+/* 
+ * shm_detach_all()
+ *   DESCRIPTION: Detaches every segment the current process still has mapped. Called from halt so exiting 
+ *                processes do not pin segments. 
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: see shm_detach
+ */
+void shm_detach_all(){
+    uint32_t id;
+    for(id = 0; id < SHM_MAX_SEGMENTS; id++){
+        if(pcb_ptr()->shm_attached & (1 << id)){
+            (void)shm_detach(SHM_START + id*SHM_SEG_SPAN);
+        }
+    }
+}
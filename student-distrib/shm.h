@@ -0,0 +1,33 @@
+#ifndef _SHM_H
+#define _SHM_H
+
+#include "types.h"
+#include "paging.h"
+
+/* Shared Memory Segment */
+typedef struct shm_segment_t {
+    int32_t key;                                // User chosen key, shm_get with the same key returns the same segment
+    uint32_t num_pages;                         // Size of the segment in 4KB pages
+    uint32_t frames[SHM_MAX_PAGES];             // Physical frames backing the segment
+    uint32_t attach_count;                      // Number of processes that currently have the segment mapped
+    uint32_t zeroed;                            // Set once the frames have been cleared through the first attachment
+    uint32_t removed;                           // Set by shm_remove: the key is free and the last detach destroys it
+    uint32_t in_use;
+} shm_segment_t;
+
+/* Finds the segment with key, or creates one of size bytes */
+int32_t shm_get(int32_t key, uint32_t size);
+
+/* Maps segment id into the current process, returns its user address */
+int32_t shm_attach(int32_t id);
+
+/* Unmaps the segment at addr from the current process */
+int32_t shm_detach(uint32_t addr);
+
+/* Marks segment id for removal, it is destroyed now or at its last detach */
+int32_t shm_remove(int32_t id);
+
+/* Unmaps every segment the current process has attached (used by halt) */
+void shm_detach_all();
+
+#endif
@@ -0,0 +1,561 @@
+/* smp.c - Finds the other CPUs, starts them and keeps the kernel to one CPU at a time with the kernel lock */
+
+#include "smp.h"
+#include "acpi.h"
+#include "ioapic.h"
+#include "clock.h"
+#include "pit.h"
+#include "paging.h"
+#include "lib.h"
+#include "fpu.h"
+#include "keyboard.h"
+#include "schedule.h"
+#include "spinlock.h"
+
+cpu_t cpus[MAX_CPUS] = { { 0, 1, &tss } };                     // CPU 0 is the bootstrap processor, running since boot
+static uint32_t num_cpus = 1;                                   // CPUs online
+static uint32_t lapic_base = 0;                                 // Virtual (= physical) address of the local APICs, 0 without one
+static uint32_t lapic_timer_khz = 0;                            // Local APIC timer rate (bus clock / 16), 0 if not calibrated
+static uint32_t cpu_lapic_count[MAX_CPUS];                      // Initial count of each CPU's running timer, 0 while it is stopped
+static tss_t ap_tss[MAX_CPUS-1];                                // TSS of CPUs 1 and up
+static uint8_t ap_stacks[MAX_CPUS-1][AP_STACK_SIZE] __attribute__((aligned(16)));   // Boot stacks, in the identity mapped kernel image
+uint32_t ap_boot_esp;                                           // Stack ap_boot.S gives the processor being started
+static spinlock_t kernel_spinlock = { 1, 0, "kernel", 0, 0, 0, 0, NULL };  // The kernel lock, held by CPU 0 from boot until it first idles
+
+extern uint8_t ap_trampoline_start[], ap_trampoline_end[], ap_gdt_desc[];
+
+
+/* Local APIC register accessors */
+static inline uint32_t lapic_read(uint32_t reg){
+    return *(volatile uint32_t*)(lapic_base + reg);
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t val){
+    *(volatile uint32_t*)(lapic_base + reg) = val;
+}
+
+
+/*
+ * io_delay_us()
+ *   DESCRIPTION: Busy waits about us microseconds: a write to the unused POST port 0x80 takes about one. Only used
+ *                while starting the processors, before anything finer is calibrated.
+ *   INPUTS: us - microseconds
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void io_delay_us(uint32_t us){
+    while(us-- > 0){
+        outb(0, 0x80);
+    }
+}
+
+
+/*
+ * kernel_lock()
+ *   DESCRIPTION: Takes the kernel lock, spinning while another CPU holds it. Once in, this CPU catches up with what
+ *                the others changed meanwhile: kernel mappings (kernel_map_sync) and the cursor of the terminal it
+ *                draws on (output_terminal_load). The time since the lock was released is charged to the running
+ *                process as user time (sched_account). Interrupts are off between taking the lock and recording the owner,
+ *                so an interrupt on this CPU can always tell whether it already holds it.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may spin, changes the TLB, video mapping and cursor of this CPU
+ */
+void kernel_lock(){
+    uint32_t flags = spin_lock_irqsave(&kernel_spinlock);
+    sched_account(1);
+    kernel_map_sync();
+    output_terminal_load();
+    restore_flags(flags);
+}
+
+
+/*
+ * kernel_unlock()
+ *   DESCRIPTION: Releases the kernel lock, leaving the cursor of the terminal this CPU draws on in its terminal
+ *                struct for the next CPU in. The time since the lock was taken is charged as kernel time.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void kernel_unlock(){
+    uint32_t flags;
+    cli_and_save(flags);
+    sched_account(0);
+    output_terminal_save();
+    spin_unlock_irqrestore(&kernel_spinlock, flags);
+}
+
+
+/*
+ * kernel_lock_enter()
+ *   DESCRIPTION: Called by every interrupt and exception entry (expcall.S) and by the system calls marked in
+ *                sys_call_locked (syscall_handler.S). Takes the kernel lock unless this CPU already holds it: an
+ *                interrupt that arrives while the CPU is running locked kernel code, or any entry on a uniprocessor.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the lock was taken here, 0 if this CPU already held it
+ *   SIDE EFFECTS: may spin
+ */
+uint32_t kernel_lock_enter(){
+    if(kernel_spinlock.owner == this_cpu_id()){
+        return 0;
+    }
+    kernel_lock();
+    return 1;
+}
+
+
+/*
+ * kernel_lock_exit()
+ *   DESCRIPTION: Called by the entries on their way out: releases the kernel lock if the matching kernel_lock_enter
+ *                took it. The entry may return on a different kernel stack than the one the lock was taken on (the
+ *                scheduler switched), but the lock belongs to the CPU, which still holds it.
+ *   INPUTS: acquired - what kernel_lock_enter returned
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void kernel_lock_exit(uint32_t acquired){
+    if(acquired){
+        kernel_unlock();
+    }
+}
+
+
+/*
+ * lapic_init()
+ *   DESCRIPTION: Enables the running CPU's local APIC, with its timer stopped. Until the IO APIC takes over, CPU 0
+ *                keeps receiving the 8259's interrupts through LINT0 (virtual wire mode); the other CPUs only get
+ *                interrupts sent by CPUs and their own timer.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the local APIC
+ */
+void lapic_init(){
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | SPURIOUS_VECTOR);
+    lapic_write(LAPIC_LVT_LINT0, (this_cpu_id() == 0 && !ioapic_active()) ? LAPIC_LVT_EXTINT : LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_NMI);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    cpu_lapic_count[this_cpu_id()] = 0;
+}
+
+
+/*
+ * lapic_calibrate()
+ *   DESCRIPTION: Measures the local APIC timer's rate against the TSC: how far it counts down in LAPIC_CALIBRATE_MS.
+ *                The bus clock is the same on every CPU, so CPU 0 measures once for all of them.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: timer rate in kHz, 0 if the TSC is not calibrated
+ *   SIDE EFFECTS: uses CPU 0's timer, busy waits LAPIC_CALIBRATE_MS milliseconds
+ */
+static uint32_t lapic_calibrate(){
+    uint32_t cycles = clock_tsc_khz() * LAPIC_CALIBRATE_MS;
+    uint32_t flags, left;
+    uint64_t start, now;
+    if(cycles == 0){
+        return 0;
+    }
+    cli_and_save(flags);
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+    rdtsc(start);
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    do{
+        rdtsc(now);
+    } while((uint32_t)(now - start) < cycles);
+    left = lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    restore_flags(flags);
+    return (0xFFFFFFFF - left) / LAPIC_CALIBRATE_MS;
+}
+
+
+/*
+ * lapic_setup()
+ *   DESCRIPTION: Maps the local APICs (their address is in the APIC base MSR), enables CPU 0's and calibrates the
+ *                timers. Called by ioapic_init and smp_init, whichever comes first does the work.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the CPU has no local APIC
+ *   SIDE EFFECTS: maps the local APIC
+ */
+int32_t lapic_setup(){
+    uint32_t eax, ebx, ecx, edx;
+    if(lapic_base != 0){
+        return 0;
+    }
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    if(!(edx & CPUID_APIC)){
+        return -1;
+    }
+    asm volatile("rdmsr" : "=a"(eax), "=d"(edx) : "c"(MSR_APIC_BASE));
+    lapic_base = eax & LAPIC_BASE_MASK;
+    mmio_directory_entry_init(lapic_base);
+    cpus[0].apic_id = lapic_read(LAPIC_ID) >> 24;
+    lapic_init();
+    lapic_timer_khz = lapic_calibrate();
+    return 0;
+}
+
+
+/*
+ * lapic_timer_slice()
+ *   DESCRIPTION: Starts or stops the running CPU's local APIC timer, which raises LAPIC_TIMER_VECTOR at the PIT's
+ *                tick rate: a CPU other than 0 slices its own time with it instead of waiting for CPU 0 to forward
+ *                ticks (IPI_TICK). Called by schedule with whether the run queue needs slicing, so it only touches
+ *                the APIC when that changes (or the tick rate did).
+ *   INPUTS: on - 1 to run the timer, 0 to stop it
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the local APIC
+ */
+void lapic_timer_slice(uint32_t on){
+    uint32_t hz = pit_get_hz();
+    uint32_t count = (on && lapic_timer_khz != 0) ? (lapic_timer_khz / hz) * 1000 + (lapic_timer_khz % hz) * 1000 / hz : 0;
+    uint32_t* running = &cpu_lapic_count[this_cpu_id()];
+    if(count == *running){
+        return;
+    }
+    *running = count;
+    if(count == 0){
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_TIMER_VECTOR);
+        lapic_write(LAPIC_TIMER_INIT, 0);
+        return;
+    }
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, count);
+}
+
+
+/*
+ * lapic_timer_running()
+ *   DESCRIPTION: Tells whether a CPU's local APIC timer is slicing its time
+ *   INPUTS: cpu - CPU number
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it runs, 0 if the CPU depends on forwarded ticks
+ *   SIDE EFFECTS: none
+ */
+uint32_t lapic_timer_running(uint32_t cpu){
+    return cpu_lapic_count[cpu] != 0;
+}
+
+
+/*
+ * lapic_timer_freq()
+ *   DESCRIPTION: Returns the local APIC timer rate measured by lapic_setup
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: rate in kHz, 0 without a local APIC or before lapic_setup
+ *   SIDE EFFECTS: none
+ */
+uint32_t lapic_timer_freq(){
+    return lapic_timer_khz;
+}
+
+
+/*
+ * lapic_eoi()
+ *   DESCRIPTION: Acknowledges an interrupt delivered by the local APIC: one from another CPU or its timer, or an ISA
+ *                IRQ routed through the IO APIC
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void lapic_eoi(){
+    if(lapic_base != 0){
+        lapic_write(LAPIC_EOI, 0);
+    }
+}
+
+
+/*
+ * lapic_send()
+ *   DESCRIPTION: Sends an interrupt command to a local APIC and waits until it has been delivered
+ *   INPUTS: apic_id - APIC id of the target
+ *           command - value of the low command register (delivery mode and vector)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void lapic_send(uint32_t apic_id, uint32_t command){
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while(lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING){
+        asm volatile("pause");
+    }
+}
+
+
+/*
+ * smp_send_ipi()
+ *   DESCRIPTION: Interrupts another CPU
+ *   INPUTS: cpu    - target CPU
+ *           vector - IPI_RESCHED_VECTOR or IPI_TICK_VECTOR
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void smp_send_ipi(uint32_t cpu, uint32_t vector){
+    uint32_t flags;
+    if(cpu >= num_cpus || cpu == this_cpu_id()){
+        return;
+    }
+    cli_and_save(flags);
+    lapic_send(cpus[cpu].apic_id, LAPIC_ICR_FIXED | vector);
+    restore_flags(flags);
+}
+
+
+/*
+ * smp_num_cpus()
+ *   DESCRIPTION: Returns the number of CPUs online, numbered 0 to smp_num_cpus()-1
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of CPUs
+ *   SIDE EFFECTS: none
+ */
+uint32_t smp_num_cpus(){
+    return num_cpus;
+}
+
+
+/*
+ * add_cpu()
+ *   DESCRIPTION: Records a CPU found in the firmware tables, unless it is the bootstrap processor (already CPU 0) or
+ *                there are MAX_CPUS already
+ *   INPUTS: apic_id - its APIC id
+ *           count   - CPUs recorded so far
+ *   OUTPUTS: none
+ *   RETURN VALUE: CPUs recorded now
+ *   SIDE EFFECTS: none
+ */
+static uint32_t add_cpu(uint32_t apic_id, uint32_t count){
+    if(apic_id == cpus[0].apic_id || count >= MAX_CPUS){
+        return count;
+    }
+    cpus[count].apic_id = apic_id;
+    cpus[count].online = 0;
+    return count + 1;
+}
+
+
+/*
+ * find_cpus_madt()
+ *   DESCRIPTION: Finds the local APICs in the ACPI MADT
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of CPUs recorded (at least 1), 0 if there is no MADT
+ *   SIDE EFFECTS: changes the ACPI pages of the kernel map window
+ */
+static uint32_t find_cpus_madt(){
+    acpi_madt_t* madt = (acpi_madt_t*)acpi_find_table("APIC");
+    madt_entry_t* entry;
+    madt_lapic_t* lapic;
+    uint32_t count = 1;
+    uint8_t* end;
+    if(madt == NULL){
+        return 0;
+    }
+    end = (uint8_t*)madt + madt->header.length;
+    for(entry = (madt_entry_t*)(madt + 1); (uint8_t*)entry < end && entry->length > 0;
+        entry = (madt_entry_t*)((uint8_t*)entry + entry->length)){
+        lapic = (madt_lapic_t*)entry;
+        if(entry->type == MADT_LAPIC && (lapic->flags & MADT_LAPIC_ENABLED)){
+            count = add_cpu(lapic->apic_id, count);
+        }
+    }
+    return count;
+}
+
+
+/*
+ * find_cpus_mp()
+ *   DESCRIPTION: Finds the processors in the MP specification tables (older machines and firmware without ACPI):
+ *                the floating pointer is in the first KB of the EBDA or in the BIOS ROM
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of CPUs recorded (at least 1), 0 if there is no valid MP configuration table
+ *   SIDE EFFECTS: changes the ACPI pages of the kernel map window
+ */
+static uint32_t find_cpus_mp(){
+    uint32_t ebda, addr, config_addr, length, i, count = 1;
+    mp_float_t* mpf;
+    mp_config_t* config;
+    uint8_t* entry;
+    ebda = (uint32_t)(*(uint16_t*)acpi_map(BIOS_EBDA_SEG_PTR, 2)) << 4;
+    addr = (ebda != 0) ? acpi_scan(ebda, ebda + 1024, "_MP_", 4) : 0;
+    if(addr == 0 && (addr = acpi_scan(BIOS_ROM_START, BIOS_ROM_END, "_MP_", 4)) == 0){
+        return 0;
+    }
+    mpf = (mp_float_t*)acpi_map(addr, sizeof(mp_float_t));
+    if(!acpi_checksum_ok(mpf, sizeof(mp_float_t)) || (config_addr = mpf->config_addr) == 0){
+        return 0;
+    }
+    length = ((mp_config_t*)acpi_map(config_addr, sizeof(mp_config_t)))->length;
+    config = (mp_config_t*)acpi_map(config_addr, length);
+    if(config == NULL || strncmp((const int8_t*)config->signature, (const int8_t*)"PCMP", 4) != 0 ||
+       !acpi_checksum_ok(config, length)){
+        return 0;
+    }
+    entry = (uint8_t*)(config + 1);
+    for(i = 0; i < config->entry_count && entry < (uint8_t*)config + length; i++){
+        if(*entry != MP_ENTRY_CPU){
+            entry += MP_ENTRY_OTHER_SIZE;
+            continue;
+        }
+        if(((mp_cpu_t*)entry)->flags & MP_CPU_ENABLED){
+            count = add_cpu(((mp_cpu_t*)entry)->apic_id, count);
+        }
+        entry += sizeof(mp_cpu_t);
+    }
+    return count;
+}
+
+
+/*
+ * ap_tss_init()
+ *   DESCRIPTION: Gives an application processor its own TSS (esp0 of the process it runs) and a GDT descriptor for
+ *                it, built like the bootstrap processor's in kernel.c
+ *   INPUTS: cpu - CPU number, 1 and up
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the GDT
+ */
+static void ap_tss_init(uint32_t cpu){
+    seg_desc_t the_tss_desc;
+    tss_t* cpu_tss = &ap_tss[cpu-1];
+    the_tss_desc.granularity   = 0x0;
+    the_tss_desc.opsize        = 0x0;
+    the_tss_desc.reserved      = 0x0;
+    the_tss_desc.avail         = 0x0;
+    the_tss_desc.seg_lim_19_16 = TSS_SIZE & 0x000F0000;
+    the_tss_desc.present       = 0x1;
+    the_tss_desc.dpl           = 0x0;
+    the_tss_desc.sys           = 0x0;
+    the_tss_desc.type          = 0x9;
+    the_tss_desc.seg_lim_15_00 = TSS_SIZE & 0x0000FFFF;
+    SET_TSS_PARAMS(the_tss_desc, cpu_tss, tss_size);
+    cpu_tss_desc_ptr[cpu-1] = the_tss_desc;
+
+    cpu_tss->ldt_segment_selector = KERNEL_LDT;
+    cpu_tss->ss0 = KERNEL_DS;
+    cpu_tss->esp0 = (uint32_t)ap_stacks[cpu-1] + AP_STACK_SIZE;
+    cpus[cpu].tss = cpu_tss;
+}
+
+
+/*
+ * start_ap()
+ *   DESCRIPTION: Starts an application processor with the INIT, startup, startup sequence of the MP specification,
+ *                pointing it at the start code copied to AP_TRAMPOLINE_ADDR, and waits until ap_main reports it online
+ *   INPUTS: cpu - CPU number
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the CPU came up, 0 if it did not within AP_START_TIMEOUT_US
+ *   SIDE EFFECTS: the CPU starts running ap_main
+ */
+static uint32_t start_ap(uint32_t cpu){
+    uint32_t i, waited;
+    ap_tss_init(cpu);
+    ap_boot_esp = (uint32_t)ap_stacks[cpu-1] + AP_STACK_SIZE;
+    lapic_send(cpus[cpu].apic_id, LAPIC_ICR_INIT);
+    io_delay_us(10000);
+    for(i = 0; i < 2 && !cpus[cpu].online; i++){
+        lapic_send(cpus[cpu].apic_id, LAPIC_ICR_STARTUP | (AP_TRAMPOLINE_ADDR >> 12));
+        io_delay_us(200);
+    }
+    for(waited = 0; !cpus[cpu].online && waited < AP_START_TIMEOUT_US; waited += 10){
+        io_delay_us(10);
+    }
+    return cpus[cpu].online;
+}
+
+
+/*
+ * smp_init()
+ *   DESCRIPTION: Sets up the local APICs (lapic_setup), finds the CPUs in the ACPI MADT (or the MP tables), copies
+ *                the start code of ap_boot.S below 1MB and starts every application processor one at a time. Each
+ *                one goes through ap_main and waits for the kernel lock, which CPU 0 releases when it first idles.
+ *                Without a local APIC or firmware tables the kernel keeps running on CPU 0 alone.
+ *   INPUTS: none
+ *   OUTPUTS: prints the number of CPUs started
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may map the local APIC, starts CPUs, changes the GDT
+ */
+void smp_init(){
+    uint32_t count, cpu;
+    uint8_t* trampoline;
+
+    if(lapic_setup() == -1){
+        return;
+    }
+    if((count = find_cpus_madt()) == 0 && (count = find_cpus_mp()) == 0){
+        return;
+    }
+
+    trampoline = (uint8_t*)kmap(SMP_KMAP_INDEX, AP_TRAMPOLINE_ADDR);
+    memcpy(trampoline, ap_trampoline_start, ap_trampoline_end - ap_trampoline_start);
+    memcpy(trampoline + (ap_gdt_desc - ap_trampoline_start), &gdt_desc_ptr, 6);
+    kunmap(SMP_KMAP_INDEX);
+
+    for(cpu = 1; cpu < count; cpu++){
+        if(!start_ap(cpu)){
+            printf("CPU %d (APIC %d) did not start\n", cpu, cpus[cpu].apic_id);
+            break;
+        }
+        num_cpus++;
+    }
+    printf("%d CPU(s) online\n", num_cpus);
+}
+
+
+/*
+ * ap_main()
+ *   DESCRIPTION: First C code of an application processor, on the boot stack smp_init gave it (its idle thread's
+ *                stack from now on). It loads its TSS, turns on paging with its own copy of the per-CPU tables, its FPU
+ *                and local APIC, reports itself online and joins the kernel through the kernel lock.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: runs the idle loop of the CPU
+ */
+void ap_main(){
+    uint32_t cpu = num_cpus;                                    // smp_init starts one CPU at a time
+    ltr(CPU_TSS_SEL(cpu));                                      // from here on this_cpu_id() is cpu
+    lldt(KERNEL_LDT);
+    page_init_ap();
+    fpu_init();
+    lapic_init();
+    sched_init_cpu(cpu);
+    cpus[cpu].online = 1;
+    kernel_lock();
+    cpu_idle();
+}
+
+
+/*
+ * cpu_idle()
+ *   DESCRIPTION: Idle thread of a CPU: runs whatever its run queue holds and halts with the kernel lock released
+ *                while it is empty. An interrupt (on CPU 0) or an IPI_RESCHED from a CPU that queued a process here
+ *                wakes it up. Called with the kernel lock held.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: switches processes
+ */
+void cpu_idle(){
+    while(1){
+        schedule();
+        kernel_unlock();
+        asm volatile("sti; hlt; cli" ::: "memory");             // sti only takes effect after hlt, so no interrupt is missed
+        kernel_lock();
+    }
+}
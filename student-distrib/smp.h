@@ -0,0 +1,137 @@
+#ifndef _SMP_H
+#define _SMP_H
+
+#include "types.h"
+#include "x86_desc.h"
+#include "expnum.h"
+
+/* Local APIC registers, as offsets from its base address */
+#define MSR_APIC_BASE       0x1B                                // model specific register holding the local APIC's address
+#define LAPIC_BASE_MASK     0xFFFFF000
+#define LAPIC_ID            0x20                                // bits 24-31: APIC id of the CPU
+#define LAPIC_EOI           0xB0
+#define LAPIC_SVR           0xF0                                // spurious interrupt vector, bit 8 enables the APIC
+#define LAPIC_ICR_LOW       0x300                               // interrupt command: writing it sends the IPI
+#define LAPIC_ICR_HIGH      0x310                               // bits 24-31: APIC id of the target
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_LVT_LINT0     0x350
+#define LAPIC_LVT_LINT1     0x360
+#define LAPIC_TIMER_INIT    0x380                               // initial count, writing it starts the timer
+#define LAPIC_TIMER_CUR     0x390                               // current count
+#define LAPIC_TIMER_DIV     0x3E0
+#define LAPIC_SVR_ENABLE    0x100
+#define LAPIC_ICR_INIT      0x00004500                          // INIT, level assert
+#define LAPIC_ICR_STARTUP   0x00004600                          // startup IPI, low byte = page of the start code
+#define LAPIC_ICR_FIXED     0x00004000                          // fixed interrupt, low byte = vector
+#define LAPIC_ICR_PENDING   0x1000                              // delivery status: still being sent
+#define LAPIC_LVT_EXTINT    0x700                               // LINT0 passes the 8259's interrupts through
+#define LAPIC_LVT_NMI       0x400
+#define LAPIC_LVT_MASKED    0x10000
+#define LAPIC_TIMER_PERIODIC 0x20000                            // reloads the initial count when it reaches 0
+#define LAPIC_TIMER_DIV_16  0x3                                 // timer counts the bus clock divided by 16
+#define LAPIC_CALIBRATE_MS  10
+#define CPUID_APIC          0x200                               // CPUID(1) EDX bit: the CPU has a local APIC
+
+/* Application processor start code, see ap_boot.S */
+#define AP_TRAMPOLINE_ADDR  0x8000                              // page 0x08, the startup IPI vector
+#define SMP_KMAP_INDEX      12                                  // kernel map page used to copy it there
+#define AP_STACK_SIZE       4096                                // boot stack, later the stack of the CPU's idle thread
+#define AP_START_TIMEOUT_US 100000
+
+/* MP specification tables, used when there is no ACPI MADT */
+typedef struct __attribute__((packed)) mp_float_t {
+    char signature[4];                          // "_MP_"
+    uint32_t config_addr;                       // physical address of the configuration table
+    uint8_t length;                             // in 16 byte units
+    uint8_t spec_rev;
+    uint8_t checksum;
+    uint8_t features[5];
+} mp_float_t;
+
+typedef struct __attribute__((packed)) mp_config_t {
+    char signature[4];                          // "PCMP"
+    uint16_t length;
+    uint8_t spec_rev;
+    uint8_t checksum;
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t lapic_addr;
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+} mp_config_t;
+
+typedef struct __attribute__((packed)) mp_cpu_t {
+    uint8_t type;                               // MP_ENTRY_CPU
+    uint8_t apic_id;
+    uint8_t apic_version;
+    uint8_t flags;                              // MP_CPU_ENABLED, MP_CPU_BSP
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} mp_cpu_t;
+
+#define MP_ENTRY_CPU        0                   // the only entry that is 20 bytes long, the others take 8
+#define MP_ENTRY_OTHER_SIZE 8
+#define MP_CPU_ENABLED      0x1
+#define MP_CPU_BSP          0x2
+
+/* One CPU */
+typedef struct cpu_t {
+    uint32_t apic_id;
+    uint32_t online;                            // set by the CPU once it is running kernel code
+    tss_t* tss;                                 // its task state segment (esp0 of the process it runs)
+} cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+
+/* Returns the running CPU */
+static inline cpu_t* this_cpu(){
+    return &cpus[this_cpu_id()];
+}
+
+/* Finds the CPUs (ACPI MADT or MP tables) and starts the application processors */
+void smp_init();
+
+/* Number of CPUs online */
+uint32_t smp_num_cpus();
+
+/* C entry point of an application processor, called by ap_boot.S */
+void ap_main();
+
+/* Idle loop of a CPU: runs its run queue and halts when it is empty, never returns */
+void cpu_idle();
+
+/* Sends an interrupt with the given vector to a CPU */
+void smp_send_ipi(uint32_t cpu, uint32_t vector);
+
+/* Acknowledges an interrupt delivered by the local APIC */
+void lapic_eoi();
+
+/* Maps the local APICs, enables CPU 0's and calibrates the timers; -1 without a local APIC */
+int32_t lapic_setup();
+
+/* Enables the running CPU's local APIC */
+void lapic_init();
+
+/* Starts (1) or stops (0) the running CPU's local APIC timer at the tick rate */
+void lapic_timer_slice(uint32_t on);
+
+/* Whether a CPU's local APIC timer runs */
+uint32_t lapic_timer_running(uint32_t cpu);
+
+/* Local APIC timer rate in kHz, 0 if not calibrated */
+uint32_t lapic_timer_freq();
+
+/* Kernel lock: scheduling, memory management and the screen run on one CPU at a time */
+void kernel_lock();
+void kernel_unlock();
+
+/* Kernel entry/exit: take the kernel lock unless this CPU already holds it, and drop it again if we took it */
+uint32_t kernel_lock_enter();
+void kernel_lock_exit(uint32_t acquired);
+
+#endif
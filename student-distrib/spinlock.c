@@ -0,0 +1,167 @@
+/* spinlock.c - Locks spun on by the CPUs, with counters showing which ones are contended */
+
+#include "spinlock.h"
+#include "lib.h"
+
+static spinlock_t* lock_list = NULL;                            // Every lock taken at least once, for spin_dump_stats
+static volatile uint32_t lock_list_locked = 0;                  // Guards lock_list (a plain flag: the list lock is not on the list)
+
+
+/*
+ * spin_register()
+ *   DESCRIPTION: Puts a lock on the list spin_dump_stats walks, the first time it is taken. The caller holds the lock,
+ *                so no other CPU registers it at the same time.
+ *   INPUTS: lock - lock just taken for the first time
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void spin_register(spinlock_t* lock){
+    while(xchg(&lock_list_locked, 1) != 0){
+        asm volatile("pause");
+    }
+    lock->next = lock_list;
+    lock_list = lock;
+    lock->registered = 1;
+    xchg(&lock_list_locked, 0);
+}
+
+
+/*
+ * spin_acquire()
+ *   DESCRIPTION: Takes lock. While another CPU holds it we spin reading it (no locked bus cycles) with the interrupt
+ *                flag the caller had in flags, and try again once it looks free. The counters are updated once the
+ *                lock is ours, so they need no lock of their own.
+ *   INPUTS: lock  - lock to take
+ *           flags - EFLAGS to spin with
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: returns with interrupts off, may spin
+ */
+static void spin_acquire(spinlock_t* lock, uint32_t flags){
+    uint32_t contended = 0;
+    uint64_t start = 0, end;
+    cli();
+    while(xchg(&lock->locked, 1) != 0){
+        if(!contended){
+            contended = 1;
+            rdtsc(start);
+        }
+        restore_flags(flags);
+        while(lock->locked){
+            asm volatile("pause");
+        }
+        cli();
+    }
+    lock->owner = this_cpu_id();
+    lock->acquisitions++;
+    if(contended){
+        rdtsc(end);
+        lock->contended++;
+        lock->wait_cycles += end - start;
+    }
+    if(!lock->registered){
+        spin_register(lock);
+    }
+}
+
+
+/*
+ * spin_lock_init()
+ *   DESCRIPTION: Makes lock a free lock called name, for locks that live in structures set up at run time. Locks
+ *                with static storage use SPINLOCK_INIT instead. The counters are kept, so a lock in a slot that is
+ *                reused keeps counting.
+ *   INPUTS: lock - lock to set up
+ *           name - name spin_dump_stats shows
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void spin_lock_init(spinlock_t* lock, const char* name){
+    lock->locked = 0;
+    lock->owner = NO_CPU;
+    lock->name = name;
+}
+
+
+/*
+ * spin_lock()
+ *   DESCRIPTION: Takes lock, spinning while another CPU holds it. For code that already runs with interrupts off
+ *                (interrupt handlers), or whose lock no interrupt handler takes.
+ *   INPUTS: lock - lock to take
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may spin
+ */
+void spin_lock(spinlock_t* lock){
+    uint32_t flags;
+    cli_and_save(flags);
+    spin_acquire(lock, flags);
+    restore_flags(flags);
+}
+
+
+/*
+ * spin_unlock()
+ *   DESCRIPTION: Releases lock
+ *   INPUTS: lock - lock held by this CPU
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void spin_unlock(spinlock_t* lock){
+    lock->owner = NO_CPU;
+    xchg(&lock->locked, 0);
+}
+
+
+/*
+ * spin_lock_irqsave()
+ *   DESCRIPTION: Turns interrupts off on this CPU and takes lock, for data an interrupt handler also uses: the
+ *                handler cannot come in and spin on a lock its own CPU holds. While another CPU holds the lock
+ *                we spin with interrupts as they were.
+ *   INPUTS: lock - lock to take
+ *   OUTPUTS: none
+ *   RETURN VALUE: EFLAGS before the call, for spin_unlock_irqrestore
+ *   SIDE EFFECTS: interrupts are off until spin_unlock_irqrestore, may spin
+ */
+uint32_t spin_lock_irqsave(spinlock_t* lock){
+    uint32_t flags;
+    cli_and_save(flags);
+    spin_acquire(lock, flags);
+    return flags;
+}
+
+
+/*
+ * spin_unlock_irqrestore()
+ *   DESCRIPTION: Releases lock and gives interrupts back the state spin_lock_irqsave found them in
+ *   INPUTS: lock  - lock held by this CPU
+ *           flags - what spin_lock_irqsave returned
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may turn interrupts on
+ */
+void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags){
+    spin_unlock(lock);
+    restore_flags(flags);
+}
+
+
+/*
+ * spin_dump_stats()
+ *   DESCRIPTION: Prints, for every lock taken so far, how often it was taken, how often another CPU held it at
+ *                the time and how long we spun on it (in units of 1024 TSC cycles). Hot locks are the ones worth
+ *                splitting.
+ *   INPUTS: none
+ *   OUTPUTS: one line per lock
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void spin_dump_stats(){
+    spinlock_t* lock;
+    for(lock = lock_list; lock != NULL; lock = lock->next){
+        printf("%s: %u taken, %u contended, %u Kcycles waited\n", lock->name, lock->acquisitions, lock->contended,
+               (uint32_t)(lock->wait_cycles >> 10));
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include "types.h"
+#include "x86_desc.h"
+
+/* A lock spun on by the CPUs that want it. It only keeps other CPUs out: code that an interrupt on the same CPU
+ * could also run takes it with spin_lock_irqsave. Every lock counts how it is used, see spin_dump_stats. */
+typedef struct spinlock_t {
+    volatile uint32_t locked;                   // 1 while held
+    uint32_t owner;                             // CPU holding it, NO_CPU when it is free
+    const char* name;                           // shown by spin_dump_stats
+    uint32_t acquisitions;                      // times it was taken
+    uint32_t contended;                         // times it was held by another CPU when we wanted it
+    uint64_t wait_cycles;                       // TSC cycles spent spinning on it
+    uint32_t registered;                        // 1 once it is on the list spin_dump_stats walks
+    struct spinlock_t* next;
+} spinlock_t;
+
+/* Atomically stores val at addr and returns what was there (xchg with memory is always locked) */
+static inline uint32_t xchg(volatile uint32_t* addr, uint32_t val){
+    asm volatile("xchgl %0, %1" : "+r"(val), "+m"(*addr) : : "memory");
+    return val;
+}
+
+/* Initializer of a free lock */
+#define SPINLOCK_INIT(lock_name)    { 0, NO_CPU, lock_name, 0, 0, 0, 0, NULL }
+
+/* Makes lock a free lock named name, keeps its counters */
+void spin_lock_init(spinlock_t* lock, const char* name);
+
+/* Takes lock, spinning while another CPU holds it */
+void spin_lock(spinlock_t* lock);
+
+/* Releases lock */
+void spin_unlock(spinlock_t* lock);
+
+/* Turns interrupts off and takes lock, returns the flags to give back to spin_unlock_irqrestore */
+uint32_t spin_lock_irqsave(spinlock_t* lock);
+
+/* Releases lock and puts the interrupt flag back as spin_lock_irqsave found it */
+void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags);
+
+/* Returns 1 if the running CPU holds lock */
+static inline uint32_t spin_is_held(spinlock_t* lock){
+    return lock->locked && lock->owner == this_cpu_id();
+}
+
+/* Prints the counters of every lock taken so far */
+void spin_dump_stats();
+
+#endif /* _SPINLOCK_H */
@@ -0,0 +1,393 @@
+/* swap.c - Compressed in-memory swap (zram-style) for pages of idle processes */
+
+#include "swap.h"
+#include "syscall.h"
+#include "lib.h"
+
+#define LZ_MIN_MATCH    3                                   // shortest match worth encoding (token + 2 byte offset)
+#define LZ_MAX_MATCH    (0x7F + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 0x80
+#define LZ_HASH_SIZE    4096
+#define LZ_HASH(p)      ((((p)[0] << 4) ^ ((p)[1] << 2) ^ (p)[2] ^ ((p)[0] >> 4)) & (LZ_HASH_SIZE-1))
+#define CHUNKS_PER_PAGE (FRAME_SIZE/SWAP_CHUNK_SIZE)
+
+static swap_slot_t slots[SWAP_MAX_SLOTS];                   // Every compressed page, the slot number is kept in the PTE
+static uint32_t zpool_bitmap[ZPOOL_CHUNKS/32];              // One bit per chunk of the compressed store, 1 = in use
+static uint16_t lz_table[LZ_HASH_SIZE];                     // Last position (+1) where each 3 byte hash was seen
+static uint8_t swap_buf[SWAP_COMPRESS_BOUND];               // Compressor output before it is copied into the store
+static swap_stats_t stats;
+
+
+/*
+ * lz_literals()
+ *   DESCRIPTION: Emits src[start, end) as literal runs of at most LZ_MAX_LITERALS bytes, each one preceded by
+ *                a token holding its length - 1 (high bit clear).
+ *   INPUTS: src - page being compressed, start/end - literal range, dst/op - output and its current length
+ *   OUTPUTS: none
+ *   RETURN VALUE: new output length
+ *   SIDE EFFECTS: writes dst
+ */
+static uint32_t lz_literals(const uint8_t* src, uint32_t start, uint32_t end, uint8_t* dst, uint32_t op){
+    uint32_t n;
+    while(start < end){
+        n = (end - start > LZ_MAX_LITERALS) ? LZ_MAX_LITERALS : end - start;
+        dst[op++] = n - 1;
+        memcpy(dst + op, src + start, n);
+        op += n;
+        start += n;
+    }
+    return op;
+}
+
+
+/*
+ * swap_compress()
+ *   DESCRIPTION: Byte oriented LZ77 in the spirit of LZ4/LZF: one pass, a single hash table probe per position,
+ *                no entropy coding, so a page compresses in a few microseconds. A match is a token with the high
+ *                bit set holding length - 3, followed by a 16 bit little endian distance back into the page.
+ *   INPUTS: src - 4KB page
+ *           dst - output, at least SWAP_COMPRESS_BOUND bytes
+ *   OUTPUTS: none
+ *   RETURN VALUE: compressed length
+ *   SIDE EFFECTS: writes dst
+ */
+uint32_t swap_compress(const uint8_t* src, uint8_t* dst){
+    uint32_t ip = 0, op = 0, lit_start = 0, cand, len, h;
+    memset(lz_table, 0, sizeof(lz_table));
+    while(ip + LZ_MIN_MATCH <= FRAME_SIZE){
+        h = LZ_HASH(src + ip);
+        cand = lz_table[h];
+        lz_table[h] = ip + 1;
+        if(cand != 0 && src[cand-1] == src[ip] && src[cand] == src[ip+1] && src[cand+1] == src[ip+2]){
+            cand--;
+            len = LZ_MIN_MATCH;
+            while(ip + len < FRAME_SIZE && len < LZ_MAX_MATCH && src[cand+len] == src[ip+len]){
+                len++;
+            }
+            op = lz_literals(src, lit_start, ip, dst, op);
+            dst[op++] = 0x80 | (len - LZ_MIN_MATCH);
+            dst[op++] = (ip - cand) & 0xFF;
+            dst[op++] = (ip - cand) >> 8;
+            ip += len;
+            lit_start = ip;
+        }
+        else{
+            ip++;
+        }
+    }
+    return lz_literals(src, lit_start, FRAME_SIZE, dst, op);
+}
+
+
+/*
+ * swap_decompress()
+ *   DESCRIPTION: Inverse of swap_compress. Every token is bounds checked, so a corrupt slot fails instead of
+ *                writing past the page.
+ *   INPUTS: src - compressed data, len - its length, dst - 4KB page to fill
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes produced (FRAME_SIZE for a good slot), -1 on corrupt input
+ *   SIDE EFFECTS: writes dst
+ */
+int32_t swap_decompress(const uint8_t* src, uint32_t len, uint8_t* dst){
+    uint32_t ip = 0, op = 0, n, dist;
+    uint8_t token;
+    while(ip < len){
+        token = src[ip++];
+        if(token < 0x80){                                   // literal run
+            n = token + 1;
+            if(ip + n > len || op + n > FRAME_SIZE){
+                return -1;
+            }
+            memcpy(dst + op, src + ip, n);
+            ip += n;
+            op += n;
+        }
+        else{                                               // match, may overlap its own output
+            n = (token & 0x7F) + LZ_MIN_MATCH;
+            if(ip + 2 > len){
+                return -1;
+            }
+            dist = src[ip] | (src[ip+1] << 8);
+            ip += 2;
+            if(dist == 0 || dist > op || op + n > FRAME_SIZE){
+                return -1;
+            }
+            while(n-- > 0){
+                dst[op] = dst[op - dist];
+                op++;
+            }
+        }
+    }
+    return op;
+}
+
+
+/*
+ * zpool_page_empty()
+ *   DESCRIPTION: Checks whether every chunk of a compressed store page is free
+ *   INPUTS: page - page index inside the store
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the page holds no data
+ *   SIDE EFFECTS: none
+ */
+static int32_t zpool_page_empty(uint32_t page){
+    uint32_t i;
+    for(i = 0; i < CHUNKS_PER_PAGE/32; i++){
+        if(zpool_bitmap[page*(CHUNKS_PER_PAGE/32) + i] != 0){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/*
+ * zpool_free()
+ *   DESCRIPTION: Frees a run of chunks. Store pages left without data go back to the frame pool, so the store
+ *                only ever holds as much memory as the compressed pages need.
+ *   INPUTS: first - first chunk, count - number of chunks
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may free frames
+ */
+static void zpool_free(uint32_t first, uint32_t count){
+    uint32_t i, page;
+    for(i = first; i < first + count; i++){
+        zpool_bitmap[i/32] &= ~(1 << (i%32));
+    }
+    for(page = first/CHUNKS_PER_PAGE; page <= (first + count - 1)/CHUNKS_PER_PAGE; page++){
+        if(kmap_page_table[ZPOOL_FIRST_KMAP + page].present && zpool_page_empty(page)){
+            free_frame(kmap_page_table[ZPOOL_FIRST_KMAP + page].page_base_addr << 12);
+            kunmap(ZPOOL_FIRST_KMAP + page);
+        }
+    }
+}
+
+
+/*
+ * zpool_alloc()
+ *   DESCRIPTION: First fit allocation of count contiguous chunks. The store is contiguous in the kernel map
+ *                window, so a run may cross a page boundary; pages under the run are backed on demand.
+ *   INPUTS: count - number of chunks
+ *   OUTPUTS: none
+ *   RETURN VALUE: first chunk of the run, -1 if the store or the frame pool is full
+ *   SIDE EFFECTS: may allocate frames
+ */
+static int32_t zpool_alloc(uint32_t count){
+    uint32_t i, run = 0, first, page, frame;
+    for(i = 0; i < ZPOOL_CHUNKS; i++){
+        if(run == 0 && (i % 32) == 0 && zpool_bitmap[i/32] == 0xFFFFFFFF){
+            i += 31;                                        // whole word in use
+            continue;
+        }
+        if(zpool_bitmap[i/32] & (1 << (i%32))){
+            run = 0;
+            continue;
+        }
+        if(++run == count){
+            break;
+        }
+    }
+    if(run != count){
+        return -1;
+    }
+    first = i + 1 - count;
+    for(i = first; i < first + count; i++){
+        zpool_bitmap[i/32] |= (1 << (i%32));
+    }
+    for(page = first/CHUNKS_PER_PAGE; page <= (first + count - 1)/CHUNKS_PER_PAGE; page++){
+        if(!kmap_page_table[ZPOOL_FIRST_KMAP + page].present){
+            if((frame = allocate_frame()) == 0){
+                zpool_free(first, count);
+                return -1;
+            }
+            kmap(ZPOOL_FIRST_KMAP + page, frame);
+        }
+    }
+    return first;
+}
+
+
+/*
+ * swap_out()
+ *   DESCRIPTION: Compresses a resident user page into the store and unmaps it. The PTE keeps its permission
+ *                bits and is marked PTE_AVAIL_SWAP with the slot number in place of the frame, so the page fault
+ *                handler can bring it back. A page that does not compress is marked PTE_AVAIL_NOSWAP instead.
+ *   INPUTS: process - process owning the page (its page tables need not be installed)
+ *           pte     - entry mapping the page
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 if the page was swapped out, -1 otherwise
+ *   SIDE EFFECTS: frees the page's frame, the caller flushes the TLB
+ */
+int32_t swap_out(int process, page_table_entry* pte){
+    uint32_t frame = pte->page_base_addr << 12;
+    uint32_t slot, len = 0, i;
+    int32_t first = 0;
+    uint32_t* words = (uint32_t*)kmap(SWAP_KMAP_INDEX, frame);
+    for(slot = 0; slot < SWAP_MAX_SLOTS; slot++){
+        if(!slots[slot].in_use){
+            break;
+        }
+    }
+    if(slot == SWAP_MAX_SLOTS){
+        kunmap(SWAP_KMAP_INDEX);
+        return -1;
+    }
+    for(i = 0; i < FRAME_SIZE/4 && words[i] == 0; i++);
+    if(i < FRAME_SIZE/4){                                   // not a page of zeros, compress it
+        len = swap_compress((uint8_t*)words, swap_buf);
+        if(len > SWAP_MAX_COMPRESSED){
+            pte->avail |= PTE_AVAIL_NOSWAP;
+            pte->dirty = 0;                                 // retried once the page is written again
+            stats.incompressible++;
+            kunmap(SWAP_KMAP_INDEX);
+            return -1;
+        }
+        if((first = zpool_alloc((len + SWAP_CHUNK_SIZE - 1)/SWAP_CHUNK_SIZE)) == -1){
+            kunmap(SWAP_KMAP_INDEX);
+            return -1;
+        }
+        memcpy((void*)(KMAP_START + ZPOOL_FIRST_KMAP*FRAME_SIZE + first*SWAP_CHUNK_SIZE), swap_buf, len);
+    }
+    else{
+        stats.zero_pages++;
+    }
+    kunmap(SWAP_KMAP_INDEX);
+
+    slots[slot].first_chunk = first;
+    slots[slot].length = len;
+    slots[slot].in_use = 1;
+    pte->present = 0;
+    pte->avail = (pte->avail | PTE_AVAIL_SWAP) & ~PTE_AVAIL_NOSWAP;
+    pte->page_base_addr = slot;
+    free_frame(frame);
+    stats.pages_out++;
+    stats.stored_bytes += len;
+    return 0;
+}
+
+
+/*
+ * swap_in()
+ *   DESCRIPTION: Page fault resolver for swapped pages: decompresses the slot into a new frame (through the kernel
+ *                map window, the page may be read only) and maps it at page with the permissions the page had. A
+ *                copy-on-write page comes back writable: its frame was not shared, or the swap scan would have skipped it.
+ *   INPUTS: process - faulting process (its page tables are installed)
+ *           pte     - swapped entry
+ *           page    - page aligned faulting address
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if no frame is left or the slot is corrupt
+ *   SIDE EFFECTS: allocates a frame and frees the slot
+ */
+int32_t swap_in(int process, page_table_entry* pte, uint32_t page){
+    uint32_t slot = pte->page_base_addr;
+    uint32_t writable = pte->read_write || (pte->avail & PTE_AVAIL_COW);      // only one process ever mapped a swapped page, it is private now
+    uint32_t frame = allocate_frame();
+    uint8_t* buf;
+    int32_t ret = 0;
+    if(frame == 0){
+        return -1;
+    }
+    buf = (uint8_t*)kmap(SWAP_KMAP_INDEX, frame);
+    if(slots[slot].length == 0){
+        memset(buf, 0, FRAME_SIZE);
+    }
+    else if(swap_decompress((uint8_t*)(KMAP_START + ZPOOL_FIRST_KMAP*FRAME_SIZE + slots[slot].first_chunk*SWAP_CHUNK_SIZE),
+                            slots[slot].length, buf) != FRAME_SIZE){
+        ret = -1;
+    }
+    user_map_page(process, page, frame, writable);
+    swap_free(slot);
+    stats.pages_in++;
+    return ret;
+}
+
+
+/*
+ * swap_free()
+ *   DESCRIPTION: Drops a compressed page, e.g. when it is paged in or its process halts
+ *   INPUTS: slot - swap slot number
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees store chunks
+ */
+void swap_free(uint32_t slot){
+    if(slot >= SWAP_MAX_SLOTS || !slots[slot].in_use){
+        return;
+    }
+    if(slots[slot].length != 0){
+        zpool_free(slots[slot].first_chunk, (slots[slot].length + SWAP_CHUNK_SIZE - 1)/SWAP_CHUNK_SIZE);
+    }
+    stats.stored_bytes -= slots[slot].length;
+    slots[slot].in_use = 0;
+}
+
+
+/*
+ * swap_scan_table()
+ *   DESCRIPTION: Second chance (clock) pass over one user page table. A page touched since the last pass only
+ *                loses its accessed bit, a page left untouched for a whole pass is swapped out. Shared pages
+ *                (frame referenced more than once) are skipped.
+ *   INPUTS: process - process owning the table, table - page table, budget - pages that may still be swapped
+ *   OUTPUTS: none
+ *   RETURN VALUE: remaining budget
+ *   SIDE EFFECTS: may swap pages out
+ */
+static uint32_t swap_scan_table(int process, page_table_entry* table, uint32_t budget){
+    uint32_t i;
+    for(i = 0; i < ENTRIES_NUM && budget > 0; i++){
+        if(!table[i].present || frame_refcount(table[i].page_base_addr << 12) != 1){
+            continue;
+        }
+        if(table[i].accessed){
+            table[i].accessed = 0;
+            continue;
+        }
+        if((table[i].avail & PTE_AVAIL_NOSWAP) && !table[i].dirty){
+            continue;
+        }
+        if(swap_out(process, &table[i]) == 0){
+            budget--;
+        }
+    }
+    return budget;
+}
+
+
+/*
+ * swap_scan()
+ *   DESCRIPTION: Called every SWAP_SCAN_MS milliseconds. Processes blocked in terminal_read (idle shells, mostly
+ *                on background terminals) have their program and heap pages scanned, and cold ones are compressed,
+ *                at most SWAP_SCAN_BATCH per call to bound the time spent in the interrupt.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may swap pages out, flushes the TLB
+ */
+void swap_scan(){
+    uint32_t budget = SWAP_SCAN_BATCH;
+    int p;
+    pcb_t* proc;
+    for(p = 0; p < PCB_ARR_MAX_COUNT && budget > 0; p++){
+        proc = pcb_by_num(p);
+        if(!proc->in_use || !proc->in_terminal_read){
+            continue;
+        }
+        budget = swap_scan_table(p, program_page_table[p], budget);
+        budget = swap_scan_table(p, heap_page_table[p], budget);
+    }
+    tlb_flush();                                            // cleared accessed bits must be set again on the next access
+}
+
+
+/*
+ * swap_get_stats()
+ *   DESCRIPTION: Returns the swap counters
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the counters
+ *   SIDE EFFECTS: none
+ */
+swap_stats_t* swap_get_stats(){
+    return &stats;
+}
@@ -0,0 +1,56 @@
+#ifndef _SWAP_H
+#define _SWAP_H
+
+#include "types.h"
+#include "paging.h"
+
+/* Compressed swap: cold user pages are compressed into a pool of frames mapped in the kernel map window */
+#define SWAP_MAX_SLOTS       2048                               // compressed pages held at once
+#define SWAP_CHUNK_SIZE      64                                 // allocation unit of the compressed store
+#define SWAP_KMAP_INDEX      0                                  // kernel map page used to reach a page being swapped out
+#define ZPOOL_FIRST_KMAP     16                                 // kernel map page of the first compressed store page
+#define ZPOOL_PAGES          512                                // compressed store size in pages (2MB)
+#define ZPOOL_CHUNKS         (ZPOOL_PAGES*FRAME_SIZE/SWAP_CHUNK_SIZE)
+#define SWAP_MAX_COMPRESSED  3072                               // pages that do not shrink below this stay resident
+#define SWAP_COMPRESS_BOUND  (FRAME_SIZE + FRAME_SIZE/128 + 1)  // worst case compressor output
+#define SWAP_SCAN_BATCH      16                                 // pages compressed per scan at most
+#define SWAP_SCAN_MS         2000                               // time between scans
+
+/* One compressed page */
+typedef struct swap_slot_t {
+    uint32_t first_chunk;                       // first chunk of the compressed data in the store
+    uint32_t length;                            // compressed size in bytes, 0 for a page of zeros
+    uint32_t in_use;
+} swap_slot_t;
+
+/* Swap counters */
+typedef struct swap_stats_t {
+    uint32_t pages_out;                         // pages compressed and unmapped
+    uint32_t pages_in;                          // pages brought back by the page fault handler
+    uint32_t zero_pages;                        // pages out that were all zeros and took no space
+    uint32_t incompressible;                    // pages that were left resident because they did not compress
+    uint32_t stored_bytes;                      // compressed bytes currently held
+} swap_stats_t;
+
+/* Compresses the 4KB page at src into dst, returns the compressed length */
+uint32_t swap_compress(const uint8_t* src, uint8_t* dst);
+
+/* Decompresses len bytes from src into the 4KB page at dst, returns the number of bytes produced or -1 */
+int32_t swap_decompress(const uint8_t* src, uint32_t len, uint8_t* dst);
+
+/* Compresses the page mapped by pte of a process and unmaps it */
+int32_t swap_out(int process, page_table_entry* pte);
+
+/* Brings the swapped page described by pte back at page (current process) */
+int32_t swap_in(int process, page_table_entry* pte, uint32_t page);
+
+/* Drops a compressed page */
+void swap_free(uint32_t slot);
+
+/* Swaps out cold pages of processes blocked in terminal_read */
+void swap_scan();
+
+/* Returns the swap counters */
+swap_stats_t* swap_get_stats();
+
+#endif
@@ -6,13 +6,25 @@
 #include "x86_desc.h"
 #include "rtc.h"
 #include "lib.h"
+#include "shm.h"
+#include "page_fault.h"
+#include "schedule.h"
+#include "pit.h"
+#include "fpu.h"
+#include "smp.h"
+#include "elf.h"
+#include "timer.h"
+#include "clock.h"
  
 /* HELPER GLOBAL VARIABLES */
 static int pcb_array[PCB_ARR_MAX_COUNT]={0};                    // Flag array which ensures only 2 processes are running at once 
-static pcb_t* pcb = NULL;                                       // Pointer to the pcb of the current executing process 
-static pcb_t* pcb_copy=NULL;
+static pcb_t pcb_table[PCB_ARR_MAX_COUNT];                      // PCBs live here, away from the kernel stacks they describe 
+static pcb_t* cpu_pcb[MAX_CPUS];                                // Pointer to the pcb of the process each CPU is executing 
+#define pcb this_cpu_var(cpu_pcb)
 static int num_times_ex_called = 0;                                 // Number of times execute function is entered
-static uint8_t arg_buf[128]={'\0'};
+static spinlock_t pcb_table_lock = SPINLOCK_INIT("pcb table");      // Guards pcb_array and num_times_ex_called
+
+#define EXEC_FRAME_WORDS 11                                         // switch_stack frame (eflags, edi, esi, ebx, ebp, return address) + iret frame
 
 /* 
  *   pcb_ptr()
@@ -26,6 +38,18 @@ pcb_t* pcb_ptr(){
 }
 
 
+/* 
+ *   pcb_by_num(int process)
+ *   DESCRIPTION: Returns a pointer to the pcb of process slot process    
+ *   INPUTS: process - process number (index into pcb_array)
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: Pointer to the pcb of that slot 
+ */
+pcb_t* pcb_by_num(int process){
+    return &pcb_table[process]; 
+}
+
+
 /* 
  *   change_global_pcb(pcb_t* addr)
  *   DESCRIPTION: Set the global pcb pointer to point to addr    
@@ -38,6 +62,64 @@ void change_global_pcb(pcb_t* addr){
 }
 
 
+/* 
+ *   fd_alloc(uint32_t inode_num)
+ *   DESCRIPTION: Takes the first free descriptor (2 to 7) of the current process for an open call and starts it at
+ *                the beginning of the file. The caller sets its operation table.    
+ *   INPUTS: inode_num - inode of the file (0 for the RTC and directories)
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: the descriptor, -1 if all of them are in use
+ */
+int32_t fd_alloc(uint32_t inode_num){
+    int32_t i;
+    uint32_t flags = spin_lock_irqsave(&pcb->fd_lock);
+    for(i=2; i<8; i++){                                                     // 2 as stdin and stdout are the first 2, 8 as the array length is 8
+        if(pcb->fds[i].flags==0){
+            pcb->fds[i].inode_num = inode_num;
+            pcb->fds[i].file_pos = 0;
+            pcb->fds[i].flags = 1;                                          // Mark the descriptor as in use
+            spin_unlock_irqrestore(&pcb->fd_lock, flags);
+            return i;
+        }
+    }
+    spin_unlock_irqrestore(&pcb->fd_lock, flags);
+    return -1;
+}
+
+
+/* 
+ *   fd_free(int32_t fd)
+ *   DESCRIPTION: Gives descriptor fd of the current process back, for the close calls    
+ *   INPUTS: fd - descriptor to close
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: 0 on success, -1 if fd was not open
+ */
+int32_t fd_free(int32_t fd){
+    int32_t retval = -1;
+    uint32_t flags = spin_lock_irqsave(&pcb->fd_lock);
+    if(pcb->fds[fd].flags != 0){
+        pcb->fds[fd].flags = 0;
+        retval = 0;
+    }
+    spin_unlock_irqrestore(&pcb->fd_lock, flags);
+    return retval;
+}
+
+
+/* 
+ *   syscall_count()
+ *   DESCRIPTION: Counts a system call of the current process, called by syscall_handler before the call runs    
+ *   INPUTS: N/A
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: none
+ */
+void syscall_count(){
+    if(pcb != NULL){
+        pcb->syscalls++;
+    }
+}
+
+
 /* 
  *   dummy()
  *   DESCRIPTION: Does nothing: acts as a space filler such that the jump table in syscall_handler.S workers properly.    
@@ -50,6 +132,36 @@ int32_t dummy (){
 }
 
 
+/* 
+ *   release_children(pcb_t* parent)
+ *   DESCRIPTION: Called when parent halts: its halted spawned children are reaped and the running ones orphaned, 
+ *                so they free their own slot when they halt.    
+ *   INPUTS: parent - process halting
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: none
+ */
+static void release_children(pcb_t* parent){
+    int32_t i;
+    pcb_t* child;
+    spin_lock(&pcb_table_lock);
+    for(i = NUM_TERMINALS; i < PCB_ARR_MAX_COUNT; i++){
+        child = pcb_by_num(i);
+        if(pcb_array[i] == 0 || !child->spawned || child->parent_id != parent->process_num){
+            continue;
+        }
+        if(child->zombie){
+            child->zombie = 0;
+            pcb_array[i] = 0;
+            num_times_ex_called = num_times_ex_called - 1;
+        }
+        else{
+            child->parent_id = -1;
+        }
+    }
+    spin_unlock(&pcb_table_lock);
+}
+
+
 /* 
  *   system_halt (uint8_t status)
  *   DESCRIPTION: Once an executable has reached the end of its execution (or once "return" is reached), system_halt() is called. 
@@ -64,93 +176,160 @@ int32_t dummy (){
 int32_t system_halt (uint8_t status){
     
     int parent_id_temp, i;
-    cli();                                                                  // Disable Interrupts 
+    uint32_t flags;
+    cli_and_save(flags);                                                    // No switching away on this CPU while we tear down the address space we run in 
 
-    deallocate_page(34);                                                    // Set vidmap page's which is at index 34 present bit to 0
+    deallocate_page(VIDMAP_PDE_INDEX);                                      // Set vidmap page's which is at index 34 present bit to 0
+    pcb->vidmap = 0;
+    user_release(pcb->process_num, USER_START, USER_STACK_TOP);             // Give every image, stack and heap frame of this process back to the frame pool
+    user_release(pcb->process_num, HEAP_START, HEAP_END);
+    shm_detach_all();                                                       // Drop this process' shared memory attachments
+    fpu_release(pcb);                                                       // and its FPU state
     
     if(pcb->process_num < 0 || pcb->process_num > PCB_ARR_MAX_COUNT){       // If the process ID is invalid, DO NOT HALT 
         printf("halting not existing process\n");
-        sti();
+        restore_flags(flags);
         return -1;                                                          // Return -1 for failure
     }
 
+    release_children(pcb);                                                  // Spawned children outlive us, nobody will wait for them
+
+    if(pcb->spawned){                                                       // A spawned process gives up its own turn and waits for its parent to collect it
+        for(i = 2 ; i < 8 ; i++){
+            system_close(i);
+        }
+        pcb->in_use = 0;
+        pcb->halt_status = status;
+        sched_dequeue(pcb);
+        pcb_t* parent = NULL;
+        spin_lock(&pcb_table_lock);
+        if(pcb->parent_id == -1){                                           // Orphaned: nobody collects it, free the slot now
+            pcb_array[pcb->process_num] = 0;
+            num_times_ex_called = num_times_ex_called - 1;
+        }
+        else{
+            pcb->zombie = 1;
+            parent = pcb_by_num(pcb->parent_id);
+        }
+        spin_unlock(&pcb_table_lock);
+        if(parent != NULL){
+            sched_wake_up(&parent->child_waiters);
+        }
+        schedule();                                                         // Never picked again: we leave this kernel stack for good (the kernel lock keeps its next owner out until the switch)
+        return 0;
+    }
+
     parent_id_temp = pcb->parent_id;           
 
     if(parent_id_temp == -1){                                               // If the process we want to halt does not have a parent:
+        spin_lock(&pcb_table_lock);
         pcb_array[pcb->process_num] = 0;                                    //      - Set process array flag low 
-        pcb_copy=NULL; 
         num_times_ex_called = num_times_ex_called - 1;                      
+        spin_unlock(&pcb_table_lock);
+        pcb->in_use = 0;
+        pcb->halt_status = status;
         for(i = 2 ; i < 8 ; i++){                                           //      - Clear pcb FD array
             system_close (i);
         }
-        sti();
-        tss.ss0 = KERNEL_DS;                                                //      - Set segment selector to KERNEL_DS and the future ESP to 8MB
-        tss.esp0 = 0x800000-(0x2000 * (pcb->process_num));                  //      - Set esp0 to point to the next available stack (8MB - 8KB*process-num)
-        restore_reg(pcb);                                                   //      - Now, restore the process we just halted
+        this_cpu()->tss->ss0 = KERNEL_DS;                                   //      - Set segment selector to KERNEL_DS and the future ESP to 8MB
+        this_cpu()->tss->esp0 = pcb->kernel_stack_top;                      //      - Set esp0 to the top of this process' kernel stack 
+        fpu_switch(pcb);
+        switch_stack(&pcb->kernel_esp, pcb->exec_esp);                      //      - Now, go back to the execute that started the process we just halted
         return 0;
     }
 
+    spin_lock(&pcb_table_lock);
     num_times_ex_called = num_times_ex_called - 1;                          
-
     pcb_array[pcb->process_num] = 0;                                        // Set the process flag low 
+    spin_unlock(&pcb_table_lock);
+    pcb->in_use = 0;
 
     for(i = 2 ; i < 8 ; i++){                                               // Clear pcb FD array
         system_close(i);
     }
 
-    sti(); 
     int curr_terminal = pcb->terminal;
+    pcb_t* child = pcb;
 
-    pcb_t* parent = (pcb_t*) (0x800000 - (0x2000 * (parent_id_temp+1)));    // Gain access to the parent pcb 
-    load_4MB_syscall_page(parent_id_temp);                                  // Associated parent physical memory with virtual memory page 
-    pcb_copy=pcb;
-    pcb_copy->halt_status=status;                                           // Store the exit status of the current process in its pcb 
-    pcb=parent;                                                             // Set the parent process as the current process 
+    pcb_t* parent = pcb_by_num(parent_id_temp);                             // Gain access to the parent pcb 
+    child->halt_status=status;                                              // Store the exit status of the current process in its pcb 
+    sched_replace(child, parent);                                           // The terminal's turn in the run queue goes back to the parent 
+    sched_load(parent);                                                     // Set the parent process as the current process: global pcb, TSS esp0, program page, screen 
 
     terminal_t* current_terminal = terminal_data(curr_terminal);            // Update the last run pcb for the terminal that we are currently in
-    current_terminal->last_run_pcb=pcb;
+    current_terminal->last_run_pcb=parent;
+    fpu_switch(parent);                                                     // The parent's FPU state may have been saved away while the child ran
 
-    tss.ss0 = KERNEL_DS;                                                    // Redefine TSS parameters to tear down the old current process's stack 
-    tss.esp0 = 0x800000 - (0x2000 * (parent_id_temp+1));
-    restore_reg(pcb_copy);                                                  // Restore registers so we can return to after the context switch in execute 
+    switch_stack(&child->kernel_esp, child->exec_esp);                      // Back onto the parent's kernel stack, into execute right after it started the child (interrupts come back on there)
                                                         
     return 0;
 }
 
 
 /* 
- *   system_execute (const uint8_t* command)
- *   DESCRIPTION: This function takes in an executable name and sets up its execution. First, it checks to see if the executable is valid. If so, 
+ *   pcb_slot_alloc (pcb_t* parent)
+ *   DESCRIPTION: Takes a process slot for a process started by parent. A terminal thread starting its base shell gets 
+ *                the terminal's own slot (0, 1 or 2), anything else the lowest free slot after those.    
+ *   INPUTS: parent - process starting it, NULL before any process runs
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: the slot, -1 if every slot is taken
+ */
+int32_t pcb_slot_alloc(pcb_t* parent){
+    int32_t i, process = -1;
+    uint32_t flags = spin_lock_irqsave(&pcb_table_lock);
+    if(parent != NULL && parent->parent_id == -1 && pcb_array[parent->process_num] == 0){
+        process = parent->process_num;                                      // A terminal thread starting its base shell: the shell takes the terminal's slot (0, 1 or 2)
+    }
+    else{                                                                   // Otherwise a free PID, base shell slots are reserved for their terminals
+        for(i = (parent != NULL) ? NUM_TERMINALS : 0; i < PCB_ARR_MAX_COUNT; i++){
+            if(pcb_array[i]==0){
+                process=i; 
+                break;
+            }
+        }
+    }
+    if(process != -1){
+        pcb_array[process]=1; 
+        num_times_ex_called = num_times_ex_called+1;                        // Increment our global execute counter 
+    }
+    spin_unlock_irqrestore(&pcb_table_lock, flags);
+    return process;
+}
+
+
+/* 
+ *   process_start (const uint8_t* command, uint32_t spawn)
+ *   DESCRIPTION: Starts an executable, for system_execute and system_spawn. First, it checks to see if the executable is valid. If so, 
  *                we check to see if the maximum supported PCBs (2) has been reached. If not, this executable is assigned a process IF (either 0
- *                or 1). From here, the exact position of the kernel stack for this executable is determined, and it's PCB is initialized. Then, 
- *                this executable is mapped from its physical address to a virtual page with the use of the read_data and load_4MB_syscall_page 
- *                functions. TSS parameters are then edited to reflect the correct future values for SS0 and ESP0, and a contest swtich is performed
- *                to take us to the virtual page and start execution of the executable.    
+ *                or 1). From here, the process slot's kernel stack is taken from the stack pool (first use only), and it's PCB is initialized. Then, 
+ *                this executable's address space is described (image backed by the file, stack, heap) and its page tables are installed with 
+ *                load_4MB_syscall_page; pages are filled in by the page fault handler on first touch. TSS parameters are then edited to reflect the correct future values for SS0 and ESP0, and a contest swtich is performed
+ *                to take us to the virtual page and start execution of the executable. A spawned child instead gets its own 
+ *                turn in the run queue: its page tables are loaded when the scheduler first picks it and we return at once.    
  *   INPUTS: command - Name of the executable to be executed. 
+ *           spawn   - 0 to run it in the parent's place until it halts, 1 to run it next to the parent
  *   OUTPUTS: If valid, an executable is run. 
- *   RETURN VALUE: -1 if failed to execute, 0 if successful   
+ *   RETURN VALUE: -1 if failed to execute, otherwise the halt status of the child (execute) or its process number (spawn)
  */
-int32_t system_execute (const uint8_t* command){
+static int32_t process_start (const uint8_t* command, uint32_t spawn){
 
     uint32_t parent_id_temp = -1;                                           // Initializing helper variables/buffers for future use 
     int i = 0;
-    int nbytes = 5;
-    uint8_t file_data_buf[5];
-    uint8_t elf_buf[3];
-    cli();                                                                  // Disable interrupts 
-    num_times_ex_called = num_times_ex_called+1;                            // Increment our global execute counter 
+    uint32_t flags;
+    elf_image_t image;
 
     /* Obtain the first argument and second argument in command */
     dentry_t dentry;  
     int idx=0;
     int arg_idx=0;
     uint8_t cmd_buf[10]={'\0'};
+    uint8_t arg_buf[128]={'\0'};                                           // Copied into the new pcb once we have one, see system_getargs
     while(command[idx]!=' ' && command[idx]!='\0'){                         // Obtain the first argument in command and store this in cmd_buf 
         cmd_buf[idx]=command[idx];
         idx++;
     }
-    while(command[idx]!='\0'){                                              // Obtain the second argument in command and store this in arg_buf
-        if(command[idx]!=' '){                                              // arg_buf is static, and is accessible from system_getargs 
+    while(command[idx]!='\0' && arg_idx<127){                              // Obtain the second argument in command and store this in arg_buf
+        if(command[idx]!=' '){                                              
             arg_buf[arg_idx]=command[idx];
             arg_idx++;
         }
@@ -161,94 +340,307 @@ int32_t system_execute (const uint8_t* command){
     if(read_dentry_by_name (cmd_buf, &dentry)==-1){                         // Check if the command exists
         return -1; 
     }
-    if(read_data(dentry.inode_num, 0, file_data_buf, nbytes) != nbytes){    // Check if file can be read properly 
-        return -1;
-    }
-    for(i = 0 ; i < 3 ; i++){                                               // Obtain the first 3 bytes of the file and store in elf_buf
-        elf_buf[i] = file_data_buf[1+i];
-    }
-    if(strncmp((const int8_t*)elf_buf, (const int8_t*)"ELF", (uint32_t)3) == 0){  // Check if first 3 bytes = "ELF" (if so -> is executable)
-    } else{
+    inode_t* inode = get_inode_info(dentry.inode_num);                      // Aquire the inode info of the executable (number, length of file, etc.)
+    if(elf_lookup(dentry.inode_num, inode->length_bytes, &image) == -1){     // Check it is an ELF executable we can load, and find its segments (cached after the first launch)
         return -1;
     }
-    int process = NULL;                                                     // Check if we have reached the maximum supported PCB's 
-    if(pcb_array[0]==0){                                                    // If we have NOT, assign the executable a PID (0, 1, 2, or 3)
-        pcb_array[0]=1; 
-        process=0; 
-    }
-    else if(pcb_array[1]==0){
-        pcb_array[1]=1; 
-        process=1; 
-    }
-    else if(pcb_array[2]==0){                                                    
-        pcb_array[2]=1; 
-        process=2; 
-    }
-    else if(pcb_array[3]==0){
-        pcb_array[3]=1; 
-        process=3; 
-    }
-    else if(pcb_array[4]==0){
-        pcb_array[4]=1; 
-        process=4; 
-    }
-    else if(pcb_array[5]==0){
-        pcb_array[5]=1; 
-        process=5; 
-    }
-    else{
+    pcb_t* parent = pcb;
+    int process = pcb_slot_alloc(parent);                                   // Check if we have reached the maximum supported PCB's 
+    if(process == -1){
         printf("Reached Max Amount of PCBs\n");
         return -1;                                                          // If we have reached the maximum supported PCBs, return -1
     }
    
     /* Initlialize PCB and Kernel Stack for Valid Executable */
-    if(!(process==0 || process==1 || process==2)){                          // If this executable is not one of the 3 base shells, save it's parent's PID
-        parent_id_temp = pcb->process_num; 
+    if(parent != NULL && process != parent->process_num){                   // If this executable is not a base shell, save it's parent's PID
+        parent_id_temp = parent->process_num; 
     }
        
-    pcb = (pcb_t*)(0x800000 - (0x2000 * num_times_ex_called));              // Initialize PCB pointer (8MB - 8KB*number of times execute called)
-    pcb->addr=0x800000 - (0x2000 * num_times_ex_called); 
-    pcb->process_num = process;   
-    pcb->parent_id = parent_id_temp;                                        // Save the current PID, parent's PID 
-    int temp = get_seen_terminal_num(); 
-    pcb->terminal = temp;   
-
-    /* update the last run pcb for the terminal that we are currently in */
-    terminal_t* curr_terminal = terminal_data(get_seen_terminal_num());
-    curr_terminal->last_run_pcb=pcb; 
-
-    pcb->fds[0].flags=1;                                                    // Initlize stdin and stdout in the pcb's FD array 
-    pcb->fds[1].flags=1;
-    pcb->fds[0].operation_ptr = fun_ptr_arr_terminal;
-    pcb->fds[1].operation_ptr = fun_ptr_arr_terminal;
+    if(pcb_table[process].kernel_stack_top == 0){                           // First use of this slot: take a guarded kernel stack from the pool 
+        pcb_table[process].kernel_stack_top = kernel_stack_alloc(KERNEL_STACK_PAGES);
+        if(pcb_table[process].kernel_stack_top == 0){
+            flags = spin_lock_irqsave(&pcb_table_lock);
+            pcb_array[process] = 0;
+            num_times_ex_called = num_times_ex_called-1;
+            spin_unlock_irqrestore(&pcb_table_lock, flags);
+            printf("Out of Kernel Stacks\n");
+            return -1;
+        }
+    }
+    cli_and_save(flags);                                                    // From here until the child runs this CPU must not switch: pcb and the run queue name the child while we are on the parent's stack 
+    pcb_t* child = pcb_by_num(process);                                     // PCB table entry for this process slot
+    child->process_num = process;   
+    child->in_use = 1;
+    child->in_terminal_read = 0;
+    child->parent_id = parent_id_temp;                                      // Save the current PID, parent's PID 
+    child->terminal = (parent != NULL) ? parent->terminal : get_seen_terminal_num();   // Children run on their parent's terminal 
+    child->vidmap = 0;
+    child->fpu_state = NULL;                                                // No FPU save area until the first FPU instruction
+    child->sched_nice = (parent != NULL) ? parent->sched_nice : 0;          // Children inherit their parent's nice value 
+    child->spawned = spawn;
+    child->zombie = 0;
+    child->child_waiters.head = NULL;                                       // Nobody waits for its spawned children yet 
+    child->child_waiters.tail = NULL;
+    memcpy(child->name, cmd_buf, sizeof(cmd_buf));                          // Name shown by system_getstats, ended here if it fills cmd_buf
+    child->name[sizeof(cmd_buf)] = '\0';
+    child->user_cycles = 0;                                                 // Fresh CPU accounting, see system_getstats 
+    child->kernel_cycles = 0;
+    child->syscalls = 0;
+    child->vol_switches = 0;
+    child->invol_switches = 0;
+    memcpy(child->args, arg_buf, sizeof(arg_buf));
+    if(!spawn){
+        pcb = child;                                                        // Initialize PCB pointer 
+        if(parent != NULL){
+            sched_replace(parent, child);                                   // The child takes its parent's turn in the run queue until it halts 
+        }
+        /* update the last run pcb for the terminal that we are currently in */
+        terminal_t* curr_terminal = terminal_data(child->terminal);
+        curr_terminal->last_run_pcb=child; 
+    }
+
+    spin_lock_init(&child->fd_lock, "fd table");
+    child->fds[0].flags=1;                                                  // Initlize stdin and stdout in the pcb's FD array 
+    child->fds[1].flags=1;
+    child->fds[0].operation_ptr = fun_ptr_arr_terminal;
+    child->fds[1].operation_ptr = fun_ptr_arr_terminal;
     for(i=2; i<8; i++){         
-        pcb->fds[i].flags=0;                                                // Initialize the rest of the flags in the FD array to 0 (unused)
+        child->fds[i].flags=0;                                              // Initialize the rest of the flags in the FD array to 0 (unused)
     }
-    asm("movl %%ebp, %0;" : "=r" (pcb->ebp):);                              // Save current EBP 
+    for(i=0; i<MAX_VMAS; i++){                                              // Describe the address space, nothing is backed until it is touched
+        vma_set(child, i, VMA_NONE, 0, 0, 0);
+    }
+    vma_set(child, VMA_HEAP_SLOT, VMA_ANON, HEAP_START, HEAP_START, 1);       // Empty heap, brk moves its end
+    vma_set(child, VMA_STACK_SLOT, VMA_STACK, USER_STACK_TOP - USER_STACK_MAX, USER_STACK_TOP, 1);
+    for(i=0; i<PF_NUM_KINDS; i++){
+        child->fault_count[i] = 0;
+        child->fault_cycles[i] = 0;
+    }
+    program_page_table_init(process);
+    heap_page_table_init(process);
+    child->shm_attached = 0;                                                // No shared memory segments mapped yet
+    shm_page_table_init(process);
 
     /* Map Executable to Virtual Memory Page */ 
-    load_4MB_syscall_page(process);                                         // Call load_4MB_syscall_page to map physical address of executable to virtual page address
-    inode_t* inode = get_inode_info(dentry.inode_num);                      // Aquire the inode info of the executable (number, length of file, etc.)
-    uint32_t length = inode->length_bytes;
-    pcb->length = length;
-    pcb->inode_num = dentry.inode_num;
-    uint8_t* page_addr = (uint8_t*)(0x08048000);                            // Save the virtual memory page address in page_addr (the program image is mapped to addr: 0x08048000)
-    uint8_t filebuf[40];                                                    // Create filebuf to store the EIP later 
-    read_data (dentry.inode_num, 0, filebuf, 40);                           // Store the executable into the virtual memory page/into filebuf
-    read_data (dentry.inode_num, 0, page_addr, inode->length_bytes);
+    if(!spawn){                                                             // A spawned child's tables are loaded when it is first scheduled 
+        deallocate_page(VIDMAP_PDE_INDEX);                                  // The parent's vidmap page is not the child's 
+        load_4MB_syscall_page(process);                                     // Call load_4MB_syscall_page to map physical address of executable to virtual page address
+    }
+    child->length = inode->length_bytes;
+    child->inode_num = dentry.inode_num;
+    elf_map(child, &image);                                                 // The PT_LOAD segments are paged in from the file on first touch, .bss reads as zero 
 
     /* Perform Context Switch to Start Execution of Executable */
-    uint32_t eflags=0;
-    uint32_t eip= (filebuf[27]<<24)+(filebuf[26]<<16)+(filebuf[25]<<8)+filebuf[24];     // Aquire bytes 24-27 from the executable to obtain new EIP
-    tss.ss0 = KERNEL_DS;
-    tss.esp0 = 0x800000 - (0x2000 * num_times_ex_called);                               // Set esp0 to the base of the NEXT kernel stack to be used the next time execute is called 
-    sti();
-    context_switch (pcb, eip, USER_CS, eflags, 0x8400000, USER_DS);                     // Perform context switch 
-
-    if(pcb_copy == NULL){                                                   
+    uint32_t eip = image.entry;                                                         // Start at the ELF entry point
+    uint32_t* frame = (uint32_t*)child->kernel_stack_top - EXEC_FRAME_WORDS;            // Start the child's kernel stack with a switch_stack frame that returns into enter_user
+    frame[0] = 0x2;                                                                     //      - eflags, edi, esi, ebx, ebp popped by switch_stack
+    frame[1] = 0;
+    frame[2] = 0;
+    frame[3] = 0;
+    frame[4] = 0;
+    frame[5] = (uint32_t)enter_user;                                                    //      - where switch_stack returns
+    frame[6] = eip;                                                                     //      - iret frame of enter_user: user EIP, CS, EFLAGS (IF on), ESP, SS
+    frame[7] = USER_CS;
+    frame[8] = 0x202;
+    frame[9] = USER_STACK_TOP;
+    frame[10] = USER_DS;
+    if(spawn){
+        child->kernel_esp = (uint32_t)frame;                                            // The scheduler's switch_to enters the frame when the child first runs
+        sched_start(child, parent->sched_cpu);                                          // It gets its own turn, next to the parent's
+        restore_flags(flags);
+        return process;
+    }
+    this_cpu()->tss->ss0 = KERNEL_DS;
+    this_cpu()->tss->esp0 = child->kernel_stack_top;                                    // Set esp0 to the top of the new process' kernel stack 
+    fpu_switch(child);                                                                  // The child's first FPU instruction traps and gets it a clean state
+    switch_stack(&child->exec_esp, (uint32_t)frame);                                    // Perform context switch, we are back here once the child halts (pcb is the parent again)
+
+    restore_flags(flags);
+    return child->halt_status;
+}
+
+
+/* 
+ *   system_execute (const uint8_t* command)
+ *   DESCRIPTION: Runs an executable in place of the calling process and waits for it to halt, see process_start.    
+ *   INPUTS: command - Name of the executable to be executed, followed by its arguments
+ *   OUTPUTS: If valid, an executable is run. 
+ *   RETURN VALUE: -1 if failed to execute, otherwise the status the child halted with   
+ */
+int32_t system_execute (const uint8_t* command){
+    return process_start(command, 0);
+}
+
+
+/* 
+ *   system_spawn (const uint8_t* command)
+ *   DESCRIPTION: Starts an executable as a child that runs next to the calling process (a background job) and returns 
+ *                right away. The child is a zombie from its halt until the parent collects it with system_waitpid.    
+ *   INPUTS: command - Name of the executable to be executed, followed by its arguments
+ *   OUTPUTS: If valid, an executable is started. 
+ *   RETURN VALUE: -1 if failed to start, otherwise the child's process number   
+ */
+int32_t system_spawn (const uint8_t* command){
+    if(pcb == NULL){
         return -1;
     }
-    return pcb_copy->halt_status;
+    return process_start(command, 1);
+}
+
+
+/* 
+ *   wait_child (int32_t pid, int32_t* status, int32_t options, uint32_t ticks)
+ *   DESCRIPTION: Collects a spawned child of the calling process once it has halted: its slot is freed and its halt 
+ *                status handed out. Without WNOHANG the caller sleeps until such a child halts, or until ticks PIT 
+ *                ticks went by.    
+ *   INPUTS: pid     - process number of the child, -1 for any spawned child
+ *           status  - where to store the child's halt status, NULL if not wanted
+ *           options - WNOHANG to return 0 instead of sleeping
+ *           ticks   - longest wait in PIT ticks, 0 to wait as long as it takes
+ *   OUTPUTS: *status
+ *   RETURN VALUE: process number of the child collected, 0 if WNOHANG or the time ran out and no child has halted 
+ *                 yet, -1 if there is no such spawned child or status is not a writable user address   
+ */
+static int32_t wait_child (int32_t pid, int32_t* status, int32_t options, uint32_t ticks){
+    int32_t i, found, halt_status = 0;
+    pcb_t* child;
+    uint32_t flags;
+    uint32_t deadline = (uint32_t)get_counter() + ticks;
+
+    if(status != NULL && !user_writable(pcb, (uint32_t)status, sizeof(int32_t))){
+        return -1;
+    }
+    flags = spin_lock_irqsave(&pcb_table_lock);
+    while(1){
+        found = -1;
+        for(i = NUM_TERMINALS; i < PCB_ARR_MAX_COUNT; i++){             // Base shells are never spawned
+            child = pcb_by_num(i);
+            if(pcb_array[i] == 0 || !child->spawned || child->parent_id != pcb->process_num || (pid != -1 && pid != i)){
+                continue;
+            }
+            found = i;
+            if(child->zombie){                                          // Reap it: the slot can be used again
+                child->zombie = 0;
+                halt_status = child->halt_status;
+                pcb_array[i] = 0;
+                num_times_ex_called = num_times_ex_called - 1;
+                spin_unlock_irqrestore(&pcb_table_lock, flags);
+                if(status != NULL){
+                    *status = halt_status;
+                }
+                return i;
+            }
+        }
+        if(found == -1){
+            spin_unlock_irqrestore(&pcb_table_lock, flags);
+            return -1;
+        }
+        if(options & WNOHANG){
+            spin_unlock_irqrestore(&pcb_table_lock, flags);
+            return 0;
+        }
+        if(ticks == 0){
+            sched_sleep_on_lock(&pcb->child_waiters, &pcb_table_lock);  // A halting child wakes us under the same lock
+        }
+        else if((int32_t)(deadline - (uint32_t)get_counter()) <= 0){
+            spin_unlock_irqrestore(&pcb_table_lock, flags);
+            return 0;
+        }
+        else{
+            sched_sleep_on_lock_timeout(&pcb->child_waiters, &pcb_table_lock, deadline - (uint32_t)get_counter());
+        }
+    }
+}
+
+
+/* 
+ *   system_waitpid (int32_t pid, int32_t* status, int32_t options)
+ *   DESCRIPTION: Collects a spawned child of the calling process once it has halted, see wait_child. Without WNOHANG 
+ *                the caller sleeps until such a child halts.    
+ *   INPUTS: pid     - process number of the child, -1 for any spawned child
+ *           status  - where to store the child's halt status, NULL if not wanted
+ *           options - WNOHANG to return 0 instead of sleeping
+ *   OUTPUTS: *status
+ *   RETURN VALUE: process number of the child collected, 0 if WNOHANG and no child has halted yet, -1 if there is 
+ *                 no such spawned child or status is not a writable user address   
+ */
+int32_t system_waitpid (int32_t pid, int32_t* status, int32_t options){
+    return wait_child(pid, status, options, 0);
+}
+
+
+/* 
+ *   system_timedwait (int32_t pid, int32_t* status, int32_t timeout_ms)
+ *   DESCRIPTION: system_waitpid that gives up after timeout_ms milliseconds, so a shell can poll its background jobs 
+ *                without spinning. The wait is a timer of the timer wheel, not a loop over the clock.    
+ *   INPUTS: pid        - process number of the child, -1 for any spawned child
+ *           status     - where to store the child's halt status, NULL if not wanted
+ *           timeout_ms - longest wait in milliseconds, 0 to only check (as WNOHANG)
+ *   OUTPUTS: *status
+ *   RETURN VALUE: process number of the child collected, 0 if the time ran out first, -1 if there is no such 
+ *                 spawned child or an argument is bad   
+ */
+int32_t system_timedwait (int32_t pid, int32_t* status, int32_t timeout_ms){
+    if(timeout_ms < 0){
+        return -1;
+    }
+    if(timeout_ms == 0){
+        return wait_child(pid, status, WNOHANG, 0);
+    }
+    return wait_child(pid, status, 0, timer_ticks((uint32_t)timeout_ms / 1000, ((uint32_t)timeout_ms % 1000) * 1000000));
+}
+
+
+/* 
+ *   system_nanosleep (const timespec_t* req, timespec_t* rem)
+ *   DESCRIPTION: Puts the calling process to sleep for the time in *req, rounded up to whole PIT ticks. It sleeps on a 
+ *                wait queue nobody wakes, with a timer of the timer wheel ending the sleep, so the CPU is free (and can 
+ *                go tickless) meanwhile instead of reading the RTC in a loop.    
+ *   INPUTS: req - time to sleep, nanoseconds below one second
+ *           rem - where to store the time left, NULL if not wanted (the sleep is never cut short, so it is zero)
+ *   OUTPUTS: *rem
+ *   RETURN VALUE: 0 on success, -1 if req is not a readable user address, rem is not a writable one or req is not a valid time   
+ */
+int32_t system_nanosleep (const timespec_t* req, timespec_t* rem){
+    wait_queue_t sleepers = { NULL, NULL };
+    uint32_t deadline, flags;
+
+    if(!user_readable(pcb, (uint32_t)req, sizeof(timespec_t)) ||
+       (rem != NULL && !user_writable(pcb, (uint32_t)rem, sizeof(timespec_t)))){
+        return -1;
+    }
+    if(req->tv_nsec >= NSEC_PER_SEC){
+        return -1;
+    }
+    cli_and_save(flags);
+    deadline = (uint32_t)get_counter() + timer_ticks(req->tv_sec, req->tv_nsec);
+    while((int32_t)(deadline - (uint32_t)get_counter()) > 0){
+        sched_sleep_on_lock_timeout(&sleepers, NULL, deadline - (uint32_t)get_counter());
+    }
+    restore_flags(flags);
+    if(rem != NULL){
+        rem->tv_sec = 0;
+        rem->tv_nsec = 0;
+    }
+    return 0;
+}
+
+
+/* 
+ *   system_clock_gettime (int32_t clock_id, timespec_t* ts)
+ *   DESCRIPTION: Reads the monotonic clock (nanoseconds from the calibrated TSC, counted from boot). Programs can read 
+ *                the same clock without a trap off the page at VCLOCK_ADDR, this call is for those that do not.    
+ *   INPUTS: clock_id - CLOCK_MONOTONIC
+ *           ts       - where to store the time
+ *   OUTPUTS: *ts
+ *   RETURN VALUE: 0 on success, -1 for another clock or if ts is not a writable user address   
+ */
+int32_t system_clock_gettime (int32_t clock_id, timespec_t* ts){
+    if(clock_id != CLOCK_MONOTONIC || !user_writable(pcb, (uint32_t)ts, sizeof(timespec_t))){
+        return -1;
+    }
+    clock_read(ts);
+    return 0;
 }
 
 
@@ -269,6 +661,9 @@ int32_t system_read (int32_t fd, void* buf, int32_t nbytes){
     if(fd>7 || fd<0){                                                       // Check to see if the FD index is valid
         return -1;
     }
+    if(nbytes > 0 && !user_writable(pcb, (uint32_t)buf, nbytes)){           // The kernel cannot store to read only user pages (CR0.WP)
+        return -1;
+    }
     int retval;
     if(fd==0){                                                              // If we want to read from the terminal, jump to terminal_read via function pointer
         pcb->fds[fd].operation_ptr = fun_ptr_arr_terminal;
@@ -333,15 +728,21 @@ int32_t system_open (const uint8_t* filename){
     (void) read_dentry_by_name (filename, &dentry);
     if(dentry.file_type==0){                                                // We have an RTC file - call rtc_open 
         fd = rtc_open(filename);
-        pcb->fds[fd].operation_ptr = fun_ptr_arr_rtc;
+        if(fd != -1){
+            pcb->fds[fd].operation_ptr = fun_ptr_arr_rtc;
+        }
     }
     else if(dentry.file_type==1){                                           // We have a directory file - call dir_open 
         fd = dir_open(filename);
-        pcb->fds[fd].operation_ptr = fun_ptr_arr_dir;
+        if(fd != -1){
+            pcb->fds[fd].operation_ptr = fun_ptr_arr_dir;
+        }
     }
     else if(dentry.file_type==2){                                           // We have a normal file - call file_open 
         fd = file_open(filename);
-        pcb->fds[fd].operation_ptr = fun_ptr_arr_file;
+        if(fd != -1){
+            pcb->fds[fd].operation_ptr = fun_ptr_arr_file;
+        }
     }
     return fd; 
 }
@@ -378,14 +779,17 @@ int32_t system_getargs (uint8_t* buf, int32_t nbytes){
 
     int i;                                                                  // MAGIC NUMBER: The keyboard and arg_buf can only store 128 chars 
     int null_counter=0;
-    for(i=0;i<33;i++){                                                     // Store the contents of arg_buf into buf (arg_buf is filled in system_execute)
-        buf[i]=arg_buf[i];
-        if(arg_buf[i]=='\0'){                                               // Count the amount of null chars in buf 
+    if(!user_writable(pcb, (uint32_t)buf, 33)){                             // Filled below, so it must be writable (CR0.WP)
+        return -1;
+    }
+    for(i=0;i<33;i++){                                                     // Store the contents of the process' arguments into buf (filled in system_execute)
+        buf[i]=pcb->args[i];
+        if(pcb->args[i]=='\0'){                                             // Count the amount of null chars in buf 
             null_counter++;
         }
     }
-    for(i=0;i<33;i++){                                                     // Clear arg_buf such that it can be used later 
-        arg_buf[i]='\0';
+    for(i=0;i<33;i++){                                                     // Clear the arguments, they are handed out once 
+        pcb->args[i]='\0';
     }
     if((null_counter==33)||(null_counter==0)){                             // If buf is filled with all nulls (is empty) or does not end with a null terminator, return -1
         return -1;
@@ -406,14 +810,109 @@ int32_t system_vidmap (uint8_t** screen_start){
     if((uint32_t)screen_start<(0x8000000)||(uint32_t)screen_start>(0x8000000+ 0x400000)){      // Check screen_start is within valid range [128 MB, 132 MB]
         return -1;                                                         // 128 MB = 0x80000000, 132 MB = 0x8000000+ 0x400000
     }
+    if(!user_writable(pcb, (uint32_t)screen_start, sizeof(uint8_t*))){     // Not in the read only part of the image
+        return -1;
+    }
     *screen_start=(uint8_t*)0x08822000;                                    // Map the virtual user level page to 0x08822000 (because index 34 in page_directory corresponds to this value)
     vidmap_page_table_init();                                              // Create a vidmap page table to hold the new virtual 4kB page 
     vidmap_directory_entry_init(34);                                       // Initialize the page directory entry for this new page table 
     vidmap_init(34);                                                       // Create the new page inside of the new page table and map this to index 34 (because index 34 in page_directory corresponds to this value).
+    pcb->vidmap = 1;                                                       // The scheduler maps it back in whenever this process runs 
     return 0;
 }
 
 
+/* 
+ *   system_brk (void* addr)
+ *   DESCRIPTION: Moves the end of the current process' heap to addr. Growing only moves the break, the new pages are 
+ *                backed by zeroed frames on first touch (see page_fault_handler). Shrinking frees every page above the new break. 
+ *   INPUTS: addr - new end of the heap, must lie within [HEAP_START, HEAP_END]
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: -1 if addr is outside the heap region, 0 otherwise    
+ */
+int32_t system_brk (void* addr){
+
+    uint32_t new_brk = (uint32_t)addr;
+    if(new_brk < HEAP_START || new_brk > HEAP_END){                        // The heap must stay inside its 4MB page directory slot
+        return -1;
+    }
+    if(new_brk < pcb->vmas[VMA_HEAP_SLOT].end){                             // Shrinking: give back the frames that are no longer covered
+        user_release(pcb->process_num, new_brk, HEAP_END);
+    }
+    pcb->vmas[VMA_HEAP_SLOT].end = new_brk;
+    return 0;
+}
+
+
+/* 
+ *   system_sbrk (int32_t increment)
+ *   DESCRIPTION: Grows (or shrinks, for a negative increment) the current process' heap by increment bytes.   
+ *   INPUTS: increment - number of bytes to add to the heap
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: -1 if the heap cannot be resized, the previous end of the heap otherwise    
+ */
+int32_t system_sbrk (int32_t increment){
+
+    uint32_t old_brk = pcb->vmas[VMA_HEAP_SLOT].end;
+    if(system_brk((void*)(old_brk + increment)) == -1){
+        return -1;
+    }
+    return (int32_t)old_brk;
+}
+
+
+/* 
+ *   system_shmget (int32_t key, uint32_t size)
+ *   DESCRIPTION: Looks up the shared memory segment created with key, creating one of size bytes if there is none.   
+ *   INPUTS: key  - user chosen key shared by the cooperating processes
+ *           size - size of the segment in bytes (at most SHM_MAX_PAGES pages), ignored if the segment exists
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: -1 on failure, the segment id otherwise    
+ */
+int32_t system_shmget (int32_t key, uint32_t size){
+    return shm_get(key, size);
+}
+
+
+/* 
+ *   system_shmat (int32_t id)
+ *   DESCRIPTION: Maps a shared memory segment into the current process. The segment's frames are mapped directly, 
+ *                so every attached process reads and writes the same physical memory (no copies).   
+ *   INPUTS: id - segment id returned by system_shmget
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: -1 on failure, the user address of the segment otherwise    
+ */
+int32_t system_shmat (int32_t id){
+    return shm_attach(id);
+}
+
+
+/* 
+ *   system_shmdt (void* addr)
+ *   DESCRIPTION: Unmaps a shared memory segment from the current process. The segment and its contents stay until  
+ *                system_shmrm removes it.   
+ *   INPUTS: addr - address returned by system_shmat
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: -1 if no segment is attached at addr, 0 otherwise    
+ */
+int32_t system_shmdt (void* addr){
+    return shm_detach((uint32_t)addr);
+}
+
+
+/* 
+ *   system_shmrm (int32_t id)
+ *   DESCRIPTION: Removes a shared memory segment: its key is free for a new segment and it is destroyed once no 
+ *                process has it attached (at once if none does).   
+ *   INPUTS: id - segment id returned by system_shmget
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: -1 if id is not a segment or was removed already, 0 otherwise    
+ */
+int32_t system_shmrm (int32_t id){
+    return shm_remove(id);
+}
+
+
 /* 
  *   system_set_handler (int32_t signum, void* handler_address)
  *   DESCRIPTION: UNUSED BECAUSE SIGNALS ARE NOT SUPPORTED   
@@ -459,3 +958,107 @@ int32_t system_sigreturn (void){
     //     }
     // }
 
+
+/* 
+ *   system_nice (int32_t increment)
+ *   DESCRIPTION: Adds increment to the nice value of the current process (clamped to [SCHED_NICE_MIN, SCHED_NICE_MAX]). 
+ *                A higher nice value means a lower priority level in the scheduler.   
+ *   INPUTS: increment - change of the nice value
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: 0    
+ */
+int32_t system_nice (int32_t increment){
+    sched_set_nice(pcb, pcb->sched_nice + increment);
+    return 0;
+}
+
+
+/* 
+ *   system_setpriority (int32_t pid, int32_t nice)
+ *   DESCRIPTION: Sets the nice value of a running process (clamped to [SCHED_NICE_MIN, SCHED_NICE_MAX]).   
+ *   INPUTS: pid  - process number of the target
+ *           nice - new nice value
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: -1 if there is no such process, 0 otherwise    
+ */
+int32_t system_setpriority (int32_t pid, int32_t nice){
+    if(pid < 0 || pid >= PCB_ARR_MAX_COUNT || pcb_array[pid] == 0){
+        return -1;
+    }
+    sched_set_nice(pcb_by_num(pid), nice);
+    return 0;
+}
+
+
+/* 
+ *   system_timer_config (int32_t hz, int32_t quantum_ms)
+ *   DESCRIPTION: Tunes the scheduler at run time, like the "hz=" and "quantum=" boot options: the PIT tick frequency 
+ *                and the scheduling quantum (time slice of the top priority levels, lower levels get multiples of it). 
+ *                A value of 0 leaves that setting alone. Nothing is changed unless both values are valid.   
+ *   INPUTS: hz         - ticks per second (PIT_MIN_HZ to pit_max_hz()) or 0
+ *           quantum_ms - quantum in milliseconds (1 to SCHED_MAX_QUANTUM_MS) or 0
+ *   OUTPUTS: N/A
+ *   RETURN VALUE: -1 if a value is out of range, 0 otherwise    
+ */
+int32_t system_timer_config (int32_t hz, int32_t quantum_ms){
+    if((hz != 0 && (hz < PIT_MIN_HZ || (uint32_t)hz > pit_max_hz())) || quantum_ms < 0 || quantum_ms > SCHED_MAX_QUANTUM_MS){
+        return -1;
+    }
+    if(hz != 0){
+        pit_set_hz(hz);
+    }
+    if(quantum_ms != 0){
+        sched_set_quantum(quantum_ms);
+    }
+    return 0;
+}
+
+
+/* 
+ *   system_getstats (void* buf, int32_t count)
+ *   DESCRIPTION: Reports the CPU accounting of every process (see sched_account): user and kernel time, system calls, 
+ *                page faults and context switches, along with its state, so a monitor like top can find the process 
+ *                using the CPU. The table is taken under the PCB table lock and copied out afterwards.   
+ *   INPUTS: buf   - user array of count proc_stat_t
+ *           count - number of entries buf holds
+ *   OUTPUTS: one proc_stat_t per process in buf, in process number order
+ *   RETURN VALUE: number of entries filled in, -1 if buf is not a writable user address    
+ */
+int32_t system_getstats (void* buf, int32_t count){
+    proc_stat_t stats[PCB_ARR_MAX_COUNT];
+    proc_stat_t* st;
+    pcb_t* proc;
+    int32_t i, k, n = 0;
+    uint32_t flags;
+
+    if(count < 0 || !user_writable(pcb, (uint32_t)buf, ((count < PCB_ARR_MAX_COUNT) ? count : PCB_ARR_MAX_COUNT) * sizeof(proc_stat_t))){
+        return -1;
+    }
+    flags = spin_lock_irqsave(&pcb_table_lock);
+    for(i = 0; i < PCB_ARR_MAX_COUNT && n < count; i++){
+        proc = pcb_by_num(i);
+        if(pcb_array[i] == 0 || (!proc->in_use && !proc->zombie)){          // Free, or a terminal whose base shell is not running yet
+            continue;
+        }
+        st = &stats[n++];
+        st->pid = i;
+        st->parent = proc->parent_id;
+        st->terminal = proc->terminal;
+        st->nice = proc->sched_nice;
+        st->state = proc->zombie ? PROC_ZOMBIE : (proc->on_run_queue ? PROC_RUNNABLE : PROC_SLEEPING);
+        st->cpu = proc->sched_cpu;
+        st->user_kcycles = (uint32_t)(proc->user_cycles >> 10);
+        st->kernel_kcycles = (uint32_t)(proc->kernel_cycles >> 10);
+        st->syscalls = proc->syscalls;
+        st->page_faults = 0;
+        for(k = 0; k < PF_NUM_KINDS; k++){
+            st->page_faults += proc->fault_count[k];
+        }
+        st->vol_switches = proc->vol_switches;
+        st->invol_switches = proc->invol_switches;
+        memcpy(st->name, proc->name, sizeof(st->name));
+    }
+    spin_unlock_irqrestore(&pcb_table_lock, flags);
+    memcpy(buf, stats, n * sizeof(proc_stat_t));
+    return n;
+}
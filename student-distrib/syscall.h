@@ -1,13 +1,31 @@
 #ifndef SYSCALL_H
 #define SYSCALL_H
 
+/* Highest system call number accepted by syscall_handler */
+#define MAX_SYSCALL_NUM 25
+
+/* system_waitpid option: return 0 instead of sleeping when no child has halted yet */
+#define WNOHANG 1
+
+/* Offset of kernel_esp in pcb_t, used by switch_to */
+#define PCB_KERNEL_ESP 0x0
+
 #ifndef ASM
 
 #include "types.h"
 #include "filesystem.h"
 #include "keyboard.h"
+#include "paging.h"
+#include "spinlock.h"
+#include "wait_queue.h"
 
-#define PCB_ARR_MAX_COUNT 6
+/* A duration for system_nanosleep, the layout user programs pass */
+typedef struct timespec_t {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;                   // below NSEC_PER_SEC
+} timespec_t;
+
+#define NSEC_PER_SEC    1000000000
 
 /*declare all system call functions*/
 extern int32_t dummy ();
@@ -21,31 +39,32 @@ extern int32_t system_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t system_vidmap (uint8_t** screen_start);
 extern int32_t system_set_handler (int32_t signum, void* handler_address);
 extern int32_t system_sigreturn (void);
+extern int32_t system_brk (void* addr);
+extern int32_t system_sbrk (int32_t increment);
+extern int32_t system_shmget (int32_t key, uint32_t size);
+extern int32_t system_shmat (int32_t id);
+extern int32_t system_shmdt (void* addr);
+extern int32_t system_shmrm (int32_t id);
+extern int32_t system_nice (int32_t increment);
+extern int32_t system_setpriority (int32_t pid, int32_t nice);
+extern int32_t system_timer_config (int32_t hz, int32_t quantum_ms);
+extern int32_t system_spawn (const uint8_t* command);
+extern int32_t system_waitpid (int32_t pid, int32_t* status, int32_t options);
+extern int32_t system_getstats (void* buf, int32_t count);
+extern int32_t system_nanosleep (const timespec_t* req, timespec_t* rem);
+extern int32_t system_timedwait (int32_t pid, int32_t* status, int32_t timeout_ms);
+extern int32_t system_clock_gettime (int32_t clock_id, timespec_t* ts);
 
 /*sets up pcb struct*/
 typedef struct pcb_t {
-    /* General Purpose Regs */
-    /* as each register is 32 bit, each of them occupy 4 bytes */
-    /* thus, offset increment by 4 for every register/ eflags */
-    uint32_t ebp; //offset 0x0
-    uint32_t eax; //offset 0x4
-    uint32_t ebx; //offset 0x8
-    uint32_t ecx; //offset 0xC
-    uint32_t edx; //offset 0x10
-    uint32_t esi; //offset 0x14
-    uint32_t edi; //offset 0x18
-
-    /* Flags */
-    uint32_t eflags; //offset 0x1C
-
-    /* Ptr to 1st instruction in memory */
-    uint32_t eip; //offset 0x20
-
-    /* Stack Ptr */
-    uint32_t esp; //offset 0x24
+    /* Kernel stack pointer saved by switch_to while the process is not running */
+    uint32_t kernel_esp; //offset 0x0
+
+    /* Kernel stack pointer of the system_execute call waiting for this process to halt */
+    uint32_t exec_esp; //offset 0x4
 
     /* halt status attribute*/
-    uint32_t halt_status; //offset 0x28
+    uint32_t halt_status; //offset 0x8
 
     /* Other stuff */ 
     uint32_t process_num; 
@@ -56,19 +75,85 @@ typedef struct pcb_t {
     file_desc_t fds[8]; 
     int terminal; 
     int initialize_flag;
-    int addr; 
+    uint32_t kernel_stack_top;          // Top of this process' kernel stack (esp0), kept with the slot across executes
+    vm_area_t vmas[MAX_VMAS];           // Address space layout, consulted by the page fault handler
+    uint32_t shm_attached;              // Bit i set when shared memory segment i is mapped
+    uint32_t in_terminal_read;          // Set while blocked waiting for a line, the swap scan compresses such processes' pages
+    uint32_t vidmap;                    // Set once the process has mapped video memory with system_vidmap
+    uint8_t args[128];                  // Arguments given to execute, handed out by system_getargs
+    struct pcb_t* run_next;             // Run queue links (circular), valid while on_run_queue is set
+    struct pcb_t* run_prev;
+    uint32_t on_run_queue;
+    uint32_t sched_level;               // Current priority level, 0 runs first
+    int32_t sched_nice;                 // Nice value, sets the base level
+    int32_t sched_ticks_left;           // PIT ticks left in the time slice
+    uint32_t sched_cpu;                 // CPU whose run queue the process is on
+    uint32_t sched_last_ran;            // PIT tick it last got a CPU at, recently run processes are cache hot
+    struct pcb_t* wait_next;            // Next sleeper on the wait queue this process is blocked on
+    uint32_t fault_count[PF_NUM_KINDS]; // Page faults taken, by kind
+    uint64_t fault_cycles[PF_NUM_KINDS];// TSC cycles spent resolving them, by kind
+    uint8_t* fpu_state;                 // FXSAVE area, NULL until the process first uses the FPU
+    spinlock_t fd_lock;                 // Guards the flags of fds (taking and freeing descriptors)
+    uint32_t kthread;                   // 1 for a kernel thread: no user address space, never leaves the kernel
+    uint32_t preempt_count;             // Nesting of sched_preempt_disable, the process keeps the CPU while it is not 0
+    uint32_t spawned;                   // 1 if started by system_spawn: it has its own turn and its parent collects it with system_waitpid
+    uint32_t zombie;                    // Set when a spawned process has halted and its parent has not collected it yet
+    wait_queue_t child_waiters;         // This process while it sleeps in system_waitpid
+    uint8_t name[12];                   // Executable name, reported by system_getstats
+    uint64_t user_cycles;               // TSC cycles spent in user mode, see sched_account
+    uint64_t kernel_cycles;             // TSC cycles spent in the kernel on its behalf
+    uint32_t syscalls;                  // System calls made
+    uint32_t vol_switches;              // Times it gave up the CPU (sleeping, halting)
+    uint32_t invol_switches;            // Times it was preempted
 
 } pcb_t;
 
+/* Process states reported by system_getstats */
+#define PROC_RUNNABLE   0               // in a run queue
+#define PROC_SLEEPING   1               // waiting for an event, or for a child started with execute
+#define PROC_ZOMBIE     2               // halted, not collected by its parent yet
+
+/* One process as seen by system_getstats, the layout user programs get (times in units of 1024 TSC cycles) */
+typedef struct proc_stat_t {
+    int32_t pid;
+    int32_t parent;                     // -1 for none
+    int32_t terminal;
+    int32_t nice;
+    uint32_t state;                     // PROC_*
+    uint32_t cpu;
+    uint32_t user_kcycles;
+    uint32_t kernel_kcycles;
+    uint32_t syscalls;
+    uint32_t page_faults;
+    uint32_t vol_switches;
+    uint32_t invol_switches;
+    uint8_t name[12];
+} proc_stat_t;
+
+/*counts a system call of the current process, called by syscall_handler*/
+void syscall_count();
+
 /*initialize pcb*/
 int32_t pcb_init(); 
 
 /*current pcb getter function*/
 pcb_t* pcb_ptr();
 
+/*returns the pcb of process slot process*/
+pcb_t* pcb_by_num(int process);
+
 /*changes global syscall.c pcb to point to the address addr*/
 void change_global_pcb(pcb_t* addr); 
 
+/*takes a free process slot for a process started by parent*/
+int32_t pcb_slot_alloc(pcb_t* parent);
+
+/*takes a free descriptor (2-7) of the current process for the file inode_num*/
+int32_t fd_alloc(uint32_t inode_num);
+
+/*gives descriptor fd of the current process back*/
+int32_t fd_free(int32_t fd);
+
 #endif /* ASM */
 
 #endif /* SYSCALL_H */
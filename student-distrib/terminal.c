@@ -1,6 +1,7 @@
 /* Terminal Driver */
 #include "terminal.h"
 #include "lib.h"
+#include "schedule.h"
 
 /*define MACRO*/
 #define KEYBOARD_TABLE_SIZE 88
@@ -59,37 +60,63 @@ int32_t terminal_open (const uint8_t* filename){
 int32_t terminal_read(int32_t fd, void* terminal_read_buf, int32_t nbytes){
     /*check if the nbytes passed in to read is greater than the maximum terminal read buffer size*/
     num_times_read_called++;
+    pcb_t* reader = pcb_ptr();
+    if(reader != NULL){
+        /*blocked until ENTER: the swap scan may compress this process' cold pages meanwhile*/
+        reader->in_terminal_read = 1;
+    }
     
     if(nbytes > 128){
         /*if so, sets the bytes to read to maximum of 128*/
         nbytes = 128;
     }
 
-    /*obtain next available index with the getter*/
-    next_avail_index=get_next_index(); 
+    /*read the keyboard buffer of the reader's own terminal (keys typed while it is on screen land there)*/
+    terminal_t* term = terminal_data((reader != NULL) ? reader->terminal : get_seen_terminal_num());
+
+    /*obtain next available index, kept local as readers on other terminals run concurrently*/
+    int32_t next_index = term->next_index; 
 
     int i; 
-    /*while the buffer is not full (128) and the ENTER (\n) is not pressed*/
-    while(next_avail_index < nbytes && ((uint8_t*) terminal_read_buf)[next_avail_index] != '\n') {
-        /*update the terminal read buffer to the keyboard buffer*/
-        for (i = 0; i < nbytes; i++) {
-            ((uint8_t*)terminal_read_buf)[i] = get_keys()[i];
-        }
+    char line[128];
+    /*while the buffer is not full (128) and the ENTER (\n) is not pressed, sleep: key_work wakes us on every key*/
+    mutex_lock(&term->lock);
+    next_index = term->next_index;
+    while(next_index < nbytes && term->keys[next_index] != '\n') {
+        mutex_sleep_on(&term->readers, &term->lock);
         /*obtain the next available index*/
-        next_avail_index=get_next_index();
+        next_index = term->next_index;
+    }
+
+    /*take the line out of the keyboard buffer, it goes to the caller once the lock is dropped (the copy may fault)*/
+    for (i = 0; i < nbytes; i++) {
+        line[i] = term->keys[i];
     }
+    next_avail_index = next_index;
 
     /*when the buffer is full (128) or the ENTER (\n) is pressed*/
     for (i = 0; i < 128; i++) {
         /*clear the terminal buffer, sets all terminal buffer entries to \0*/
-        get_keys()[i] = '\0';
+        term->keys[i] = '\0';
     }
 
     /*resets the next index to 0*/
-    set_next_index(0);
+    term->next_index = 0;
+    mutex_unlock(&term->lock);
+
+    /*update the terminal read buffer to the keyboard buffer*/
+    for (i = 0; i < nbytes; i++) {
+        ((uint8_t*)terminal_read_buf)[i] = line[i];
+    }
+
+    if(reader != NULL){
+        reader->in_terminal_read = 0;
+        /*it waited on the user: interactive, so it goes ahead of CPU bound processes*/
+        sched_boost(reader);
+    }
 
     /*puts the newline char (\n) at the end of terminal buffer before returning*/
-    ((uint8_t*)terminal_read_buf)[next_avail_index] = '\n';
+    ((uint8_t*)terminal_read_buf)[next_index] = '\n';
     
     /*counter to access element in terminal read buffer*/
     i = 0;
@@ -50,4 +50,52 @@ void terminal_test();
 /* System Call Test (Execute, Halt, Open, Close, Read, Write)*/
 int system_call_test();
 
+/* Memory Management Tests */
+int frame_alloc_test();
+int heap_test();
+int shm_test();
+int kernel_stack_test();
+int frame_refcount_test();
+int page_fault_test();
+int swap_codec_test();
+
+/* Scheduler Tests */
+int run_queue_test();
+int mlfq_test();
+int wait_queue_test();
+int tickless_test();
+int timer_config_test();
+int switch_bench();
+int fpu_test();
+int smp_test();
+int load_balance_bench();
+
+/* Locking Tests */
+int spinlock_test();
+
+/* Deferred Work Test */
+int workqueue_test();
+
+/* Background Job Test */
+int spawn_wait_test();
+int waitpid_reap_test();
+
+/* Program Loader Test */
+int elf_test();
+int exec_bench();
+
+/* Accounting Test */
+int cpu_accounting_test();
+
+/* Device Test */
+int vrtc_test();
+
+/* Timer Test */
+int timer_wheel_test();
+int clock_test();
+int hpet_test();
+
+/* Interrupt Controller Test */
+int ioapic_test();
+
 #endif /* TESTS_H */
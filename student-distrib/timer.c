@@ -0,0 +1,247 @@
+/* timer.c - Hierarchical timer wheel driven by the PIT: timeouts for sleeping processes and kernel code */
+
+#include "timer.h"
+#include "pit.h"
+#include "spinlock.h"
+#include "lib.h"
+
+static ktimer_t* wheel[TIMER_LEVELS][TIMER_SLOTS];             // Timers of each slot of each level, unordered
+static uint32_t timer_jiffies = 0;                              // Next tick timer_run processes (the PIT counter starts at -1)
+static uint32_t timers_pending = 0;                             // Timers on the wheel
+static spinlock_t timer_lock = SPINLOCK_INIT("timer wheel");    // Guards everything above and the timers' links
+
+
+/*
+ * slot_shift()
+ *   DESCRIPTION: Returns how far a tick number is shifted to index the slots of a level
+ *   INPUTS: level - wheel level
+ *   OUTPUTS: none
+ *   RETURN VALUE: TIMER_LEVEL_BITS * level
+ *   SIDE EFFECTS: none
+ */
+static inline uint32_t slot_shift(uint32_t level){
+    return TIMER_LEVEL_BITS * level;
+}
+
+
+/*
+ * wheel_insert()
+ *   DESCRIPTION: Puts a timer in the slot of the lowest level that reaches its expiry. A timer already due goes in
+ *                the slot timer_run processes next. Call with timer_lock held.
+ *   INPUTS: timer - timer with expires set
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void wheel_insert(ktimer_t* timer){
+    int32_t delta = (int32_t)(timer->expires - timer_jiffies);
+    uint32_t level = 0;
+    ktimer_t** slot;
+    if(delta < 0){
+        slot = &wheel[0][timer_jiffies & TIMER_SLOT_MASK];
+    }
+    else{
+        if(delta > TIMER_MAX_TICKS){
+            timer->expires = timer_jiffies + TIMER_MAX_TICKS;
+            delta = TIMER_MAX_TICKS;
+        }
+        while(level < TIMER_LEVELS-1 && (uint32_t)delta >= (1U << slot_shift(level+1))){
+            level++;
+        }
+        slot = &wheel[level][(timer->expires >> slot_shift(level)) & TIMER_SLOT_MASK];
+    }
+    timer->prev = NULL;
+    timer->next = *slot;
+    if(*slot != NULL){
+        (*slot)->prev = timer;
+    }
+    *slot = timer;
+    timer->slot = slot;
+}
+
+
+/*
+ * wheel_unlink()
+ *   DESCRIPTION: Takes a timer out of its slot. Call with timer_lock held.
+ *   INPUTS: timer - timer on the wheel
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void wheel_unlink(ktimer_t* timer){
+    if(timer->prev != NULL){
+        timer->prev->next = timer->next;
+    }
+    else{
+        *timer->slot = timer->next;
+    }
+    if(timer->next != NULL){
+        timer->next->prev = timer->prev;
+    }
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->slot = NULL;
+}
+
+
+/*
+ * cascade()
+ *   DESCRIPTION: Moves every timer of one slot of a higher level down to the level that now reaches it, done when
+ *                the level below wraps around. Call with timer_lock held.
+ *   INPUTS: level - level of the slot (1 and up)
+ *           index - slot number
+ *   OUTPUTS: none
+ *   RETURN VALUE: index, so the caller knows whether the next level wraps too
+ *   SIDE EFFECTS: none
+ */
+static uint32_t cascade(uint32_t level, uint32_t index){
+    ktimer_t* timer = wheel[level][index];
+    ktimer_t* next;
+    wheel[level][index] = NULL;
+    for(; timer != NULL; timer = next){
+        next = timer->next;
+        wheel_insert(timer);
+    }
+    return index;
+}
+
+
+/*
+ * timer_add()
+ *   DESCRIPTION: Arms a timer to run ticks PIT ticks from now. A pending timer is moved to the new expiry. In tickless
+ *                mode the PIT one-shot is brought forward if this timer is due before it fires.
+ *   INPUTS: timer - timer to arm, with fn and arg set
+ *           ticks - delay in PIT ticks, at least one is used
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may reprogram the PIT
+ */
+void timer_add(ktimer_t* timer, uint32_t ticks){
+    uint32_t flags;
+    if(ticks == 0){
+        ticks = 1;
+    }
+    flags = spin_lock_irqsave(&timer_lock);
+    if(timer->pending){
+        wheel_unlink(timer);
+        timers_pending--;
+    }
+    timer->expires = (uint32_t)get_counter() + ticks;
+    timer->pending = 1;
+    wheel_insert(timer);
+    timers_pending++;
+    spin_unlock_irqrestore(&timer_lock, flags);
+    pit_timer_changed();
+}
+
+
+/*
+ * timer_cancel()
+ *   DESCRIPTION: Disarms a timer. Once it returns the timer's function will not be called (it may have run already).
+ *   INPUTS: timer - timer to disarm
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the timer was pending, 0 if it had run or was never armed
+ *   SIDE EFFECTS: none
+ */
+int32_t timer_cancel(ktimer_t* timer){
+    uint32_t flags;
+    int32_t was_pending = 0;
+    flags = spin_lock_irqsave(&timer_lock);
+    if(timer->pending){
+        wheel_unlink(timer);
+        timer->pending = 0;
+        timers_pending--;
+        was_pending = 1;
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return was_pending;
+}
+
+
+/*
+ * timer_run()
+ *   DESCRIPTION: Called by the PIT handler with the tick counter: processes every tick up to now (several after a
+ *                tickless one-shot). At each tick the higher levels whose turn it is cascade down and the timers of
+ *                the level 0 slot run, one at a time with timer_lock released, so a timer function may add timers.
+ *   INPUTS: now - current PIT tick
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: runs timer functions
+ */
+void timer_run(uint32_t now){
+    uint32_t flags, level, index;
+    ktimer_t* timer;
+    flags = spin_lock_irqsave(&timer_lock);
+    while((int32_t)(now - timer_jiffies) >= 0){
+        index = timer_jiffies & TIMER_SLOT_MASK;
+        for(level = 1; index == 0 && level < TIMER_LEVELS; level++){    // level 0 wrapped: bring the next slot of level 1 down, and so on
+            index = cascade(level, (timer_jiffies >> slot_shift(level)) & TIMER_SLOT_MASK);
+        }
+        index = timer_jiffies & TIMER_SLOT_MASK;
+        while((timer = wheel[0][index]) != NULL){
+            wheel_unlink(timer);
+            timer->pending = 0;
+            timers_pending--;
+            spin_unlock_irqrestore(&timer_lock, flags);
+            timer->fn(timer->arg);
+            flags = spin_lock_irqsave(&timer_lock);
+        }
+        timer_jiffies++;
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+
+/*
+ * timer_next_expiry()
+ *   DESCRIPTION: Returns the first tick a timer may be due at, so the tickless one-shot can fire then: the first non
+ *                empty level 0 slot within a turn of the wheel, otherwise the next cascade (the higher levels only
+ *                know their timers to the slot).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: PIT tick, TIMER_MAX_TICKS ahead when no timer is pending
+ *   SIDE EFFECTS: none
+ */
+uint32_t timer_next_expiry(){
+    uint32_t flags, i, next;
+    flags = spin_lock_irqsave(&timer_lock);
+    next = timer_jiffies + TIMER_MAX_TICKS;
+    if(timers_pending > 0){
+        for(i = 0; i < TIMER_SLOTS; i++){
+            if(wheel[0][(timer_jiffies + i) & TIMER_SLOT_MASK] != NULL){
+                break;
+            }
+            if(i > 0 && ((timer_jiffies + i) & TIMER_SLOT_MASK) == 0){  // a cascade comes first
+                break;
+            }
+        }
+        next = timer_jiffies + i;
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return next;
+}
+
+
+/*
+ * timer_ticks()
+ *   DESCRIPTION: Converts a duration to PIT ticks at the current frequency, rounding up (from whole microseconds) so a
+ *                sleep never ends early
+ *   INPUTS: sec  - seconds
+ *           nsec - nanoseconds, below one second
+ *   OUTPUTS: none
+ *   RETURN VALUE: ticks, at least one and at most TIMER_MAX_TICKS
+ *   SIDE EFFECTS: none
+ */
+uint32_t timer_ticks(uint32_t sec, uint32_t nsec){
+    uint32_t hz = pit_get_hz();
+    uint32_t usec = nsec / 1000;
+    uint32_t milliticks, ticks;
+    if(sec >= TIMER_MAX_TICKS / hz){
+        return TIMER_MAX_TICKS;
+    }
+    /* microseconds * hz overflows past 4294 Hz, so split it: (ms * hz) * 1000 + (us % 1000) * hz, each part
+       below 1000 * hz, which fits for any hz up to the millions */
+    milliticks = (usec / 1000) * hz;
+    ticks = sec * hz + milliticks / 1000 + ((milliticks % 1000) * 1000 + (usec % 1000) * hz + 999999) / 1000000;
+    return (ticks == 0) ? 1 : ticks;
+}
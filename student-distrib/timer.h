@@ -0,0 +1,44 @@
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include "types.h"
+
+/* Hierarchical timer wheel: TIMER_LEVELS wheels of TIMER_SLOTS slots. Level 0 has one slot per PIT tick, each slot of
+ * level l covers TIMER_SLOTS^l ticks; a timer sits in the lowest level that reaches its expiry and moves down
+ * (cascades) as the time gets closer. Adding, cancelling and expiring a timer is O(1). */
+#define TIMER_LEVEL_BITS    6
+#define TIMER_SLOTS         (1 << TIMER_LEVEL_BITS)
+#define TIMER_SLOT_MASK     (TIMER_SLOTS - 1)
+#define TIMER_LEVELS        4
+#define TIMER_MAX_TICKS     ((1 << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1)   // further timeouts are cut to this
+
+/* A timer: fn(arg) runs in the PIT interrupt once the tick counter reaches expires */
+typedef struct ktimer_t {
+    uint32_t expires;                           // PIT tick (get_counter) it runs at
+    void (*fn)(void* arg);
+    void* arg;
+    uint32_t pending;                           // 1 while it is on the wheel
+    struct ktimer_t* next;                      // links within its slot
+    struct ktimer_t* prev;
+    struct ktimer_t** slot;                     // head of the slot it is in
+} ktimer_t;
+
+/* Initializer of a timer */
+#define TIMER_INIT(timer_fn, timer_arg)     { 0, timer_fn, timer_arg, 0, NULL, NULL, NULL }
+
+/* Arms timer to run ticks PIT ticks from now (at least one), rearming a pending timer moves it */
+void timer_add(ktimer_t* timer, uint32_t ticks);
+
+/* Disarms timer, returns 1 if it was pending */
+int32_t timer_cancel(ktimer_t* timer);
+
+/* Runs the timers due by tick now, called by the PIT handler */
+void timer_run(uint32_t now);
+
+/* Returns the first tick a timer may be due at, for the tickless one-shot */
+uint32_t timer_next_expiry();
+
+/* Converts a duration to PIT ticks, rounding up (at least one) */
+uint32_t timer_ticks(uint32_t sec, uint32_t nsec);
+
+#endif /* _TIMER_H */
@@ -0,0 +1,34 @@
+#ifndef _WAIT_QUEUE_H
+#define _WAIT_QUEUE_H
+
+#include "types.h"
+#include "spinlock.h"
+
+struct pcb_t;
+
+/* Processes blocked until some event, linked through pcb->wait_next in the order they went to sleep */
+typedef struct wait_queue_t {
+    struct pcb_t* head;
+    struct pcb_t* tail;
+} wait_queue_t;
+
+/* Blocks the current process on wq until sched_wake_up(wq), call with interrupts off after testing the condition */
+extern void sched_sleep_on(wait_queue_t* wq);
+
+/* Same, for a condition tested under lock: lock is released once we are on wq and taken again on wake up */
+extern void sched_sleep_on_lock(wait_queue_t* wq, spinlock_t* lock);
+
+/* Same, giving up after ticks PIT ticks: returns 1 if the time ran out */
+extern int32_t sched_sleep_on_lock_timeout(wait_queue_t* wq, spinlock_t* lock, uint32_t ticks);
+
+/* Makes every process sleeping on wq runnable again */
+extern void sched_wake_up(wait_queue_t* wq);
+
+/* Switches to a woken process that outranks the current one, called at the end of interrupt handlers */
+extern void sched_preempt();
+
+/* Keeps the current process on the CPU until the matching sched_preempt_enable (it may not sleep meanwhile) */
+extern void sched_preempt_disable();
+extern void sched_preempt_enable();
+
+#endif /* _WAIT_QUEUE_H */
@@ -0,0 +1,127 @@
+/* workqueue.c - Deferred work: interrupt handlers queue their bottom halves, a kernel thread runs them */
+
+#include "workqueue.h"
+#include "schedule.h"
+#include "lib.h"
+
+static work_t* work_head = NULL;                                // Queued work, oldest first
+static work_t* work_tail = NULL;
+static spinlock_t work_lock = SPINLOCK_INIT("workqueue");       // Guards the queue and the pending flags
+static wait_queue_t worker_waiters;                             // The worker thread, while there is no work
+
+
+/*
+ * work_dequeue()
+ *   DESCRIPTION: Takes the oldest work item off the queue and clears its pending flag, so an interrupt that comes
+ *                while it runs queues it again. Call with work_lock held.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the work item, NULL if the queue is empty
+ *   SIDE EFFECTS: none
+ */
+static work_t* work_dequeue(){
+    work_t* work = work_head;
+    if(work != NULL){
+        work_head = work->next;
+        if(work_head == NULL){
+            work_tail = NULL;
+        }
+        work->next = NULL;
+        work->pending = 0;
+    }
+    return work;
+}
+
+
+/*
+ * worker_thread()
+ *   DESCRIPTION: Body of the worker kernel thread: runs queued work items one by one, with interrupts on, and
+ *                sleeps while the queue is empty
+ *   INPUTS: arg - unused
+ *   OUTPUTS: none
+ *   RETURN VALUE: never returns
+ *   SIDE EFFECTS: whatever the work items do
+ */
+static void worker_thread(void* arg){
+    work_t* work;
+    uint32_t flags;
+    while(1){
+        flags = spin_lock_irqsave(&work_lock);
+        while((work = work_dequeue()) == NULL){
+            sched_sleep_on_lock(&worker_waiters, &work_lock);
+        }
+        spin_unlock_irqrestore(&work_lock, flags);
+        work->fn(work->arg);
+    }
+}
+
+
+/*
+ * workqueue_init()
+ *   DESCRIPTION: Starts the worker kernel thread on CPU 0. Work queued before (during boot) runs once the
+ *                scheduler first picks it.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: queues the worker thread
+ */
+void workqueue_init(){
+    if(kthread_create(worker_thread, NULL, 0) == NULL){
+        printf("Out of Kernel Stacks\n");
+    }
+}
+
+
+/*
+ * work_queue()
+ *   DESCRIPTION: Queues a work item at the tail of the queue and wakes the worker thread. Called by interrupt
+ *                handlers, which return right away; the worker outranks user processes, so the work runs as soon
+ *                as the interrupted code gives up the CPU (sched_preempt at the end of the handler).
+ *   INPUTS: work - item to run
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it was queued, 0 if it was still pending (it will see whatever made us queue it again)
+ *   SIDE EFFECTS: may wake the worker thread
+ */
+int32_t work_queue(work_t* work){
+    uint32_t flags = spin_lock_irqsave(&work_lock);
+    if(work->pending){
+        spin_unlock_irqrestore(&work_lock, flags);
+        return 0;
+    }
+    work->pending = 1;
+    work->next = NULL;
+    if(work_tail == NULL){
+        work_head = work;
+    }
+    else{
+        work_tail->next = work;
+    }
+    work_tail = work;
+    spin_unlock_irqrestore(&work_lock, flags);
+    sched_wake_up(&worker_waiters);
+    return 1;
+}
+
+
+/*
+ * work_flush()
+ *   DESCRIPTION: Runs every pending work item on the calling thread instead of the worker's, in queue order
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of items run
+ *   SIDE EFFECTS: whatever the work items do
+ */
+uint32_t work_flush(){
+    work_t* work;
+    uint32_t flags, count = 0;
+    while(1){
+        flags = spin_lock_irqsave(&work_lock);
+        work = work_dequeue();
+        spin_unlock_irqrestore(&work_lock, flags);
+        if(work == NULL){
+            return count;
+        }
+        work->fn(work->arg);
+        count++;
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef _WORKQUEUE_H
+#define _WORKQUEUE_H
+
+#include "types.h"
+#include "spinlock.h"
+#include "wait_queue.h"
+
+/* A piece of work deferred from an interrupt handler (its bottom half) to the worker kernel thread */
+typedef struct work_t {
+    void (*fn)(void* arg);                      // what to do
+    void* arg;
+    uint32_t pending;                           // 1 while queued: queueing it again before it runs does nothing
+    struct work_t* next;
+} work_t;
+
+/* Initializer of a work item */
+#define WORK_INIT(work_fn, work_arg)    { work_fn, work_arg, 0, NULL }
+
+/* Starts the worker kernel thread */
+void workqueue_init();
+
+/* Queues work for the worker thread, returns 1 if it was queued, 0 if it already was pending */
+int32_t work_queue(work_t* work);
+
+/* Runs every pending work item on the calling thread, returns how many ran */
+uint32_t work_flush();
+
+#endif /* _WORKQUEUE_H */
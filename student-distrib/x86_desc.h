@@ -17,6 +17,13 @@
 #define KERNEL_TSS  0x0030
 #define KERNEL_LDT  0x0038
 
+/* CPUs the kernel can run on. CPU 0 (the bootstrap processor) uses KERNEL_TSS, the TSS descriptors of the
+ * application processors follow the LDT descriptor in the GDT. */
+#define MAX_CPUS    4
+#define CPU_TSS_SEL(cpu)   ((cpu) == 0 ? KERNEL_TSS : KERNEL_LDT + 8*(cpu))
+#define DOUBLE_FAULT_TSS   (KERNEL_LDT + 8*MAX_CPUS)        // Task of the double fault handler, after the CPUs' TSSs
+#define NO_CPU      0xFFFFFFFF                              // No CPU: a free lock, no CPU found
+
 /* Size of the task state segment (TSS) */
 #define TSS_SIZE    104
 
@@ -124,6 +131,8 @@ extern uint32_t ldt;
 extern uint32_t tss_size;
 extern seg_desc_t tss_desc_ptr;
 extern tss_t tss;
+extern seg_desc_t cpu_tss_desc_ptr[MAX_CPUS-1];      // TSS descriptors of CPUs 1 and up
+extern seg_desc_t double_fault_tss_desc_ptr;         // TSS descriptor of the double fault task (DOUBLE_FAULT_TSS)
 
 /* Sets runtime-settable parameters in the GDT entry for the LDT */
 #define SET_LDT_PARAMS(str, addr, lim)                          \
@@ -217,6 +226,17 @@ do {                                    \
     );                                  \
 } while (0)
 
+/* Number of the CPU running this code. Every CPU loads its own TSS selector, so the task register tells them
+ * apart without touching memory (0 before the task register is loaded at boot). */
+static inline uint32_t this_cpu_id(){
+    uint16_t sel;
+    asm volatile ("str %0" : "=r"(sel));
+    return (sel <= KERNEL_TSS) ? 0 : (sel - KERNEL_LDT) / 8;
+}
+
+/* Per-CPU variable: var is an array with one entry per CPU, this_cpu_var(var) is the running CPU's entry */
+#define this_cpu_var(var)   ((var)[this_cpu_id()])
+
 #endif /* ASM */
 
 #endif /* _x86_DESC_H */
@@ -3,6 +3,10 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
+#if !defined(NULL)
+#define NULL 0
+#endif
+
 uint32_t ece391_strlen(const uint8_t* s)
 {
     uint32_t len;
@@ -102,3 +106,89 @@ uint8_t* ece391_strrev(uint8_t* s)
    return s;
 }
 
+
+/* 
+ * Heap allocator.  Small requests are served from segregated free lists,
+ * one per power-of-two block size from 16 to 2048 bytes, so malloc and
+ * free are a single list pop/push.  Empty lists are refilled by carving
+ * blocks off an arena that grows a page at a time through sbrk.  Larger
+ * requests get their own page-rounded run and are recycled first-fit.
+ */
+#define MALLOC_MIN_SHIFT   4
+#define MALLOC_NUM_CLASSES 8
+#define MALLOC_MAX_BLOCK   (1 << (MALLOC_MIN_SHIFT + MALLOC_NUM_CLASSES - 1))
+#define MALLOC_PAGE        4096
+
+typedef struct malloc_hdr_t {
+    uint32_t size;                      /* block size, header included */
+    struct malloc_hdr_t* next;          /* next free block, while free */
+} malloc_hdr_t;
+
+static malloc_hdr_t* small_free[MALLOC_NUM_CLASSES];
+static malloc_hdr_t* large_free;
+static uint8_t* arena_cur;
+static uint8_t* arena_end;
+
+static malloc_hdr_t* malloc_carve(uint32_t block)
+{
+    uint8_t* mem;
+
+    if (arena_end - arena_cur < (int32_t)block) {
+        if ((void*)-1 == (mem = ece391_sbrk(MALLOC_PAGE)))
+            return NULL;
+        if (mem != arena_end)
+            arena_cur = mem;
+        arena_end = mem + MALLOC_PAGE;
+    }
+    mem = arena_cur;
+    arena_cur += block;
+    return (malloc_hdr_t*)mem;
+}
+
+void* ece391_malloc(uint32_t size)
+{
+    malloc_hdr_t* blk;
+    malloc_hdr_t** link;
+    uint32_t need, cls;
+
+    need = size + sizeof(malloc_hdr_t);
+    if (need <= MALLOC_MAX_BLOCK) {
+        for (cls = 0; (1U << (MALLOC_MIN_SHIFT + cls)) < need; cls++);
+        need = 1U << (MALLOC_MIN_SHIFT + cls);
+        if (NULL != (blk = small_free[cls]))
+            small_free[cls] = blk->next;
+        else if (NULL == (blk = malloc_carve(need)))
+            return NULL;
+    } else {
+        need = (need + MALLOC_PAGE - 1) & ~(MALLOC_PAGE - 1);
+        for (link = &large_free; NULL != *link; link = &(*link)->next)
+            if ((*link)->size >= need)
+                break;
+        if (NULL != (blk = *link)) {
+            *link = blk->next;
+            need = blk->size;
+        } else if ((void*)-1 == (blk = ece391_sbrk(need))) {
+            return NULL;
+        }
+    }
+    blk->size = need;
+    return blk + 1;
+}
+
+void ece391_free(void* ptr)
+{
+    malloc_hdr_t* blk;
+    uint32_t cls;
+
+    if (NULL == ptr)
+        return;
+    blk = (malloc_hdr_t*)ptr - 1;
+    if (blk->size <= MALLOC_MAX_BLOCK) {
+        for (cls = 0; (1U << (MALLOC_MIN_SHIFT + cls)) < blk->size; cls++);
+        blk->next = small_free[cls];
+        small_free[cls] = blk;
+    } else {
+        blk->next = large_free;
+        large_free = blk;
+    }
+}
@@ -0,0 +1,143 @@
+#include <stdint.h>
+
+#include "ece391support.h"
+#include "ece391syscall.h"
+
+#define MAX_PROCS       6
+#define DEFAULT_ROUNDS  10
+#define ARGSIZE         33
+
+/* print_num
+ * Prints value right aligned in a field of width characters.
+ */
+void
+print_num (uint32_t value, int32_t width)
+{
+    uint8_t buf[12];
+    int32_t len;
+
+    ece391_itoa (value, buf, 10);
+    for (len = ece391_strlen (buf); len < width; len++)
+        ece391_fdputs (1, (uint8_t*)" ");
+    ece391_fdputs (1, buf);
+}
+
+/* print_str
+ * Prints s left aligned in a field of width characters.
+ */
+void
+print_str (const uint8_t* s, int32_t width)
+{
+    int32_t len;
+
+    ece391_fdputs (1, s);
+    for (len = ece391_strlen (s); len < width; len++)
+        ece391_fdputs (1, (uint8_t*)" ");
+}
+
+/* find_prev
+ * Returns the entry of the previous snapshot describing the same process
+ * (same pid and name), or -1 if the process is new.
+ */
+int32_t
+find_prev (proc_stat_t* prev, int32_t nprev, proc_stat_t* cur)
+{
+    int32_t i;
+
+    for (i = 0; i < nprev; i++) {
+        if (prev[i].pid == cur->pid && 0 == ece391_strcmp (prev[i].name, cur->name))
+            return i;
+    }
+    return -1;
+}
+
+/* show
+ * Prints one line per process, busiest first: the cycles it used since
+ * the previous snapshot and its share of all of them, then its totals.
+ */
+void
+show (proc_stat_t* prev, int32_t nprev, proc_stat_t* cur, int32_t ncur)
+{
+    static const char* states[] = {"run", "sleep", "zombie"};
+    uint32_t delta[MAX_PROCS];
+    int32_t order[MAX_PROCS];
+    uint32_t total = 0;
+    int32_t i, j, k, tmp;
+
+    for (i = 0; i < ncur; i++) {
+        k = find_prev (prev, nprev, &cur[i]);
+        delta[i] = cur[i].user_kcycles + cur[i].kernel_kcycles;
+        if (-1 != k)
+            delta[i] -= prev[k].user_kcycles + prev[k].kernel_kcycles;
+        total += delta[i];
+        order[i] = i;
+    }
+    for (i = 1; i < ncur; i++) {                /* insertion sort, busiest first */
+        for (j = i; j > 0 && delta[order[j]] > delta[order[j-1]]; j--) {
+            tmp = order[j];
+            order[j] = order[j-1];
+            order[j-1] = tmp;
+        }
+    }
+
+    ece391_fdputs (1, (uint8_t*)"\n PID PPID TTY NI CPU STATE  NAME      %CPU USER KCYC KERN KCYC  SYSCALLS  FAULTS VCSW ICSW\n");
+    for (i = 0; i < ncur; i++) {
+        k = order[i];
+        print_num (cur[k].pid, 4);
+        if (-1 == cur[k].parent)
+            ece391_fdputs (1, (uint8_t*)"    -");
+        else
+            print_num (cur[k].parent, 5);
+        print_num (cur[k].terminal, 4);
+        if (cur[k].nice < 0) {
+            ece391_fdputs (1, (uint8_t*)" -");
+            print_num (-cur[k].nice, 1);
+        } else {
+            print_num (cur[k].nice, 3);
+        }
+        print_num (cur[k].cpu, 4);
+        ece391_fdputs (1, (uint8_t*)" ");
+        print_str ((uint8_t*)states[cur[k].state], 7);
+        print_str (cur[k].name, 9);
+        print_num ((0 == total) ? 0 : delta[k] * 100 / total, 5);
+        print_num (cur[k].user_kcycles, 10);
+        print_num (cur[k].kernel_kcycles, 10);
+        print_num (cur[k].syscalls, 10);
+        print_num (cur[k].page_faults, 8);
+        print_num (cur[k].vol_switches, 5);
+        print_num (cur[k].invol_switches, 5);
+        ece391_fdputs (1, (uint8_t*)"\n");
+    }
+}
+
+int main ()
+{
+    proc_stat_t snap[2][MAX_PROCS];
+    int32_t nsnap[2];
+    uint8_t arg[ARGSIZE];
+    int32_t rounds = DEFAULT_ROUNDS;
+    timespec_t second = {1, 0};
+    int32_t i, r, cur = 0;
+
+    if (0 == ece391_getargs (arg, ARGSIZE)) {   /* optional argument: number of refreshes */
+        rounds = 0;
+        for (i = 0; arg[i] >= '0' && arg[i] <= '9'; i++)
+            rounds = rounds * 10 + (arg[i] - '0');
+        if (0 == rounds)
+            rounds = DEFAULT_ROUNDS;
+    }
+    if (-1 == (nsnap[cur] = ece391_getstats (snap[cur], MAX_PROCS))) {
+        ece391_fdputs (1, (uint8_t*)"getstats failed\n");
+        return 3;
+    }
+    for (r = 0; r < rounds; r++) {
+        ece391_nanosleep (&second, 0);
+        cur = !cur;
+        if (-1 == (nsnap[cur] = ece391_getstats (snap[cur], MAX_PROCS))) {
+            ece391_fdputs (1, (uint8_t*)"getstats failed\n");
+            return 3;
+        }
+        show (snap[!cur], nsnap[!cur], snap[cur], nsnap[cur]);
+    }
+    return 0;
+}